@@ -30,7 +30,9 @@
 
 //#include "types.h"
 #include "FaxDecoder.h"
+#include "demod_q15.h"
 #include "mem.h"
+#include "log.h"
 
 #include <math.h>
 
@@ -39,53 +41,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
-#define FAX_PRINTF
-#ifdef FAX_PRINTF
-	#define faxprintf(fmt, ...) \
-		fprintf(stdout, fmt, ## __VA_ARGS__)
-#else
-	#define faxprintf(fmt, ...)
-#endif
-
 /* Note: the decoding algorithms are adapted from yahfax (on sourceforge)
    which was an improved adaptation of hamfax. */
 
-static float apply_firfilter(FaxDecoder::firfilter *filter, float sample)
-{
-// Narrow, middle and wide fir low pass filter from ACfax
-    #define TAP_COUNT 17
-    const int32_t tap_count = TAP_COUNT;
-    const float lpfcoeff[3][TAP_COUNT] = {
-          { -7, -18, -15,  11,  56, 116, 177, 223, 240, 223, 177, 116,  56,  11, -15, -18,  -7},
-          {  0, -18, -38, -39,   0,  83, 191, 284, 320, 284, 191,  83,   0, -39, -38, -18,   0},
-          {  6,  20,   7, -42, -74, -12, 159, 353, 440, 353, 159, -12, -74, -42,   7,  20,   6}
-    };
-
-    const float *c = lpfcoeff[filter->bandwidth];
-    const float *c_end = lpfcoeff[filter->bandwidth] + ((sizeof *lpfcoeff) / (sizeof **lpfcoeff));
-    float* const b_begin = filter->buffer;
-    float* const b_end = filter->buffer + tap_count;
-    float sum = 0;
-    
-    float *current = filter->buffer + filter->current;
-    // replace oldest value with current
-    *current = sample;
-    
-    // convolution
-    while (current != b_end)
-        sum += (*current++) * (*c++);
-    current = b_begin;
-    while (c != c_end)
-        sum += (*current++) * (*c++);
-    
-    // point again to oldest value
-    if (--current < b_begin)
-        current = b_end-1;
-    
-    filter->current = current - filter->buffer;
-    return sum;
-}
-
 int qsort_intcomp(const void *elem1, const void *elem2)
 {
 	const int32_t i1 = *(const int32_t *) elem1, i2 = *(const int32_t *) elem2;
@@ -108,18 +66,21 @@ int median_i(int *i, int32_t len, int32_t *pct_1, int32_t *pct_2)
     m_SampleRateRatio = m_SamplesPerSec_frac / m_SamplesPerSec_nom;
 }*/
 
-/* perform fourier transform at a specific frequency to look for start/stop */
+/* perform fourier transform at a specific frequency to look for start/stop.
+   Goertzel: the magnitude of that one bin without a sin/cos per sample,
+   the frequency needs not be a whole number of cycles in the buffer */
 float FaxDecoder::FourierTransformSub(uint8_t* buffer, int32_t samps_per_line, int32_t buffer_len, int32_t freq)
 {
-    int32_t i, n;
-    float k = -2 * M_PI * freq * 60.0 / m_lpm / samps_per_line;
-    float retr = 0, reti = 0;
-    
-    for (n=0, i=1; n < buffer_len; n++, i++) {
-        retr += buffer[n]*MCOS(k*n);
-        reti += buffer[n]*MSIN(k*n);
+    int32_t n;
+    float coeff = 2 * MCOS(2 * M_PI * freq * 60.0 / m_lpm / samps_per_line);
+    float s1 = 0, s2 = 0;
+
+    for (n = 0; n < buffer_len; n++) {
+        float s0 = buffer[n] + coeff*s1 - s2;
+        s2 = s1;
+        s1 = s0;
     }
-    return MSQRT(retr*retr + reti*reti);
+    return MSQRT(MAX(0, s1*s1 + s2*s2 - coeff*s1*s2));
 }
 
 /* see if the fourier transform at the start and stop frequencies reveils header */
@@ -128,7 +89,7 @@ FaxDecoder::Header FaxDecoder::DetectLineType(uint8_t* buffer, int32_t samps_per
      const int32_t threshold = 5; /* 5 is pretty arbitrary but works in practice even with lots of noise */
      float start_det = FourierTransformSub(buffer, samps_per_line, buffer_len, m_Start_IOC576_Frequency) / buffer_len;
      float stop_det = FourierTransformSub(buffer, samps_per_line, buffer_len, m_StopFrequency) / buffer_len;
-    faxprintf("FAX start_det=%.2f stop_det=%.2f\n", start_det, stop_det);
+    FAX_TRACE("FAX start_det=%.2f stop_det=%.2f\n", start_det, stop_det);
 
      if (start_det > threshold)
          return START;
@@ -163,23 +124,37 @@ int FaxDecoder::FaxPhasingLinePosition(uint8_t *image, int32_t samplesPerLine)
         }
     }
 
-    // faxprintf("FAX PhasingLinePosition iter=%d usec=%u\n", samplesPerLine/sampsIncr*n/PIXEL_RESOLUTION, timer_us()-start);
-    faxprintf("FAX PhasingLinePosition iter=%d\n", samplesPerLine/sampsIncr*n/PIXEL_RESOLUTION);
+    // FAX_TRACE("FAX PhasingLinePosition iter=%d usec=%u\n", samplesPerLine/sampsIncr*n/PIXEL_RESOLUTION, timer_us()-start);
+    FAX_TRACE("FAX PhasingLinePosition iter=%d\n", samplesPerLine/sampsIncr*n/PIXEL_RESOLUTION);
     return (samplesPerLine? ((min+n/2) % samplesPerLine) : 0);
 }
 
+/*
+    One demodulated line through START/STOP detection, phasing and image
+    decoding. The settings fixed at Configure are template arguments:
+    HEADER detects START/STOP, PHASING aligns on the phasing lines,
+    HEADERS_IN_IMAGE keeps the lines before the image and RAW emits every
+    line as it is (debug). SelectLineDecoder() picks the instance, so the
+    disabled parts are not compiled in rather than tested on every line.
+*/
+template<bool HEADER, bool PHASING, bool HEADERS_IN_IMAGE, bool RAW>
 bool FaxDecoder::DecodeFaxLine()
 {
     const int32_t phasingSkipLines = 2;
-    
+
+    if (m_stats)
+        m_stats->lines_decoded++;
+
     DemodulateData();
 
     enum Header type;
-    if (m_bSkipHeaderDetection) {
+    if constexpr (!HEADER) {
         type = IMAGE;
     } else {
-        // processing all the line samples for low LPM is too expensive
-        int32_t buffer_len = MIN(m_SamplesPerLine, 3000);
+        FaxStageTimer timer(m_stats, FAX_STAGE_HEADER);
+        // processing all the line samples for low LPM is too expensive,
+        // but a quarter second at least: fewer tone cycles are fooled by the image
+        int32_t buffer_len = MIN(m_SamplesPerLine, MAX(3000, (int32_t)(m_SamplesPerSec_nom / 4)));
         type = DetectLineType(m_demod_data, m_SamplesPerLine, buffer_len);
     }
 
@@ -193,18 +168,39 @@ bool FaxDecoder::DecodeFaxLine()
     }
     lasttype = type;
 
-    if (type != IMAGE) { /* if type is start or stop */
-        /* require 4 less lines than there really are to handle
-           noise and also misalignment on first and last lines */
-        const int32_t leewaylines = 4;
+    if (HEADER && type != IMAGE) { /* if type is start or stop */
+        /* require 2 seconds (4 lines at 120 LPM) less than there really are
+           to handle noise and also misalignment on first and last lines */
+        const int32_t leewaysecs = 2;
+        const int32_t startstoplines = (m_StartStopLength - leewaysecs) * m_lpm / 60;
+
+        FAX_TRACE("FAX L%d %s cnt=%d prepare=%d\n", m_imageline, (type == START)? "START":"STOP", typecount,
+            typecount == startstoplines);
+        if (typecount == startstoplines) {
+            if (m_stats) {
+                if (type == START)
+                    m_stats->start_events++;
+                else
+                    m_stats->stop_events++;
+            }
+
+            if (m_sink) {
+                // lines held for auto align belong before the boundary
+                if (m_alignLines > 0 && m_alignShift < 0 && m_alignCount > 0)
+                    FinishAutoAlign();
+                m_sink->Event((type == START)? FAX_EVENT_START : FAX_EVENT_STOP, m_lineTime);
+
+                // every fax is aligned on its own first lines, not the last one's
+                if (type == START && m_alignLines > 0) {
+                    m_alignCount = 0;
+                    m_alignShift = -1;
+                }
+            }
 
-        faxprintf("FAX L%d %s cnt=%d prepare=%d\n", m_imageline, (type == START)? "START":"STOP", typecount,
-            typecount == m_StartStopLength*2 - leewaylines);
-        if (typecount == m_StartStopLength*2 - leewaylines) {
             if (type == START /* && m_imageline < 100 */) {
                 /* prepare for phasing */
                 /* image start detected, reset image at 0 lines  */
-                if (!m_bIncludeHeadersInImages) {
+                if (!HEADERS_IN_IMAGE) {
                     m_imageline = 0;
                     imgpos = 0;
                     m_lineIncrAcc = 0;
@@ -213,79 +209,96 @@ bool FaxDecoder::DecodeFaxLine()
                 phasingLinesLeft = m_phasingLines;
                 phasingSkipData = 0;
                 have_phasing = false;
+                if (m_autoLpm) {
+                    // measure line rate on the phasing lines after the START tone
+                    m_lpmState = LPM_WAIT;
+                }
                 if (m_autostopped) {
                     // ext_send_msg(m_rx_chan, false, "EXT fax_autostopped=0");
                     m_autostopped = false;
-                    faxprintf("FAX L%d AUTOSTOPPED=0\n", m_imageline);
+                    FAX_DEBUG("FAX L%d AUTOSTOPPED=0\n", m_imageline);
                 }
             } else {
                 // type == STOP
                 if (m_autostop) {
                     // ext_send_msg(m_rx_chan, false, "EXT fax_autostopped=1");
                     m_autostopped = true;
-                    faxprintf("FAX L%d AUTOSTOPPED=1\n", m_imageline);
+                    FAX_DEBUG("FAX L%d AUTOSTOPPED=1\n", m_imageline);
                 }
             }
         }
     }
 
+    if (m_lpmState != LPM_IDLE) {
+        CollectLpm(type);
+    }
+
     /* throw away first 2 lines of phasing because we are not sure
        if they are misaligned start lines */
-    if (m_use_phasing && phasingLinesLeft > 0 && phasingLinesLeft <= m_phasingLines - phasingSkipLines) {
+    if (PHASING && phasingLinesLeft > 0 && phasingLinesLeft <= m_phasingLines - phasingSkipLines) {
+        FaxStageTimer timer(m_stats, FAX_STAGE_PHASING);
         phasingPos[phasingLinesLeft-1] = FaxPhasingLinePosition(m_demod_data, m_SamplesPerLine);
-        faxprintf("FAX L%d phasingPos[%d]=%d\n", m_imageline, phasingLinesLeft-1, phasingPos[phasingLinesLeft-1]);
+        FAX_TRACE("FAX L%d phasingPos[%d]=%d\n", m_imageline, phasingLinesLeft-1, phasingPos[phasingLinesLeft-1]);
     }
 
-    if (m_use_phasing && type == IMAGE && phasingLinesLeft >= -phasingSkipLines) {
+    if (PHASING && type == IMAGE && phasingLinesLeft >= -phasingSkipLines) {
         if (--phasingLinesLeft == 0) {  /* decrement each phasing line */
-        
+            FaxStageTimer timer(m_stats, FAX_STAGE_PHASING);
+
             // DetectLineType() sometimes returns START during IMAGEs with sparse black text on a white background.
             // If the extension was started in the middle of a fax transmission this can result in a false phasing align.
             // Filter that out by looking at the 10%/90% distribution width of the phasing data.
             int32_t ten_pct = 10, ninety_pct = 90;
             phasingSkipData = median_i(phasingPos, m_phasingLines - phasingSkipLines, &ten_pct, &ninety_pct);
-            fprintf(stdout, "FAX L%d SET phasingSkipData=%d 10%%=%d 90%%=%d\n", m_imageline, phasingSkipData, ten_pct, ninety_pct);
+            FAX_DEBUG("FAX L%d SET phasingSkipData=%d 10%%=%d 90%%=%d\n", m_imageline, phasingSkipData, ten_pct, ninety_pct);
             if ((ninety_pct - ten_pct) > m_SamplesPerLine/6) {
-                faxprintf("FAX L%d BAD phasingSkipData\n", m_imageline);
+                FAX_DEBUG("FAX L%d BAD phasingSkipData\n", m_imageline);
                 phasingSkipData = 0;
             }
+
+            if (m_stats) {
+                if (phasingSkipData)
+                    m_stats->phasing_accepted++;
+                else
+                    m_stats->phasing_rejected++;
+            }
         }
     }
 
     /* go past the phasing lines we are skipping to make sure we are in the image */
-    if (m_bIncludeHeadersInImages || !m_use_phasing || (type == IMAGE && phasingLinesLeft < -phasingSkipLines)) {
-        if (m_imageline >= height) {
-            height *= 2;
-            m_imgdata = (uint8_t*) kiwi_irealloc("DecodeFaxLine", m_imgdata, m_imagewidth*height*m_imagecolors);
-            fprintf(stdout, "Kiwi realloc %d, %d, %d\n", m_imagewidth, height, m_imagecolors);
+    if (HEADERS_IN_IMAGE || !PHASING || (type == IMAGE && phasingLinesLeft < -phasingSkipLines)) {
+        if (imgpos >= height*m_imagewidth*m_imagecolors) {
+            imgpos = 0;
         }
 
         /*
             if (m_imageline == 10) {
                 m_autostopped = true;
                 ext_send_msg(m_rx_chan, false, "EXT fax_autostopped=1");
-                faxprintf("FAX L%d TEST AUTOSTOPPED=1\n", m_imageline);
+                FAX_DEBUG("FAX L%d TEST AUTOSTOPPED=1\n", m_imageline);
             }
             if (m_imageline == 20) {
                 m_autostopped = false;
                 ext_send_msg(m_rx_chan, false, "EXT fax_autostopped=0");
-                faxprintf("FAX L%d TEST AUTOSTOPPED=0\n", m_imageline);
+                FAX_DEBUG("FAX L%d TEST AUTOSTOPPED=0\n", m_imageline);
             }
         */
 
-        if (!m_autostopped)
-            DecodeImageLine(m_demod_data, m_SamplesPerLine, m_imgdata+imgpos);
+        if (!m_autostopped) {
+            FaxStageTimer timer(m_stats, FAX_STAGE_LINE);
+            DecodeImageLine<RAW>(m_demod_data, m_SamplesPerLine, m_imgdata+imgpos);
+        }
         
         // fprintf(stdout, "Line decoded: %d\n", m_SamplesPerLine);
 
         phasingSkipData %= m_SamplesPerLine;
 
-        if (phasingSkipData && m_use_phasing && !have_phasing) {
+        if (PHASING && phasingSkipData && !have_phasing) {
             m_skip = phasingSkipData;
             have_phasing = true;
             // ext_send_msg(m_rx_chan, false, "EXT fax_phased");
-            // faxprintf("FAX L%d USE phasingSkipData=%d\n", m_imageline, phasingSkipData);
-            faxprintf("FAX L%d USE phasingSkipData=%d\n", m_fax_line, phasingSkipData);
+            // FAX_DEBUG("FAX L%d USE phasingSkipData=%d\n", m_imageline, phasingSkipData);
+            FAX_DEBUG("FAX L%d USE phasingSkipData=%d\n", m_fax_line, phasingSkipData);
         }
         
         
@@ -301,39 +314,90 @@ bool FaxDecoder::DecodeFaxLine()
 
 void FaxDecoder::DemodulateData()
 {
-    double f=0, ph_inc;
-    int32_t i, j, pixel;
-
     // update sps for mixers
     // UpdateSampleRate();
 
     if (m_SamplesPerSec_frac != m_SamplesPerSec_frac_prev) {
         // ext_send_msg(m_rx_chan, false, "EXT fax_sps_changed");
-        //if (m_rx_chan == 0) faxprintf("FAX sps %.12e %.12e diff=%.3e\n", m_rx_chan,
+        //if (m_rx_chan == 0) FAX_DEBUG("FAX sps %.12e %.12e diff=%.3e\n", m_rx_chan,
         //    m_SamplesPerSec_frac, m_SamplesPerSec_frac_prev, m_SamplesPerSec_frac - m_SamplesPerSec_frac_prev);
         m_SamplesPerSec_frac_prev = m_SamplesPerSec_frac;
     }
-    
-    ph_inc = m_carrier/m_SamplesPerSec_frac;
 
-    float scale = -1.3 * (m_SamplesPerSec_nom/m_deviation/8);
-    for (i=0, j=1; i < m_SamplesPerLine; i++, j++) {
-        // mix to carrier so start/stop/black/white freqs will be relative to zero
+    /* Two passes over the line, so the counters can tell the filter from
+       the discriminator apart and each loop stays small. */
+    if (m_fixedPoint) {
+        {
+            FaxStageTimer timer(m_stats, FAX_STAGE_FIR);
+            MixAndFilterQ15();
+        }
+        {
+            FaxStageTimer timer(m_stats, FAX_STAGE_DEMOD);
+            DiscriminateQ15();
+        }
+        return;
+    }
 
+    {
+        FaxStageTimer timer(m_stats, FAX_STAGE_FIR);
+        MixAndFilter();
+    }
+    {
+        FaxStageTimer timer(m_stats, FAX_STAGE_DEMOD);
+        Discriminate();
+    }
+}
+
+/* mix to carrier so start/stop/black/white freqs will be relative to zero,
+   then low pass filter I and Q, with the kernel picked for the sample rate */
+void FaxDecoder::MixAndFilter()
+{
+    double f=0, ph_inc;
+    int32_t i;
+
+    ph_inc = m_carrier/m_SamplesPerSec_frac;
+
+    for (i=0; i < m_SamplesPerLine; i++) {
         static float normalize_sample = 1.0/32768.0;
         float samp = m_samples[i] * normalize_sample;      // -1..0..1
 
-        float Icur = apply_firfilter(firfilters+0, samp*MCOS(K_2PI*f));
-        float Qcur = apply_firfilter(firfilters+1, samp*MSIN(K_2PI*f));
+        m_lineI[i] = samp*MCOS(K_2PI*f);
+        m_lineQ[i] = samp*MSIN(K_2PI*f);
 
         f += ph_inc;
         if (f > 1.0) f -= 1.0;      // keep bounded
-        
+    }
+
+    m_fir.block(m_firCoeff, m_fir.taps, &firfilters[0].state, m_lineI, m_lineI, m_SamplesPerLine);
+    m_fir.block(m_firCoeff, m_fir.taps, &firfilters[1].state, m_lineQ, m_lineQ, m_SamplesPerLine);
+}
+
+void FaxDecoder::Discriminate()
+{
+    int32_t i, pixel;
+
+    float scale = -1.3 * (m_SamplesPerSec_nom/m_deviation/8);
+    // discriminator output of the white tone when exactly on frequency
+    const float white = 1.3 * K_2PI / 8;
+    int32_t white_above = 0, white_below = 0;
+
+    for (i=0; i < m_SamplesPerLine; i++) {
+        float Icur = m_lineI[i];
+        float Qcur = m_lineQ[i];
+
         float mag = MSQRT(Qcur*Qcur + Icur*Icur);
         Icur /= mag;
         Qcur /= mag;
 
         float x = (Icur*(Qcur-Qprev) - Qcur*(Icur-Iprev)) * scale;
+
+        if (m_afc && x > white*0.5f && x < white*1.5f) {
+            if (x > white)
+                white_above++;
+            else
+                white_below++;
+        }
+
         x = x/2.0 + 0.5;
         pixel = x*255.0;
         pixel = (pixel < 0)? 0 : ((pixel > 255)? 255 : pixel);   // clamp
@@ -342,6 +406,77 @@ void FaxDecoder::DemodulateData()
         Iprev = Icur;
         Qprev = Qcur;
     }
+
+    if (m_afc)
+        UpdateAfc(white_above, white_below);
+}
+
+/* The same in Q15: mixed by a phase accumulator and a cosine table, filtered
+   with the Q15 coefficients of the same filter */
+void FaxDecoder::MixAndFilterQ15()
+{
+    uint32_t phase_inc = llround(m_carrier / m_SamplesPerSec_frac * 4294967296.0);
+
+    demod_q15_mix(m_samples, m_SamplesPerLine, phase_inc, m_lineI16, m_lineQ16);
+
+    fir_block_q15(m_firCoeffQ15, m_fir.taps, &firfilters[0].state_q15, m_lineI16, m_lineI16, m_SamplesPerLine);
+    fir_block_q15(m_firCoeffQ15, m_fir.taps, &firfilters[1].state_q15, m_lineQ16, m_lineQ16, m_SamplesPerLine);
+}
+
+void FaxDecoder::DiscriminateQ15()
+{
+    // as in Discriminate(), in unclamped pixels
+    const float scale = -1.3 * (m_SamplesPerSec_nom/m_deviation/8);
+    const float white = 1.3 * K_2PI / 8;
+    demod_q15_t d;
+
+    d.iprev = Iprev16;
+    d.qprev = Qprev16;
+    d.gain = 127.5f * scale;
+    d.white_lo = 127.5f + 127.5f * white * 0.5f;
+    d.white = 127.5f + 127.5f * white;
+    d.white_hi = 127.5f + 127.5f * white * 1.5f;
+    d.white_above = d.white_below = 0;
+
+    demod_q15_discriminate(&d, m_lineI16, m_lineQ16, m_SamplesPerLine, m_demod_data);
+
+    Iprev16 = d.iprev;
+    Qprev16 = d.qprev;
+
+    if (m_afc)
+        UpdateAfc(d.white_above, d.white_below);
+}
+
+/* Lightweight AFC: keep the median of the white samples on the white tone.
+   A median, unlike a mean, is not dragged by black/white transitions.
+   Only lines with plenty of white are used, on noise the discriminator
+   output is spread all over and few samples fall near white. */
+void FaxDecoder::UpdateAfc(int32_t white_above, int32_t white_below)
+{
+    int32_t white_cnt = white_above + white_below;
+
+    if (white_cnt > m_SamplesPerLine/4) {
+        const double afc_step = m_deviation * 0.01;
+
+        m_afcOffset += afc_step * (white_above - white_below) / white_cnt;
+        m_afcOffset = MAX(-m_deviation/2, MIN(m_deviation/2, m_afcOffset));
+        m_carrier = m_afcBase + m_afcOffset;
+        // the gate listens where the signal is, not where it was configured
+        if (m_gateBlock)
+            SetGateTones();
+    }
+}
+
+void FaxDecoder::SetFixedPoint(bool enable)
+{
+    m_fixedPoint = enable;
+}
+
+void FaxDecoder::SetAfc(bool enable)
+{
+    m_afc = enable;
+    m_afcBase = m_carrier;
+    m_afcOffset = 0;
 }
 
 /*
@@ -349,6 +484,7 @@ void FaxDecoder::DemodulateData()
     Buffer should contain m_SamplesPerSec_nom*60.0/m_lpm*colors bytes.
     Image will contain imagewidth*colors bytes.
 */
+template<bool RAW>
 void FaxDecoder::DecodeImageLine(uint8_t* buffer, int32_t buffer_len, uint8_t *image)
 {
     int32_t pixel;
@@ -356,11 +492,11 @@ void FaxDecoder::DecodeImageLine(uint8_t* buffer, int32_t buffer_len, uint8_t *i
     int32_t spl = m_SamplesPerLine;
 
     if (buffer_len != spl) {
-        faxprintf("FAX m_SamplesPerSec_nom=%.1f buffer_len=%d spl=%d\n", m_SamplesPerSec_nom, buffer_len, spl);
-        fprintf(stderr, "DecodeImageLine requires specific buffer length");
+        FAX_ERROR("DecodeImageLine requires specific buffer length: m_SamplesPerSec_nom=%.1f buffer_len=%d spl=%d\n",
+            m_SamplesPerSec_nom, buffer_len, spl);
     }
 
-    int32_t i, j;
+    int32_t i;
 
     for (i = 0; i < m_imagewidth; i++) {
         
@@ -381,7 +517,7 @@ void FaxDecoder::DecodeImageLine(uint8_t* buffer, int32_t buffer_len, uint8_t *i
     }
     
     bool emit = false;
-    if (m_debug) {
+    if constexpr (RAW) {
         emit = true;
     } else {
         double m_lineNextBlend, m_linePrevBlend;
@@ -390,9 +526,10 @@ void FaxDecoder::DecodeImageLine(uint8_t* buffer, int32_t buffer_len, uint8_t *i
             if (m_imageline != 0 && m_lineIncrAcc != 0) {
                 m_lineNextBlend = m_lineIncrAcc/m_lineBlend;
                 m_linePrevBlend = 1.0 - m_lineNextBlend;
-                j = -m_imagewidth;
-                for (i = 0; i < m_imagewidth; i++, j++) {
-                    pixel = roundf((float)image[i] * m_lineNextBlend + (float)image[j] * m_linePrevBlend);
+                // previous line, the last one of the ring when this is the first
+                const uint8_t *prev = (image == m_imgdata)? m_imgdata + (height-1)*m_imagewidth*m_imagecolors : image - m_imagewidth;
+                for (i = 0; i < m_imagewidth; i++) {
+                    pixel = roundf((float)image[i] * m_lineNextBlend + (float)prev[i] * m_linePrevBlend);
                     pixel = MIN(255, pixel);
                     m_outImage[i] = pixel;
                 }
@@ -406,19 +543,130 @@ void FaxDecoder::DecodeImageLine(uint8_t* buffer, int32_t buffer_len, uint8_t *i
     }
 
     if (emit) {
-        FileWrite(m_outImage, m_imagewidth);
+        EmitLine(m_outImage, m_lineTime);
+    }
+}
+
+/*
+    Pass a finished output line to the sink, holding back the first lines
+    while the horizontal alignment is collected.
+*/
+void FaxDecoder::EmitLine(uint8_t *line, double timestamp)
+{
+    if (m_alignLines > 0) {
+        if (m_alignShift < 0) {
+            memcpy(m_alignBuf + m_alignCount*m_imagewidth, line, m_imagewidth);
+            m_alignTimes[m_alignCount] = timestamp;
+
+            if (++m_alignCount == m_alignLines) {
+                FinishAutoAlign();
+            }
+            return;
+        }
+
+        if (m_alignShift > 0) {
+            int32_t i, j;
+            for (i = 0, j = m_alignShift; j < m_imagewidth; i++, j++)
+                m_alignRow[i] = line[j];
+            for (j = 0; i < m_imagewidth; i++, j++)
+                m_alignRow[i] = line[j];
+            line = m_alignRow;
+        }
+    }
+
+    if (m_sink == NULL) return;
+
+    FaxStageTimer timer(m_stats, FAX_STAGE_WRITE);
+
+    m_sink->Line(std::span<const uint8_t>(line, m_imagewidth), m_fax_line, timestamp);
+    m_fax_line++;
+
+    if (m_stats)
+        m_stats->lines_emitted++;
+
+    if (m_fax_line % 100 == 0) {
+        FAX_INFO("Lines decoded: %d\n", m_fax_line);
+    }
+}
+
+/*
+    Average the collected lines into a column profile and locate the white
+    margin on it the same way the phasing lines are located, then flush
+    the held back lines. Fewer lines than asked for, cut short by a START,
+    STOP or the end of input, are likely tones or noise and pass unshifted.
+*/
+void FaxDecoder::FinishAutoAlign()
+{
+    int32_t i, k;
+
+    if (m_alignCount < m_alignLines) {
+        FAX_DEBUG("FAX auto align on %d of %d lines: not shifted\n", m_alignCount, m_alignLines);
+        m_alignShift = 0;
+
+        for (k = 0; k < m_alignCount; k++)
+            EmitLine(m_alignBuf + k*m_imagewidth, m_alignTimes[k]);
+        return;
+    }
+
+    int32_t *sums = (int32_t*) kiwi_icalloc("FinishAutoAlign", m_imagewidth, sizeof(int32_t));
+
+    for (k = 0; k < m_alignCount; k++) {
+        uint8_t *row = m_alignBuf + k*m_imagewidth;
+        for (i = 0; i < m_imagewidth; i++)
+            sums[i] += row[i];
+    }
+
+    // the profile goes to the rotation buffer, it is not used yet
+    for (i = 0; i < m_imagewidth; i++)
+        m_alignRow[i] = sums[i] / m_alignCount;
+    kiwi_ifree(sums, "FinishAutoAlign");
+
+    m_alignShift = FaxPhasingLinePosition(m_alignRow, m_imagewidth);
+    FAX_INFO("FAX auto align on %d lines: shift %d px, %d samples\n", m_alignCount, m_alignShift, AlignSamples());
+
+    for (k = 0; k < m_alignCount; k++)
+        EmitLine(m_alignBuf + k*m_imagewidth, m_alignTimes[k]);
+}
+
+void FaxDecoder::SetAutoAlign(int32_t lines)
+{
+    if (m_alignBuf) {
+        kiwi_ifree(m_alignBuf, "SetAutoAlign");
+        kiwi_ifree(m_alignRow, "SetAutoAlign");
+        kiwi_ifree(m_alignTimes, "SetAutoAlign");
+        m_alignBuf = m_alignRow = NULL;
+        m_alignTimes = NULL;
+    }
+
+    m_alignLines = lines;
+    m_alignCount = 0;
+    m_alignShift = -1;
+
+    if (m_alignLines > 0) {
+        m_alignBuf = (uint8_t*) kiwi_imalloc("SetAutoAlign", m_alignLines*m_imagewidth);
+        m_alignRow = (uint8_t*) kiwi_imalloc("SetAutoAlign", m_imagewidth);
+        m_alignTimes = (double*) kiwi_imalloc("SetAutoAlign", m_alignLines*sizeof(double));
     }
 }
 
-bool FaxDecoder::ProcessSamples(int16_t *samps, int32_t nsamps, float shift)
+int32_t FaxDecoder::AlignSamples() const
+{
+    if (m_alignShift <= 0 || m_imagewidth == 0)
+        return 0;
+
+    return (int64_t) m_alignShift * m_SamplesPerLine / m_imagewidth;
+}
+
+bool FaxDecoder::ProcessSamples(const int16_t *samps, int32_t nsamps, float shift)
 {
     if ((m_lineLimit > 0) && (m_fax_line >= m_lineLimit)) {
         return false;
     }
 
-    int32_t i = 0;
-    
     if (m_bEndDecoding) return false;
+
+    if (m_stats)
+        m_stats->samples += nsamps;
     
     if (shift) m_skip = shift * m_SamplesPerLine;
 
@@ -426,39 +674,315 @@ bool FaxDecoder::ProcessSamples(int16_t *samps, int32_t nsamps, float shift)
         int32_t skip = MIN(nsamps, m_skip);
         nsamps -= skip;
         samps = &samps[skip];
-        faxprintf("FAX m_skip %d skip %d\n", m_skip, skip);
+        FAX_DEBUG("FAX m_skip %d skip %d\n", m_skip, skip);
         m_skip -= skip;
+        m_inputPos += skip;
     }
 
+    if (m_gateBlock == 0) {
+        FeedSamples(samps, nsamps);
+        return true;
+    }
+
+    while (nsamps > 0) {
+        int32_t n = MIN(nsamps, m_gateBlock);
+
+        if (CarrierGate(samps, n))
+            FeedSamples(samps, n);
+        else
+            m_inputPos += n;
+
+        samps += n;
+        nsamps -= n;
+    }
+
+    return true;
+}
+
+void FaxDecoder::FeedSamples(const int16_t *samps, int32_t nsamps)
+{
+    int32_t i = 0;
+
     while (i < nsamps) {
-        for (; i < nsamps && m_samp_idx < m_SamplesPerLine;) {
-            m_samples[m_samp_idx] = samps[i];
-            m_samp_idx++;
-            m_fi += m_SampleRateRatio;
-            i = trunc(m_fi);
+        {
+            FaxStageTimer timer(m_stats, FAX_STAGE_RESAMPLE);
+
+            for (; i < nsamps && m_samp_idx < m_SamplesPerLine;) {
+                m_samples[m_samp_idx] = samps[i];
+                m_samp_idx++;
+                m_fi += m_SampleRateRatio;
+                i = trunc(m_fi);
+            }
         }
         
         if (m_samp_idx == m_SamplesPerLine) {
-            DecodeFaxLine();
+            m_lineTime = (m_inputPos + i) / m_SamplesPerSec_nom;
+            (this->*m_decodeLine)();
             m_samp_idx = 0;
         }
     }
     m_fi -= nsamps;     // keep bounded
+    m_inputPos += nsamps;
+}
+
+/*
+    Cheap no-carrier detection on a block of raw samples, two tests:
+    - A FM fax signal has a constant envelope whatever the image is, so its
+      mean absolute value is 2*sqrt(2)/pi of RMS, while for (band limited)
+      gaussian noise it is sqrt(2/pi) of RMS. Works for any picture, but
+      only with a decent SNR.
+    - Goertzel power at the black, white and carrier frequencies relative to
+      the block energy, 1.0 for a pure tone and 2/nsamps for noise. Mostly
+      white charts, phasing and START/STOP tones (their spectral lines are
+      at carrier +- n*300/450 Hz) pass it even deep in the noise.
+    Digital silence is caught by the RMS floor.
+*/
+bool FaxDecoder::CarrierGate(const int16_t *samps, int32_t nsamps)
+{
+    const float rms_floor = 16;
+    const float tone_threshold = 0.05;
+    int64_t sum = 0;
+    int32_t i;
+
+    for (i = 0; i < nsamps; i++)
+        sum += samps[i];
+
+    float mean = (float) sum / nsamps;
+    float sum_abs = 0, sum_sq = 0;
+    float b1 = 0, b2 = 0, w1 = 0, w2 = 0, c1 = 0, c2 = 0;
+
+    for (i = 0; i < nsamps; i++) {
+        float x = samps[i] - mean;
+        sum_abs += MFABS(x);
+        sum_sq += x*x;
+
+        float b0 = x + m_gateCoeffBlack*b1 - b2;
+        b2 = b1;
+        b1 = b0;
+        float w0 = x + m_gateCoeffWhite*w1 - w2;
+        w2 = w1;
+        w1 = w0;
+        float c0 = x + m_gateCoeffCarrier*c1 - c2;
+        c2 = c1;
+        c1 = c0;
+    }
+
+    float rms = MSQRT(sum_sq / nsamps);
+    float tones = (b1*b1 + b2*b2 - m_gateCoeffBlack*b1*b2) + (w1*w1 + w2*w2 - m_gateCoeffWhite*w1*w2)
+        + (c1*c1 + c2*c2 - m_gateCoeffCarrier*c1*c2);
+    bool carrier = rms > rms_floor &&
+        ((sum_abs / nsamps) > m_gateThreshold * rms || tones > tone_threshold * sum_sq * nsamps / 2);
+
+    if (carrier) {
+        m_gateHoldLeft = m_gateHold;
+    } else {
+        m_gateHoldLeft = MAX(0, m_gateHoldLeft - nsamps);
+    }
+
+    bool open = m_gateHoldLeft > 0;
 
+    if (open != m_gateOpen) {
+        if (open) {
+            // start over the header detection, next START tone sets up phasing
+            lasttype = IMAGE;
+            typecount = 0;
+        } else {
+            // the partial line would be glued to the next transmission
+            m_samp_idx = 0;
+            m_fi = 0;
+        }
+        FAX_DEBUG("FAX L%d gate %s at %.1f sec\n", m_imageline, open? "OPEN" : "CLOSED", m_gateTotal / m_SamplesPerSec_nom);
+        m_gateOpen = open;
+    }
+
+    m_gateTotal += nsamps;
+    if (!open)
+        m_gateSkipped += nsamps;
+
+    return open;
+}
+
+// Goertzel coefficients of the black, white and carrier tones, follow m_carrier
+void FaxDecoder::SetGateTones()
+{
+    m_gateCoeffBlack = 2 * MCOS(K_2PI * (m_carrier - m_deviation) / m_SamplesPerSec_nom);
+    m_gateCoeffWhite = 2 * MCOS(K_2PI * (m_carrier + m_deviation) / m_SamplesPerSec_nom);
+    m_gateCoeffCarrier = 2 * MCOS(K_2PI * m_carrier / m_SamplesPerSec_nom);
+}
+
+void FaxDecoder::SetCarrierGate(bool enable, float hold_sec, float threshold)
+{
+    // 1/10 second blocks, a fraction of a line at any LPM
+    m_gateBlock = enable? MAX(1, (int32_t)(m_SamplesPerSec_nom / 10)) : 0;
+    m_gateThreshold = threshold;
+    SetGateTones();
+    m_gateHold = hold_sec * m_SamplesPerSec_nom;
+    m_gateHoldLeft = 0;
+    m_gateOpen = !enable;
+    m_gateSkipped = m_gateTotal = 0;
+}
+
+/*
+    Line rate detection. Phasing lines repeat the same short pulse on every
+    line, so the demodulated signal is periodic with the line length. Pick
+    the candidate LPM with the best normalized autocorrelation at its line
+    length; a period also correlates at its multiples, so the shortest lag
+    nearly as good as the best one wins.
+*/
+static const int32_t lpm_candidates[] = {240, 180, 120, 100, 90, 60};
+
+void FaxDecoder::CollectLpm(Header type)
+{
+    if (m_lpmState == LPM_WAIT) {
+        // START tone is periodic at any lag, wait for it to end
+        if (type != IMAGE)
+            return;
+        m_lpmState = LPM_COLLECT;
+        m_lpmFill = 0;
+    }
+
+    int32_t n = MIN(m_SamplesPerLine, m_lpmSize - m_lpmFill);
+    memcpy(m_lpmBuf + m_lpmFill, m_demod_data, n);
+    m_lpmFill += n;
+
+    if (m_lpmFill < m_lpmSize)
+        return;
+
+    m_lpmState = LPM_IDLE;
+
+    int32_t i, c, best = -1;
+    float corr[sizeof lpm_candidates / sizeof *lpm_candidates];
+    const int32_t ncand = sizeof lpm_candidates / sizeof *lpm_candidates;
+
+    int64_t sum = 0;
+    for (i = 0; i < m_lpmSize; i++)
+        sum += m_lpmBuf[i];
+    float mean = (float) sum / m_lpmSize;
+
+    for (c = 0; c < ncand; c++) {
+        int32_t lag = m_SamplesPerSec_nom * 60.0 / lpm_candidates[c];
+        float xy = 0, xx = 0, yy = 0;
+
+        for (i = 0; i + lag < m_lpmSize; i++) {
+            float x = m_lpmBuf[i] - mean, y = m_lpmBuf[i + lag] - mean;
+            xy += x*y;
+            xx += x*x;
+            yy += y*y;
+        }
+        corr[c] = (xx > 0 && yy > 0)? xy / MSQRT(xx*yy) : 0;
+
+        if (best < 0 || corr[c] > corr[best])
+            best = c;
+    }
+
+    const float min_corr = 0.5;
+    if (corr[best] < min_corr) {
+        FAX_DEBUG("FAX L%d LPM not detected, best %d corr=%.2f\n", m_imageline, lpm_candidates[best], corr[best]);
+        return;
+    }
+
+    for (c = 0; c < best; c++) {
+        if (corr[c] >= 0.8 * corr[best]) {
+            best = c;
+            break;
+        }
+    }
+
+    FAX_INFO("FAX L%d LPM detected %d corr=%.2f\n", m_imageline, lpm_candidates[best], corr[best]);
+
+    if (lpm_candidates[best] != m_lpm) {
+        SetLpm(lpm_candidates[best]);
+    }
+}
+
+void FaxDecoder::SetLpm(int32_t lpm)
+{
+    m_lpm = lpm;
+    m_SamplesPerLine = m_SamplesPerSec_nom * 60.0 / m_lpm;
+    m_samp_idx = 0;
+
+    // phasing so far was measured on wrong line length, start it over
+    phasingLinesLeft = m_phasingLines;
+    phasingSkipData = 0;
+    have_phasing = false;
+
+    if (m_stats)
+        m_stats->lpm = m_lpm;
+
+    FAX_INFO("FAX L%d switched to lpm=%d SamplesPerLine=%d\n", m_imageline, m_lpm, m_SamplesPerLine);
+}
+
+void FaxDecoder::SetStats(bool enable)
+{
+    m_stats = NULL;
+
+    if (enable) {
+        fax_stats_reset(&m_statsData);
+        m_statsData.sample_rate = m_SamplesPerSec_nom;
+        m_statsData.lpm = m_lpm;
+        m_statsData.perf = m_perfOpen? &m_perf : NULL;
+        m_stats = &m_statsData;
+    }
+}
+
+bool FaxDecoder::SetPerfCounters(bool enable)
+{
+    if (!enable) {
+        if (m_perfOpen) {
+            fax_perf_close(&m_perf);
+            m_perfOpen = false;
+        }
+        m_statsData.perf = NULL;
+        return true;
+    }
+
+    if (!m_perfOpen && !fax_perf_open(&m_perf)) {
+        return false;
+    }
+
+    m_perfOpen = true;
+    SetStats(true);
     return true;
 }
 
+void FaxDecoder::SetAutoLpm(bool enable)
+{
+    m_autoLpm = enable;
+    m_lpmState = LPM_IDLE;
+
+    // line rate is only measured after a START tone, without auto LPM the
+    // configured decoder skips its detection again if it did
+    m_bSkipHeaderDetection = m_autoLpm? false : m_configSkipHeaderDetection;
+    SelectLineDecoder();
+
+    if (m_autoLpm) {
+        // four lines of the slowest rate
+        m_lpmSize = m_SamplesPerSec_nom * 60.0 / FAX_MIN_LPM * 4;
+
+        if (m_lpmSize > m_lpmCapacity) {
+            kiwi_ifree(m_lpmBuf, "SetAutoLpm");
+            m_lpmBuf = (uint8_t*) kiwi_imalloc("SetAutoLpm", m_lpmSize);
+            m_lpmCapacity = m_lpmSize;
+        }
+    }
+}
+
 void FaxDecoder::InitializeImage()
 {
-    height = m_imgsize / 2 / m_SamplesPerSec_nom / 60.0 * m_lpm;
+    height = FAX_IMAGE_LINES;
     imgpos = 0;
 
-    if (height == 0) /* for unknown size, start out at 256 */
-        height = 256;
+    size_t size = (size_t)m_imagewidth*height*m_imagecolors;
+
+    if (size > m_imgAlloc) {
+        FreeImage();
+        m_imgdata  = (uint8_t*) kiwi_imalloc("InitializeImage", size);
+        m_outImage = (uint8_t*) kiwi_imalloc("InitializeImage", m_imagewidth*m_imagecolors);
+        m_imgAlloc = size;
+    }
 
-    FreeImage();
-    m_imgdata  = (uint8_t*) kiwi_imalloc("InitializeImage", m_imagewidth*height*m_imagecolors);
-    m_outImage = (uint8_t*) kiwi_imalloc("InitializeImage", m_imagewidth*m_imagecolors);
+    m_imageline = 0;
+    m_lineIncrAcc = 0;
 
     lasttype = IMAGE;
     typecount = 0;
@@ -466,8 +990,8 @@ void FaxDecoder::InitializeImage()
     m_autostopped = false;
 }
 
-bool FaxDecoder::Configure(int lpm, int32_t imagewidth, int32_t BitsPerPixel, int32_t carrier,
-                           int32_t deviation, enum firfilter::Bandwidth bandwidth,
+bool FaxDecoder::Configure(int lpm, int32_t imagewidth, int32_t BitsPerPixel, double carrier,
+                           double deviation, enum firfilter::Bandwidth bandwidth,
                            double minus_saturation_threshold,
                            bool bIncludeHeadersInImages, bool use_phasing, bool autostop,
                            int32_t debug, bool reset, double sample_rate, double srcorr, int32_t lineLimit)
@@ -476,15 +1000,21 @@ bool FaxDecoder::Configure(int lpm, int32_t imagewidth, int32_t BitsPerPixel, in
     m_BitsPerPixel = BitsPerPixel;
     m_carrier = carrier;
     m_deviation = deviation;
+    m_afc = false;
+    m_fixedPoint = false;
+    m_autoLpm = false;
+    m_lpmState = LPM_IDLE;
+    m_afcBase = carrier;
+    m_afcOffset = 0;
     m_minus_saturation_threshold = minus_saturation_threshold;
     m_bIncludeHeadersInImages = bIncludeHeadersInImages;
     m_use_phasing = use_phasing;
     m_autostop = autostop;
-    m_bSkipHeaderDetection = (m_use_phasing || m_autostop)? false : true;
+    m_bSkipHeaderDetection = m_configSkipHeaderDetection = (m_use_phasing || m_autostop)? false : true;
     
     m_imagecolors = 1;
 
-    m_lpm = lpm;
+    m_lpm = m_configLpm = lpm;
     m_bFM = true;
     m_Start_IOC576_Frequency = 300;
     m_Start_IOC288_Frequency = 675;
@@ -498,7 +1028,18 @@ bool FaxDecoder::Configure(int lpm, int32_t imagewidth, int32_t BitsPerPixel, in
     firfilters[0] = firfilter(bandwidth);
     firfilters[1] = firfilter(bandwidth);
 
+    bool width_changed = imagewidth != m_imagewidth;
+
+    if (width_changed) {
+        // the image buffers are sized by lines
+        FreeImage();
+    }
     m_imagewidth = imagewidth;
+
+    // so are the auto align ones
+    if (width_changed && m_alignLines > 0) {
+        SetAutoAlign(m_alignLines);
+    }
     // /* must reset if image width changes */
     // if (m_imagewidth != imagewidth || reset) {
     //     m_imagewidth = imagewidth;
@@ -508,13 +1049,19 @@ bool FaxDecoder::Configure(int lpm, int32_t imagewidth, int32_t BitsPerPixel, in
     m_lineIncrFrac = m_imagewidth / (M_PI * 576);
     m_bEndDecoding = false;
     m_debug = debug;
-    fprintf(stdout, "FAX Configure lpm=%d car=%.3f dev=%.3f debug=%d\n", m_lpm, m_carrier, m_deviation, m_debug);
+    FAX_INFO("FAX Configure lpm=%d car=%.3f dev=%.3f debug=%d\n", m_lpm, m_carrier, m_deviation, m_debug);
 
     m_SamplesPerSec_frac = sample_rate * srcorr;// * 1.000092;
     m_SamplesPerSec_nom = sample_rate;
     m_SampleRateRatio = m_SamplesPerSec_frac / m_SamplesPerSec_nom;
 
-    fprintf(stdout, "FAX Configure m_SamplesPerSec_frac=%0.3f m_SamplesPerSec_nom=%.3f m_SampleRateRatio=%.3f \n", m_SamplesPerSec_frac, m_SamplesPerSec_nom, m_SampleRateRatio);
+    m_fir = fir_kernel(m_SamplesPerSec_nom, bandwidth, m_firCoeff);
+    fir_coeff_q15(m_firCoeff, m_fir.taps, m_firCoeffQ15);
+    FAX_DEBUG("FAX Configure %d FIR taps\n", m_fir.taps);
+    if (m_gateBlock)
+        SetGateTones();
+
+    FAX_DEBUG("FAX Configure m_SamplesPerSec_frac=%0.3f m_SamplesPerSec_nom=%.3f m_SampleRateRatio=%.3f \n", m_SamplesPerSec_frac, m_SamplesPerSec_nom, m_SampleRateRatio);
 
     // if (reset) {
         // CleanUpBuffers();
@@ -524,9 +1071,62 @@ bool FaxDecoder::Configure(int lpm, int32_t imagewidth, int32_t BitsPerPixel, in
         SetupBuffers();
     // }
 
+    SelectLineDecoder();
+
     return true;
 }
 
+void FaxDecoder::SelectLineDecoder()
+{
+    // [header][phasing][headers in image][raw]
+    static const line_decoder_fn decoders[2][2][2][2] = {
+        {{{&FaxDecoder::DecodeFaxLine<false, false, false, false>, &FaxDecoder::DecodeFaxLine<false, false, false, true>},
+          {&FaxDecoder::DecodeFaxLine<false, false, true, false>,  &FaxDecoder::DecodeFaxLine<false, false, true, true>}},
+         {{&FaxDecoder::DecodeFaxLine<false, true, false, false>,  &FaxDecoder::DecodeFaxLine<false, true, false, true>},
+          {&FaxDecoder::DecodeFaxLine<false, true, true, false>,   &FaxDecoder::DecodeFaxLine<false, true, true, true>}}},
+        {{{&FaxDecoder::DecodeFaxLine<true, false, false, false>,  &FaxDecoder::DecodeFaxLine<true, false, false, true>},
+          {&FaxDecoder::DecodeFaxLine<true, false, true, false>,   &FaxDecoder::DecodeFaxLine<true, false, true, true>}},
+         {{&FaxDecoder::DecodeFaxLine<true, true, false, false>,   &FaxDecoder::DecodeFaxLine<true, true, false, true>},
+          {&FaxDecoder::DecodeFaxLine<true, true, true, false>,    &FaxDecoder::DecodeFaxLine<true, true, true, true>}}},
+    };
+
+    m_decodeLine = decoders[!m_bSkipHeaderDetection][m_use_phasing][m_bIncludeHeadersInImages][m_debug != 0];
+}
+
+// fax_bench times the image line stage on its own
+template void FaxDecoder::DecodeImageLine<false>(uint8_t* buffer, int32_t buffer_len, uint8_t *image);
+
+void FaxDecoder::Reset()
+{
+    firfilters[0] = firfilter(firfilters[0].bandwidth);
+    firfilters[1] = firfilter(firfilters[1].bandwidth);
+    Iprev = Qprev = 0;
+    Iprev16 = Qprev16 = 0;
+    m_lineBlend = 0;
+    m_skip = 0;
+    m_offset = 0;
+    m_bEndDecoding = false;
+    m_fax_line = 0;
+
+    m_carrier = m_afcBase;      // where AFC started, not where it left the last input
+    m_afcOffset = 0;
+    if (m_gateBlock)
+        SetGateTones();
+    m_lpm = m_configLpm;
+    m_lpmState = LPM_IDLE;
+    m_alignCount = 0;
+    m_alignShift = -1;
+    m_gateOpen = (m_gateBlock == 0);
+    m_gateHoldLeft = 0;
+    m_gateSkipped = m_gateTotal = 0;
+
+    InitializeImage();
+    SetupBuffers();
+
+    if (m_stats)
+        SetStats(true);
+}
+
 void FaxDecoder::SetupBuffers()
 {
     // initial approx sps to set samplesPerMin/Line
@@ -536,15 +1136,37 @@ void FaxDecoder::SetupBuffers()
     m_SamplesPerLine = samplesPerMin / m_lpm;
     // m_BytesPerLine = m_SamplesPerLine * 2;
     
-    faxprintf("FAX SamplesPerSec=%.3f/%.0f lpm=%d SamplesPerLine=%d\n",
+    FAX_DEBUG("FAX SamplesPerSec=%.3f/%.0f lpm=%d SamplesPerLine=%d\n",
         m_SamplesPerSec_frac, m_SamplesPerSec_nom, m_lpm, m_SamplesPerLine);
     
-    m_samples = new int16_t[m_SamplesPerLine];
+    // room for the slowest supported line rate, so SetLpm() never reallocates
+    int32_t capacity = samplesPerMin / MIN(m_lpm, FAX_MIN_LPM);
+
+    if (capacity > m_lineCapacity) {
+        kiwi_ifree(m_samples, "SetupBuffers");
+        kiwi_ifree(m_demod_data, "SetupBuffers");
+        kiwi_ifree(m_lineI, "SetupBuffers");
+        kiwi_ifree(m_lineQ, "SetupBuffers");
+        kiwi_ifree(m_lineI16, "SetupBuffers");
+        kiwi_ifree(m_lineQ16, "SetupBuffers");
+        m_samples = (int16_t*) kiwi_imalloc("SetupBuffers", capacity*sizeof(int16_t));
+        m_demod_data = (uint8_t*) kiwi_imalloc("SetupBuffers", capacity);
+        m_lineI = (float*) kiwi_imalloc("SetupBuffers", capacity*sizeof(float));
+        m_lineQ = (float*) kiwi_imalloc("SetupBuffers", capacity*sizeof(float));
+        m_lineI16 = (int16_t*) kiwi_imalloc("SetupBuffers", capacity*sizeof(int16_t));
+        m_lineQ16 = (int16_t*) kiwi_imalloc("SetupBuffers", capacity*sizeof(int16_t));
+        m_lineCapacity = capacity;
+    }
+
+    if (phasingPos == NULL) {
+        // m_phasingLines is fixed
+        phasingPos = (int32_t*) kiwi_imalloc("SetupBuffers", m_phasingLines*sizeof(int32_t));
+    }
+
     m_samp_idx = 0;
     m_fi = 0;
-    m_demod_data = new uint8_t[m_SamplesPerLine];
-
-    phasingPos = new int[m_phasingLines];
+    m_inputPos = 0;
+    m_lineTime = 0;
     phasingLinesLeft = phasingSkipData = 0;
     have_phasing = false;
 
@@ -555,13 +1177,10 @@ void FaxDecoder::SetupBuffers()
 
 void FaxDecoder::FreeImage()
 {
-    if (m_imgdata) {
-        kiwi_ifree(m_imgdata, "FreeImage");
-    }
-
-    if (m_outImage) {
-        kiwi_ifree(m_outImage, "FreeImage");
-    }
+    kiwi_ifree(m_imgdata, "FreeImage");
+    kiwi_ifree(m_outImage, "FreeImage");
+    m_imgdata = m_outImage = NULL;
+    m_imgAlloc = 0;
 
     m_imageline = 0;
     m_lineIncrAcc = 0;
@@ -569,76 +1188,69 @@ void FaxDecoder::FreeImage()
 
 void FaxDecoder::CleanUpBuffers()
 {
-     delete [] m_samples;
-     delete [] m_demod_data;
-     delete [] phasingPos;
+    kiwi_ifree(m_samples, "CleanUpBuffers");
+    kiwi_ifree(m_demod_data, "CleanUpBuffers");
+    kiwi_ifree(m_lineI, "CleanUpBuffers");
+    kiwi_ifree(m_lineQ, "CleanUpBuffers");
+    kiwi_ifree(m_lineI16, "CleanUpBuffers");
+    kiwi_ifree(m_lineQ16, "CleanUpBuffers");
+    kiwi_ifree(phasingPos, "CleanUpBuffers");
+    kiwi_ifree(m_lpmBuf, "CleanUpBuffers");
+    kiwi_ifree(m_alignBuf, "CleanUpBuffers");
+    kiwi_ifree(m_alignRow, "CleanUpBuffers");
+    kiwi_ifree(m_alignTimes, "CleanUpBuffers");
+
+    m_samples = NULL;
+    m_demod_data = NULL;
+    m_lineI = m_lineQ = NULL;
+    m_lineI16 = m_lineQ16 = NULL;
+    m_lineCapacity = 0;
+    phasingPos = NULL;
+    m_lpmBuf = NULL;
+    m_lpmCapacity = 0;
+    m_alignBuf = m_alignRow = NULL;
+    m_alignTimes = NULL;
 }
 
 // SECURITY:
 // Little bit of a security hole: Can look at previously saved fax images by downloading the fixed filename.
 // Not a big deal really.
 
-void FaxDecoder::FileOpen(const char *fn)
+void FaxDecoder::SetLineSink(FaxLineSink *sink)
 {
-    // m_fn = fn;
+    m_sink = sink;
+    m_fax_line = 0;
+}
 
+void FaxDecoder::FileOpen(const char *fn)
+{
     FileClose();
-    // asprintf(&m_fn, DIR_DATA "/fax.ch%d.pgm", m_rx_chan);
-    // m_file = pgm_file_open(m_fn, &m_offset, m_imagewidth, 0, 255);
-    m_file = fopen(fn, "w");
-    
-    if (m_file != NULL) {
-        m_offset = fprintf(m_file, "P5 %d ", m_imagewidth);
-        // reserve space for height (written later with pgm_file_height()) using a fixed-length field
-        fprintf(m_file, "%6d %d\n", 0, 255);
-    }
 
-    if (m_file == NULL) {
-        faxprintf("FAX open FAILED %s\n", fn);
-    } else {
-        faxprintf("FAX open %s\n", fn);
+    if (!m_pgmSink.Open(fn, m_imagewidth)) {
+        FAX_ERROR("FAX open FAILED %s\n", fn);
+        return;
     }
+
+    FAX_INFO("FAX open %s\n", fn);
+    SetLineSink(&m_pgmSink);
 }
 
 void FaxDecoder::FileWrite(uint8_t *data, int32_t datalen)
 {
-    if (m_file == NULL) return;
-    
-    fwrite(data, datalen, 1, m_file);
-    m_fax_line++;
+    if (!m_pgmSink.IsOpen()) return;
 
-    // With each data write to the file update image header too,
-    // so it would be readable if utility is killed midst processing.
-    // Usefull for partial decode, when image tilt is evaluated by eye.
-    int32_t pos = ftell(m_file);
-    
-    fseek(m_file, m_offset, SEEK_SET);
-    fprintf(m_file, "%6d", m_fax_line);
-    
-    if (m_fax_line % 100 == 0) {
-        fprintf(stdout, "Lines decoded: %d\n", m_fax_line);
-    }
-
-    fseek(m_file, pos, SEEK_SET);
+    FaxStageTimer timer(m_stats, FAX_STAGE_WRITE);
+    m_pgmSink.Line(std::span<const uint8_t>(data, datalen), m_fax_line++, m_lineTime);
 }
 
 void FaxDecoder::FileClose()
 {
-    if (m_file == NULL) return;
-    
-    fflush(m_file);
-    
-    fseek(m_file, m_offset, SEEK_SET);
-    if (m_fax_line > 999999) {
-        m_fax_line = 999999;
-        fprintf(stdout, "height limited to 999999!\n");
+    if (m_sink == NULL) return;
+
+    if (m_alignLines > 0 && m_alignShift < 0) {
+        FinishAutoAlign();
     }
-    fprintf(m_file, "%6d", m_fax_line);
-    
-    fclose(m_file);
-    // faxprintf("FAX %s wrote %d lines\n", m_fn, m_fax_line);
-    faxprintf("FAX wrote %d lines\n", m_fax_line);
-    
-    m_file = NULL;
+
+    m_sink->Close();
     m_fax_line = 0;
 }
@@ -30,12 +30,18 @@
 #pragma once
 //#include "types.h"
 #include "datatypes.h"
+#include "fir.h"
+#include "linesink.h"
+#include "stats.h"
 #include <stdint.h>
 
 #define FAX_MSG_CLEAR   255
 #define FAX_MSG_DRAW    254
 #define FAX_MSG_SCOPE   0       // channel 0, 1, 2, 3
 
+#define FAX_MIN_LPM     60      // line buffers are sized for it
+#define FAX_IMAGE_LINES 16      // decoded lines kept in m_imgdata, the image goes to the line sink
+
 class FaxDecoder
 {
 public:
@@ -43,18 +49,18 @@ public:
     struct firfilter {
         enum Bandwidth {NARROW, MIDDLE, WIDE};
         firfilter() {}
-        firfilter(enum Bandwidth b) : bandwidth(b), current(0)
-            { for(int i=0; i<17; i++) buffer[i] = 0; }
+        firfilter(enum Bandwidth b) : bandwidth(b)
+            { state.pos = 0; for(int i=0; i<2*FIR_MAX_TAPS; i++) state.history[i] = 0;
+              state_q15.pos = 0; for(int i=0; i<2*FIR_MAX_TAPS+FIR_Q15_PAD; i++) state_q15.history[i] = 0; }
         enum Bandwidth bandwidth;
-        float buffer[17];
-        int32_t current;
+        fir_state_t state;
+        fir_state_q15_t state_q15;
     };
 
     FaxDecoder():
         m_rx_chan {0},
         m_fn {NULL},
-        //int m_file,
-        m_file {NULL},
+        m_sink {NULL},
         m_bEndDecoding {false},
         m_SamplesPerSec_nom {0.0},
         m_SamplesPerSec_frac {0.0},
@@ -67,31 +73,116 @@ public:
         m_BytesPerLine {0},
         Iprev {0.0},
         Qprev {0.0},
+        Iprev16 {0},
+        Qprev16 {0},
         m_samples {NULL},
         m_samp_idx{0},
+        m_lineCapacity {0},
         m_demod_data {NULL},
         m_imgdata {NULL},
         m_outImage {NULL},
+        m_imagewidth {0},
         m_skip {0},
         m_imageline {0},
         m_fax_line {0},
+        m_inputPos {0},
+        m_lineTime {0.0},
+        m_fixedPoint {false},
+        m_configSkipHeaderDetection {true},
         m_bIncludeHeadersInImages {true},
-        m_lineLimit {0}
+        m_decodeLine {NULL},
+        m_imgAlloc {0},
+        phasingPos {NULL},
+        m_lineLimit {0},
+        m_alignLines {0},
+        m_alignCount {0},
+        m_alignShift {-1},
+        m_alignBuf {NULL},
+        m_alignRow {NULL},
+        m_alignTimes {NULL},
+        m_gateBlock {0},
+        m_gateOpen {true},
+        m_gateHold {0},
+        m_gateHoldLeft {0},
+        m_gateSkipped {0},
+        m_gateTotal {0},
+        m_autoLpm {false},
+        m_lpmState {LPM_IDLE},
+        m_lpmBuf {NULL},
+        m_lpmSize {0},
+        m_lpmCapacity {0},
+        m_stats {NULL},
+        m_perfOpen {false},
+        m_lineI {NULL},
+        m_lineQ {NULL},
+        m_lineI16 {NULL},
+        m_lineQ16 {NULL}
     { 
         
     }
         
-    ~FaxDecoder() { FreeImage(); CleanUpBuffers(); }
+    ~FaxDecoder() { FreeImage(); CleanUpBuffers(); SetPerfCounters(false); }
 
-    bool Configure(int lpm, int32_t imagewidth, int32_t BitsPerPixel, int32_t carrier,
-                   int32_t deviation, enum firfilter::Bandwidth bandwidth,
+    bool Configure(int lpm, int32_t imagewidth, int32_t BitsPerPixel, double carrier,
+                   double deviation, enum firfilter::Bandwidth bandwidth,
                    double minus_saturation_threshold, bool bIncludeHeadersInImages,
                    bool use_phasing, bool autostop, int32_t debug, bool reset, double sample_rate, double srcorr, int32_t lineLimit);
 
-    bool ProcessSamples(int16_t *samps, int32_t nsamps, float shift);
+    // Start over on new input with the same settings, like a freshly configured
+    // decoder. Buffers are kept, Configure() also reuses them when large enough.
+    void Reset();
+
+    bool ProcessSamples(const int16_t *samps, int32_t nsamps, float shift);
+
+    // Finished lines go to the sink (not owned), NULL drops them.
+    // FileOpen() sets the built-in PGM file sink, FileWrite() writes to it directly.
+    void SetLineSink(FaxLineSink *sink);
+    FaxLineSink *LineSink() const { return m_sink; }
     void FileOpen(const char *);
     void FileWrite(uint8_t *data, int32_t datalen);
+    // Flushes the lines held back by auto align and closes the sink
     void FileClose();
+
+    // Find the white margin stripe over the first "lines" output lines and rotate
+    // all output rows by it. Meant for faxes without (or with failed) phasing.
+    void SetAutoAlign(int32_t lines);
+    // Detected rotation in pixels, -1 until enough lines are collected
+    int32_t AlignShift() const { return m_alignShift; }
+    // The same rotation expressed in samples, as for "--drop"
+    int32_t AlignSamples() const;
+
+    // Skip demodulation of blocks without a fax carrier. Carrier is assumed when the block
+    // has a constant envelope (mean |x| over RMS above threshold, 0.90 for a pure tone,
+    // 0.80 for noise) or strong black/white/carrier tones; the gate is held open for hold_sec
+    // after the last such block.
+    void SetCarrierGate(bool enable, float hold_sec = 10.0, float threshold = 0.85);
+    double GateSkippedSeconds() const { return m_gateSkipped / m_SamplesPerSec_nom; }
+    double GateTotalSeconds() const { return m_gateTotal / m_SamplesPerSec_nom; }
+
+    // Track carrier drift by keeping the white tone on its nominal frequency,
+    // correction is limited to +-deviation/2 from the configured carrier.
+    void SetAfc(bool enable);
+    double AfcOffset() const { return m_afcOffset; }
+
+    // Demodulate in Q15 fixed point instead of float (mixer, filter and
+    // discriminator), for CPUs with slow float like the Raspberry Pi.
+    // Images differ from the float ones by a gray level or two.
+    void SetFixedPoint(bool enable);
+    bool FixedPoint() const { return m_fixedPoint; }
+
+    // Detect line rate from the phasing lines of every transmission and switch
+    // to it in place (60..240 LPM, buffers are allocated for FAX_MIN_LPM).
+    void SetAutoLpm(bool enable);
+    void SetLpm(int32_t lpm);
+    int32_t Lpm() const { return m_lpm; }
+
+    // Per stage timers and event counters, NULL while disabled.
+    // Enabling resets them; read and DC removal are timed by the caller.
+    void SetStats(bool enable);
+    FaxStats *Stats() const { return m_stats; }
+    // Hardware counters per stage on top of the stats (enables them), for the
+    // thread that calls ProcessSamples. False when perf events are not available.
+    bool SetPerfCounters(bool enable);
     
     bool DecodeFaxFromFilename();
     bool DecodeFaxFromDSP();
@@ -100,23 +191,39 @@ public:
     void InitializeImage();
     void FreeImage();
 
+    // ring of the last FAX_IMAGE_LINES decoded lines, memory stays the same however long the input
     uint8_t *m_imgdata, *m_outImage;
     int32_t m_imageline;
     int32_t m_imagewidth;
     double m_minus_saturation_threshold;
 
 private:
-    bool DecodeFaxLine();
+    // stage microbenchmarks drive the private hot paths directly
+    friend class FaxBench;
+
+    template<bool HEADER, bool PHASING, bool HEADERS_IN_IMAGE, bool RAW> bool DecodeFaxLine();
+    // The DecodeFaxLine() instance for the settings, called per line
+    void SelectLineDecoder();
     void DemodulateData();
+    void MixAndFilter();
+    void Discriminate();
+    void MixAndFilterQ15();
+    void DiscriminateQ15();
+    void UpdateAfc(int32_t white_above, int32_t white_below);
+    void FeedSamples(const int16_t *samps, int32_t nsamps);
+    bool CarrierGate(const int16_t *samps, int32_t nsamps);
+    void SetGateTones();
 
     void SetupBuffers();
     void CleanUpBuffers();
 
     int32_t m_rx_chan;
     char *m_fn;
-    //int m_file;
-    FILE *m_file;
+    PgmFileSink m_pgmSink;
+    FaxLineSink *m_sink;
     int32_t m_fax_line;
+    int64_t m_inputPos;         /* samples handed to ProcessSamples so far */
+    double m_lineTime;          /* input position of the last line end, seconds */
     bool m_bEndDecoding;        /* flag to end decoding thread */
     double m_SamplesPerSec_nom;
     double m_SamplesPerSec_frac, m_SamplesPerSec_frac_prev;
@@ -126,26 +233,40 @@ private:
     int32_t m_BytesPerLine;
 
     float Iprev, Qprev;
+    int16_t Iprev16, Qprev16;
     int16_t *m_samples;
     int32_t m_samp_idx;
+    int32_t m_lineCapacity;     /* samples of the line buffers */
     uint8_t *m_demod_data;
 
     enum Header {IMAGE, START, STOP};
 
     float FourierTransformSub(uint8_t* buffer, int32_t samps_per_line, int32_t buffer_len, int32_t freq);
     Header DetectLineType(uint8_t* buffer, int32_t samps_per_line, int32_t buffer_len);
-    void DecodeImageLine(uint8_t* buffer, int32_t buffer_len, uint8_t *image);
+    template<bool RAW> void DecodeImageLine(uint8_t* buffer, int32_t buffer_len, uint8_t *image);
+    void CollectLpm(Header type);
+    void EmitLine(uint8_t *line, double timestamp);
+    void FinishAutoAlign();
     int32_t FaxPhasingLinePosition(uint8_t *image, int32_t samplesPerLine);
     void UpdateSampleRate();
 
     /* fax settings */
     int32_t m_BitsPerPixel;
     double m_carrier, m_deviation;
+    bool m_afc;
+    double m_afcBase, m_afcOffset;
     struct firfilter firfilters[2];
+    fir_kernel_t m_fir;         /* for the sample rate, shared by I and Q */
+    float m_firCoeff[FIR_MAX_TAPS];
+    int16_t m_firCoeffQ15[FIR_MAX_TAPS + FIR_Q15_PAD];
+    bool m_fixedPoint;
     bool m_bSkipHeaderDetection;
+    bool m_configSkipHeaderDetection;   /* before auto LPM switched it */
     bool m_bIncludeHeadersInImages;
     bool m_use_phasing;
     bool m_autostop, m_autostopped;
+    typedef bool (FaxDecoder::*line_decoder_fn)();
+    line_decoder_fn m_decodeLine;
     int32_t m_imagecolors;
     int32_t m_lpm;
     bool m_bFM;
@@ -154,6 +275,8 @@ private:
     int32_t m_phasingLines;
     int32_t m_offset;
     int32_t m_imgsize;
+    size_t m_imgAlloc;          /* bytes of m_imgdata */
+    int32_t m_configLpm;        /* before auto LPM switched it */
 
     int32_t height, imgpos;
 
@@ -167,6 +290,30 @@ private:
     bool have_phasing;
     int32_t m_debug;
     int32_t m_lineLimit;
+
+    int32_t m_alignLines, m_alignCount, m_alignShift;
+    uint8_t *m_alignBuf, *m_alignRow;
+    double *m_alignTimes;
+
+    int32_t m_gateBlock;
+    bool m_gateOpen;
+    float m_gateThreshold, m_gateCoeffBlack, m_gateCoeffWhite, m_gateCoeffCarrier;
+    int64_t m_gateHold, m_gateHoldLeft;
+    int64_t m_gateSkipped, m_gateTotal;
+
+    enum LpmState {LPM_IDLE, LPM_WAIT, LPM_COLLECT};
+    bool m_autoLpm;
+    LpmState m_lpmState;
+    uint8_t *m_lpmBuf;
+    int32_t m_lpmSize, m_lpmFill, m_lpmCapacity;
+
+    FaxStats m_statsData, *m_stats;
+    FaxPerfCounters m_perf;
+    bool m_perfOpen;
+
+    // mixed and low pass filtered line, input of the discriminator
+    float *m_lineI, *m_lineQ;
+    int16_t *m_lineI16, *m_lineQ16;     // the same in Q15
 };
 
 // extern FaxDecoder m_FaxDecoder[MAX_RX_CHANS];
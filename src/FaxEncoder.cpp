@@ -0,0 +1,218 @@
+#include "FaxEncoder.h"
+#include "datatypes.h"
+
+#include <algorithm>
+
+bool FaxEncoder::Configure(int32_t lpm, double sample_rate, double carrier, double deviation,
+                           double skew_ppm, double amplitude, double noise, double dc_offset, uint64_t seed)
+{
+    if (lpm <= 0 || sample_rate <= 0) {
+        return false;
+    }
+
+    m_lpm = lpm;
+    m_SamplesPerSec = sample_rate * (1.0 + skew_ppm / 1000000.0);
+    m_SamplesPerLine = m_SamplesPerSec * 60.0 / m_lpm;
+    m_lineAcc = 0;
+    m_carrier = carrier;
+    m_deviation = deviation;
+    m_amplitude = amplitude;
+    m_noise = noise;
+    m_dc = dc_offset;
+    m_phase = 0;
+    // xorshift must not start from 0
+    m_rng = seed? seed : 0x9E3779B97F4A7C15ULL;
+
+    return true;
+}
+
+/* Line length in whole samples, the fraction is carried to the next line
+   so a skewed clock drifts exactly as a real one would. */
+int32_t FaxEncoder::NextLineLength()
+{
+    m_lineAcc += m_SamplesPerLine;
+    int32_t n = (int32_t) m_lineAcc;
+    m_lineAcc -= n;
+    return n;
+}
+
+/* sin() of a 32 bit phase: an odd polynomial on [-pi/2, pi/2] */
+static inline float phase_sin(uint32_t phase)
+{
+    const float to_rad = K_PI / 2147483648.0;
+
+    float x = (int32_t) phase * to_rad;             // -pi..pi
+    x = (x > (float)K_PI2)? (float)K_PI - x : x;
+    x = (x < -(float)K_PI2)? -(float)K_PI - x : x;  // -pi/2..pi/2
+    float x2 = x * x;
+    return x * (1.0f + x2 * (-1.0f/6 + x2 * (1.0f/120 + x2 * (-1.0f/5040 + x2 * (1.0f/362880)))));
+}
+
+/* NCO: phase increments are accumulated in 32 bit fixed point (wraps for free),
+   sine is an odd polynomial on [-pi/2, pi/2] so the loop vectorizes. */
+void FaxEncoder::Modulate(const float *freq, int32_t nsamps, std::vector<int16_t> &out)
+{
+    const double phase_scale = 4294967296.0 / m_SamplesPerSec;
+    int32_t i;
+
+    m_phases.resize(nsamps);
+    uint32_t *phases = m_phases.data();
+    uint32_t phase = m_phase;
+
+    for (i = 0; i < nsamps; i++) {
+        phases[i] = phase;
+        phase += (uint32_t)(int64_t)(freq[i] * phase_scale);
+    }
+    m_phase = phase;
+
+    const int32_t channels = m_iq? 2 : 1;
+    size_t start = out.size();
+    out.resize(start + (size_t) nsamps * channels);
+    int16_t *dst = &out[start];
+
+    const float amplitude = m_amplitude, dc = m_dc;
+
+    if (m_iq) {
+        // cos and sin, the cosine is the sine a quarter turn later
+        for (i = 0; i < nsamps; i++) {
+            float vi = dc + amplitude * phase_sin(phases[i] + 0x40000000u);
+            float vq = dc + amplitude * phase_sin(phases[i]);
+            dst[2 * i] = (int16_t) lrintf(std::min(32767.0f, std::max(-32768.0f, vi)));
+            dst[2 * i + 1] = (int16_t) lrintf(std::min(32767.0f, std::max(-32768.0f, vq)));
+        }
+    } else {
+        for (i = 0; i < nsamps; i++) {
+            float v = dc + amplitude * phase_sin(phases[i]);
+            v = std::min(32767.0f, std::max(-32768.0f, v));
+            dst[i] = (int16_t) lrintf(v);
+        }
+    }
+
+    AddNoise(dst, nsamps * channels);
+}
+
+/* Gaussian noise approximated by a sum of four 16 bit uniforms (Irwin-Hall)
+   taken from one xorshift64* draw. */
+void FaxEncoder::AddNoise(int16_t *out, int32_t nsamps)
+{
+    if (m_noise == 0) {
+        return;
+    }
+
+    const float mean = 4 * 32767.5f;
+    const float scale = m_noise / 37837.2f;       // sqrt(4 * (65536^2 - 1) / 12)
+    uint64_t x = m_rng;
+
+    for (int32_t i = 0; i < nsamps; i++) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        uint64_t r = x * 2685821657736338717ULL;
+        float sum = (float)(r & 0xffff) + (float)((r >> 16) & 0xffff) + (float)((r >> 32) & 0xffff) + (float)(r >> 48);
+        float v = out[i] + (sum - mean) * scale;
+        v = std::min(32767.0f, std::max(-32768.0f, v));
+        out[i] = (int16_t) lrintf(v);
+    }
+
+    m_rng = x;
+}
+
+void FaxEncoder::Tone(int32_t freq, double seconds, std::vector<int16_t> &out)
+{
+    int32_t nsamps = seconds * m_SamplesPerSec;
+    m_freq.resize(nsamps);
+
+    for (int32_t i = 0; i < nsamps; i++) {
+        double cycles = (double)i * freq / m_SamplesPerSec;
+        bool white = (cycles - (int64_t)cycles) < 0.5;
+        m_freq[i] = m_carrier + (white? m_deviation : -m_deviation);
+    }
+
+    Modulate(m_freq.data(), nsamps, out);
+}
+
+void FaxEncoder::PhasingLines(int32_t lines, std::vector<int16_t> &out)
+{
+    for (int32_t l = 0; l < lines; l++) {
+        int32_t nsamps = NextLineLength();
+        int32_t pulse = nsamps / 40;    // 2.5% on both ends of the line
+        m_freq.resize(nsamps);
+
+        for (int32_t i = 0; i < nsamps; i++) {
+            bool white = i < pulse || i >= nsamps - pulse;
+            m_freq[i] = m_carrier + (white? m_deviation : -m_deviation);
+        }
+
+        Modulate(m_freq.data(), nsamps, out);
+    }
+}
+
+void FaxEncoder::ImageLine(const uint8_t *pixels, int32_t width, std::vector<int16_t> &out)
+{
+    int32_t nsamps = NextLineLength();
+    m_freq.resize(nsamps);
+
+    const float black = m_carrier - m_deviation;
+    const float step = 2.0 * m_deviation / 255.0;
+
+    for (int32_t i = 0; i < nsamps; i++) {
+        int32_t x = (int64_t)i * width / nsamps;
+        m_freq[i] = black + step * pixels[x];
+    }
+
+    Modulate(m_freq.data(), nsamps, out);
+}
+
+void FaxEncoder::Gap(double seconds, std::vector<int16_t> &out)
+{
+    int32_t nsamps = seconds * m_SamplesPerSec * (m_iq? 2 : 1);
+    size_t start = out.size();
+
+    out.resize(start + nsamps, (int16_t) lrint(m_dc));
+    AddNoise(&out[start], nsamps);
+}
+
+void FaxEncoder::Transmission(const uint8_t *image, int32_t width, int32_t height, std::vector<int16_t> &out)
+{
+    Tone(m_StartFrequency, m_StartStopSeconds, out);
+    PhasingLines(m_PhasingSeconds * m_lpm / 60, out);
+
+    for (int32_t y = 0; y < height; y++) {
+        ImageLine(image + (size_t)y * width, width, out);
+    }
+
+    Tone(m_StopFrequency, m_StartStopSeconds, out);
+}
+
+void FaxEncoder::TestPattern(uint8_t *image, int32_t width, int32_t height)
+{
+    const int32_t margin = width / 25;
+    const int32_t grid = MAX(1, width / 9);
+
+    for (int32_t y = 0; y < height; y++) {
+        uint8_t *row = image + (size_t)y * width;
+        bool ramp = y >= height * 45 / 100 && y < height / 2;
+
+        for (int32_t x = 0; x < width; x++) {
+            uint8_t v = 255;
+
+            if (x >= margin) {
+                if (ramp) {
+                    v = (x - margin) * 255 / MAX(1, width - margin - 1);
+                } else {
+                    // text-like blocks, hashed from their cell
+                    uint32_t h = (uint32_t)(x / 23) * 2654435761u ^ (uint32_t)(y / 9) * 40503u;
+                    h ^= h >> 13;
+                    h *= 0x5bd1e995;
+                    h ^= h >> 15;
+
+                    if ((h & 7) == 0 || (x % grid) < 3 || (y % 100) < 2) {
+                        v = 0;
+                    }
+                }
+            }
+
+            row[x] = v;
+        }
+    }
+}
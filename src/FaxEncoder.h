@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Synthetic radio fax signal generator, the inverse of FaxDecoder.
+//
+// Produces a FM modulated transmission: START tone, phasing lines, image
+// lines and STOP tone, with optional sound card clock skew, gaussian noise
+// and DC offset. Output is reproducible for the same seed.
+//
+// Samples are appended to the given vector, so long workloads can be
+// streamed line by line without keeping the whole recording in memory.
+class FaxEncoder
+{
+public:
+    FaxEncoder():
+        m_lpm {120},
+        m_SamplesPerSec {12000.0},
+        m_SamplesPerLine {6000.0},
+        m_lineAcc {0.0},
+        m_carrier {1900.0},
+        m_deviation {400.0},
+        m_amplitude {16384.0},
+        m_noise {0.0},
+        m_dc {0.0},
+        m_iq {false},
+        m_phase {0},
+        m_rng {1}
+    {
+    }
+
+    // skew_ppm: the "true" sample rate is sample_rate * (1 + skew_ppm / 1000000),
+    // i.e. decoding it back requires "-s skew_ppm".
+    // noise is gaussian noise RMS and dc_offset a constant, both in 16 bit sample units.
+    bool Configure(int32_t lpm, double sample_rate, double carrier, double deviation,
+                   double skew_ppm, double amplitude, double noise, double dc_offset, uint64_t seed);
+
+    // Complex output: interleaved I/Q pairs, the carrier is an offset from the
+    // center of the band and may be negative
+    void SetIq(bool iq) { m_iq = iq; }
+
+    // START (300 Hz) or STOP (450 Hz) tone: black and white alternating at the given rate
+    void Tone(int32_t freq, double seconds, std::vector<int16_t> &out);
+    // Black lines with a 5% white pulse centered at the line start
+    void PhasingLines(int32_t lines, std::vector<int16_t> &out);
+    // One line of 8 bit gray pixels, 0 is black and 255 white
+    void ImageLine(const uint8_t *pixels, int32_t width, std::vector<int16_t> &out);
+    // No carrier, only noise and DC offset
+    void Gap(double seconds, std::vector<int16_t> &out);
+
+    // Whole transmission: START tone, phasing, image and STOP tone
+    void Transmission(const uint8_t *image, int32_t width, int32_t height, std::vector<int16_t> &out);
+
+    // Deterministic chart-like picture: white margin, grid, text-like blocks and a gray ramp
+    static void TestPattern(uint8_t *image, int32_t width, int32_t height);
+
+    static const int32_t m_StartFrequency = 300;
+    static const int32_t m_StopFrequency = 450;
+    static const int32_t m_StartStopSeconds = 5;
+    static const int32_t m_PhasingSeconds = 30;
+
+private:
+    int32_t NextLineLength();
+    void Modulate(const float *freq, int32_t nsamps, std::vector<int16_t> &out);
+    void AddNoise(int16_t *out, int32_t nsamps);
+
+    int32_t m_lpm;
+    double m_SamplesPerSec;
+    double m_SamplesPerLine, m_lineAcc;
+    double m_carrier, m_deviation;
+    double m_amplitude, m_noise, m_dc;
+    bool m_iq;
+
+    uint32_t m_phase;
+    uint64_t m_rng;
+
+    std::vector<float> m_freq;
+    std::vector<uint32_t> m_phases;
+};
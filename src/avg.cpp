@@ -27,6 +27,14 @@ void int16_subtract(int16_t *data, const size_t size, int16_t avg) {
     }
 }
 
+void int16_deinterleave(const int16_t *data, const size_t frames, const int32_t channels, int16_t *const *out) {
+    for (size_t i = 0; i < frames; i++) {
+        for (int32_t c = 0; c < channels; c++) {
+            out[c][i] = data[i * channels + c];
+        }
+    }
+}
+
 #if defined(__AVX512F__) && defined(__AVX512DQ__)
 float int16_float_avx512_average(const int16_t *data, const size_t size) {
     if (size < 256) {
@@ -36,9 +44,11 @@ float int16_float_avx512_average(const int16_t *data, const size_t size) {
     __m512 avg_vec = _mm512_setzero_ps();
     __m512i count_vec = _mm512_set1_epi32(0);
 
-    float averages[16];
+    // whole vectors only, the tail is done below
+    size_t remainder = size % 16;
+    size_t vec_size = size - remainder;
 
-    for (size_t i = 0; i < size; i += 16) {
+    for (size_t i = 0; i < vec_size; i += 16) {
         __m256i data_vec_16 = _mm256_loadu_si256((__m256i*)&data[i]);
         __m512i data_vec = _mm512_cvtepi16_epi32(data_vec_16);
         __m512 values = _mm512_cvtepi32_ps(data_vec);
@@ -56,10 +66,8 @@ float int16_float_avx512_average(const int16_t *data, const size_t size) {
 
     float avg = _mm512_reduce_add_ps(_mm512_mul_ps(avg_vec, one_sixteenth_vec));
 
-    size_t remainder = size % 16;
-
     if (remainder > 0) {
-        for (size_t i {size - remainder}; i < size; i++) {
+        for (size_t i {vec_size}; i < size; i++) {
             avg += (data[i] - avg) / (i + 1);
         }
     }
@@ -75,9 +83,10 @@ double int16_avx512_average(const int16_t *data, const size_t size) {
     __m512d avg_vec = _mm512_setzero_pd();
     __m512i count_vec = _mm512_set1_epi64(0);
 
-    double averages[8];
+    size_t remainder = size % 8;
+    size_t vec_size = size - remainder;
 
-    for (size_t i = 0; i < size; i += 8) {
+    for (size_t i = 0; i < vec_size; i += 8) {
         __m128i data_vec_16 = _mm_loadu_si128((__m128i*)&data[i]);
         __m256i data_vec = _mm256_cvtepi16_epi32(data_vec_16);
         __m512d values = _mm512_cvtepi32_pd(data_vec);
@@ -91,10 +100,8 @@ double int16_avx512_average(const int16_t *data, const size_t size) {
 
     double avg = _mm512_reduce_add_pd(_mm512_mul_pd(avg_vec, one_eighth_vec));
 
-    size_t remainder = size % 8;
-
     if (remainder > 0) {
-        for (size_t i {size - remainder}; i < size; i++) {
+        for (size_t i {vec_size}; i < size; i++) {
             avg += (data[i] - avg) / (i + 1);
         }
     }
@@ -107,29 +114,113 @@ void int16_avx512_subtract(int16_t *data, const size_t size, int16_t avg) {
         return int16_subtract(data, size, avg);
     }
 
-    int16_t avgs[32];
+    __m512i avg_vec = _mm512_set1_epi16(avg);
 
-    for (size_t i = 0; i < 32; i++) {
-        avgs[i] = avg;
-    }
-// printf("SUBTRACT AVX\n");
-    __m512i avg_vec = _mm512_loadu_si512(avgs);
+    size_t remainder = size % 32;
+    size_t vec_size = size - remainder;
 
-    for (size_t i {0}; i < size; i += 32) {
+    for (size_t i {0}; i < vec_size; i += 32) {
         __m512i data_vec = _mm512_loadu_si512(&data[i]);
         __m512i diff_vec = _mm512_sub_epi16(data_vec, avg_vec);
         _mm512_storeu_si512(&data[i], diff_vec);
     }
 
-    size_t remainder = size % 32;
-
     if (remainder > 0) {
-        for (size_t i {size - remainder}; i < size; i++) {
+        for (size_t i {vec_size}; i < size; i++) {
             data[i] -= avg;
         }
     }
 }
+
+#ifdef __AVX512BW__
+void int16_avx512_deinterleave(const int16_t *data, const size_t frames, const int32_t channels, int16_t *const *out) {
+    if ((channels != 2 && channels != 4 && channels != 8) || frames < 32) {
+        return int16_deinterleave(data, frames, channels, out);
+    }
+
+    // even and odd samples of two vectors
+    __m512i even = _mm512_set_epi16(62, 60, 58, 56, 54, 52, 50, 48, 46, 44, 42, 40, 38, 36, 34, 32,
+                                    30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10,  8,  6,  4,  2,  0);
+    __m512i odd = _mm512_add_epi16(even, _mm512_set1_epi16(1));
+
+    size_t remainder = frames % 32;
+    size_t vec_frames = frames - remainder;
+
+    for (size_t i = 0; i < vec_frames; i += 32) {
+        // 32 frames, channels vectors. Each pass splits the vector pairs into
+        // their even and odd samples, after log2(channels) passes vector c
+        // holds channel c.
+        __m512i v[8], t[8];
+
+        for (int32_t k = 0; k < channels; k++) {
+            v[k] = _mm512_loadu_si512(&data[i * channels + k * 32]);
+        }
+
+        const int32_t half = channels / 2;
+
+        for (int32_t pass = 1; pass < channels; pass *= 2) {
+
+            for (int32_t k = 0; k < half; k++) {
+                t[k] = _mm512_permutex2var_epi16(v[2 * k], even, v[2 * k + 1]);
+                t[half + k] = _mm512_permutex2var_epi16(v[2 * k], odd, v[2 * k + 1]);
+            }
+
+            for (int32_t k = 0; k < channels; k++) {
+                v[k] = t[k];
+            }
+        }
+
+        for (int32_t c = 0; c < channels; c++) {
+            _mm512_storeu_si512(&out[c][i], v[c]);
+        }
+    }
+
+    if (remainder > 0) {
+        int16_t *tail[8];
+
+        for (int32_t c = 0; c < channels; c++) {
+            tail[c] = out[c] + vec_frames;
+        }
+
+        int16_deinterleave(data + vec_frames * channels, remainder, channels, tail);
+    }
+}
+#endif
+
 #elif defined(__ARM_NEON)
+void int16_neon_deinterleave(const int16_t *data, const size_t frames, const int32_t channels, int16_t *const *out) {
+    if ((channels != 2 && channels != 4) || frames < 8) {
+        return int16_deinterleave(data, frames, channels, out);
+    }
+
+    size_t remainder = frames % 8;
+    size_t vec_frames = frames - remainder;
+
+    for (size_t i = 0; i < vec_frames; i += 8) {
+        if (channels == 2) {
+            int16x8x2_t v = vld2q_s16(&data[i * 2]);
+            vst1q_s16(&out[0][i], v.val[0]);
+            vst1q_s16(&out[1][i], v.val[1]);
+        } else {
+            int16x8x4_t v = vld4q_s16(&data[i * 4]);
+            vst1q_s16(&out[0][i], v.val[0]);
+            vst1q_s16(&out[1][i], v.val[1]);
+            vst1q_s16(&out[2][i], v.val[2]);
+            vst1q_s16(&out[3][i], v.val[3]);
+        }
+    }
+
+    if (remainder > 0) {
+        int16_t *tail[4];
+
+        for (int32_t c = 0; c < channels; c++) {
+            tail[c] = out[c] + vec_frames;
+        }
+
+        int16_deinterleave(data + vec_frames * channels, remainder, channels, tail);
+    }
+}
+
 float int16_float_neon_average(const int16_t *data, const size_t size) {
     if (size < 256) {
         return int16_float_average(data, size);
@@ -138,24 +229,40 @@ float int16_float_neon_average(const int16_t *data, const size_t size) {
     float32x4_t avg_vec = vdupq_n_f32(0.0f);
     uint32x4_t count_vec	= vdupq_n_u32(0);
 
-    for (size_t i = 0; i < size; i += 4) {
+    size_t remainder = size % 4;
+    size_t vec_size = size - remainder;
+
+    for (size_t i = 0; i < vec_size; i += 4) {
         int16x4_t data_vec_16 = vld1_s16(&data[i]);
         int32x4_t data_vec = vmovl_s16(data_vec_16);
         float32x4_t values = vcvtq_f32_s32(data_vec);
 
         count_vec = vaddq_u32(count_vec, vdupq_n_u32(1));
+#if defined(__aarch64__)
         avg_vec = vaddq_f32(avg_vec, vdivq_f32(vsubq_f32(values, avg_vec), vcvtq_f32_u32(count_vec)));
+#else
+        // ARMv7 has no vector divide, the reciprocal estimate refined twice to float precision
+        float32x4_t count_f = vcvtq_f32_u32(count_vec);
+        float32x4_t r = vrecpeq_f32(count_f);
+        r = vmulq_f32(vrecpsq_f32(count_f, r), r);
+        r = vmulq_f32(vrecpsq_f32(count_f, r), r);
+        avg_vec = vaddq_f32(avg_vec, vmulq_f32(vsubq_f32(values, avg_vec), r));
+#endif
     }
 
     const float one_fourth[4] = {0.25, 0.25, 0.25, 0.25};
     
     float32x4_t one_fourth_vec = vld1q_f32(one_fourth);
+#if defined(__aarch64__)
     float avg = vaddvq_f32(vmulxq_f32(avg_vec, one_fourth_vec));
-
-    size_t remainder = size % 4;
+#else
+    float32x4_t quarter_vec = vmulq_f32(avg_vec, one_fourth_vec);
+    float32x2_t pair = vadd_f32(vget_low_f32(quarter_vec), vget_high_f32(quarter_vec));
+    float avg = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
 
     if (remainder > 0) {
-        for (size_t i {size - remainder}; i < size; i++) {
+        for (size_t i {vec_size}; i < size; i++) {
             avg += (data[i] - avg) / (i + 1);
         }
     }
@@ -17,6 +17,9 @@ double int16_average(const int16_t *data, const size_t size);
 
 void int16_subtract(int16_t *data, const size_t size, int16_t avg);
 
+// Interleaved frames of a multi-channel recording split into one buffer per channel
+void int16_deinterleave(const int16_t *data, const size_t frames, const int32_t channels, int16_t *const *out);
+
 #if defined(__AVX512F__) && defined(__AVX512DQ__)
 
 float int16_float_avx512_average(const int16_t *data, const size_t size);
@@ -29,11 +32,23 @@ void int16_avx512_subtract(int16_t *data, const size_t size, int16_t avg);
 
 #define SAMPLES_SUBTRACT(d, s, a) int16_avx512_subtract(d, s, a)
 
+#ifdef __AVX512BW__
+// 2, 4 and 8 channels, the others go to the scalar code
+void int16_avx512_deinterleave(const int16_t *data, const size_t frames, const int32_t channels, int16_t *const *out);
+#define DEINTERLEAVE(d, f, c, o) int16_avx512_deinterleave(d, f, c, o)
+#else
+#define DEINTERLEAVE(d, f, c, o) int16_deinterleave(d, f, c, o)
+#endif
+
 #elif defined(__ARM_NEON)
 float int16_float_neon_average(const int16_t *data, const size_t size);
 #define FLOAT_AVERAGE(d, s) int16_float_neon_average(d, s)
 #define SAMPLES_SUBTRACT(d, s, a) int16_subtract(d, s, a) // TODO: add support for NEON
+// 2 and 4 channels
+void int16_neon_deinterleave(const int16_t *data, const size_t frames, const int32_t channels, int16_t *const *out);
+#define DEINTERLEAVE(d, f, c, o) int16_neon_deinterleave(d, f, c, o)
 #else
 #define FLOAT_AVERAGE(d, s) int16_float_average(d, s)
 #define SAMPLES_SUBTRACT(d, s, a) int16_subtract(d, s, a)
+#define DEINTERLEAVE(d, f, c, o) int16_deinterleave(d, f, c, o)
 #endif
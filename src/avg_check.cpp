@@ -0,0 +1,476 @@
+/*********************************************************************************
+ *
+ * Project:  FAX Decoder
+ * Purpose:  differential tests and timing of the SIMD sample kernels (avg.cpp)
+ * Author:   Darau, Blė
+ *
+ **********************************************************************************
+ *   Copyright (C) 2023 by Darau, Blė                                             *
+ *                                                                                *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ * of this software and associated documentation files (the "Software"), to deal  *
+ * in the Software without restriction, including without limitation the rights   *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ * copies of the Software, and to permit persons to whom the Software is          *
+ * furnished to do so, subject to the following conditions:                       *
+ *                                                                                *
+ * The above copyright notice and this permission notice shall be included in all *
+ * copies or substantial portions of the Software.                                *
+ *                                                                                *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ * SOFTWARE.                                                                      *
+ *                                                                                *
+ **********************************************************************************
+ */
+#define VERSION "1.0.6"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+#include <getopt.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "avg.h"
+#include "datatypes.h"
+
+// Every kernel is run against the scalar reference. The scalar running mean is
+// itself compared against an exact (long double) sum, so a drifting reference
+// does not hide a drifting SIMD variant.
+
+struct average_variant_t {
+    const char *name;
+    double (*fn)(const int16_t *data, const size_t size);
+    double tolerance;       // relative to the largest sample magnitude
+};
+
+struct subtract_variant_t {
+    const char *name;
+    void (*fn)(int16_t *data, const size_t size, int16_t avg);
+};
+
+static const average_variant_t average_variants[] = {
+    {"float scalar",  [](const int16_t *d, const size_t s) -> double { return int16_float_average(d, s); }, 2e-5},
+    {"double scalar", int16_average, 1e-10},
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+    {"float avx512",  [](const int16_t *d, const size_t s) -> double { return int16_float_avx512_average(d, s); }, 2e-5},
+    {"double avx512", int16_avx512_average, 1e-10},
+#endif
+#ifdef __ARM_NEON
+    {"float neon",    [](const int16_t *d, const size_t s) -> double { return int16_float_neon_average(d, s); }, 2e-5},
+#endif
+};
+
+static const subtract_variant_t subtract_variants[] = {
+    {"scalar", int16_subtract},
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+    {"avx512", int16_avx512_subtract},
+#endif
+};
+
+struct deinterleave_variant_t {
+    const char *name;
+    void (*fn)(const int16_t *data, const size_t frames, const int32_t channels, int16_t *const *out);
+};
+
+static const deinterleave_variant_t deinterleave_variants[] = {
+    {"scalar", int16_deinterleave},
+#if defined(__AVX512F__) && defined(__AVX512DQ__) && defined(__AVX512BW__)
+    {"avx512", int16_avx512_deinterleave},
+#endif
+#ifdef __ARM_NEON
+    {"neon", int16_neon_deinterleave},
+#endif
+};
+
+static const int32_t deinterleave_channels[] = {2, 3, 4, 8};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// Buffer with an inaccessible page on both sides. The samples either end
+// exactly at the trailing guard page (any read or write past the end faults)
+// or start at a chosen misalignment after the leading one.
+class GuardedBuffer
+{
+public:
+    GuardedBuffer(size_t max_samples)
+    {
+        m_page = sysconf(_SC_PAGESIZE);
+        m_rw = ((max_samples + 64) * sizeof(int16_t) + m_page - 1) / m_page * m_page;
+        m_map = (uint8_t *) mmap(NULL, m_rw + 2 * m_page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (m_map == MAP_FAILED || mprotect(m_map + m_page, m_rw, PROT_READ | PROT_WRITE) != 0) {
+            perror("guard page mapping");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ~GuardedBuffer()
+    {
+        munmap(m_map, m_rw + 2 * m_page);
+    }
+
+    int16_t *AtEnd(size_t samples)
+    {
+        return (int16_t *)(m_map + m_page + m_rw) - samples;
+    }
+
+    int16_t *AtStart(size_t misalign)
+    {
+        return (int16_t *)(m_map + m_page) + misalign;
+    }
+
+private:
+    size_t m_page, m_rw;
+    uint8_t *m_map;
+};
+
+static sigjmp_buf fault_env;
+static volatile sig_atomic_t fault_signal;
+
+static void fault_handler(int sig)
+{
+    fault_signal = sig;
+    siglongjmp(fault_env, 1);
+}
+
+// Runs a kernel, false when it faulted. sigsetjmp() is in here, so no local
+// of the caller is live across the jump
+template <typename F>
+static bool run_guarded(F &&kernel)
+{
+    if (sigsetjmp(fault_env, 1) != 0) {
+        return false;
+    }
+
+    kernel();
+    return true;
+}
+
+static uint64_t rng_state = 1;
+
+static uint64_t rng()
+{
+    uint64_t x = rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng_state = x;
+    return x * 2685821657736338717ULL;
+}
+
+static size_t random_size(size_t max_size)
+{
+    switch (rng() % 8) {
+        // around the SIMD thresholds and lane multiples
+        case 0: return 256 + rng() % 97;
+        case 1: return (rng() % 64 + 8) * 32 + rng() % 3 - 1;
+        // long buffers, one second of audio and more
+        case 2: return rng() % (max_size + 1);
+        default: return rng() % 4096;
+    }
+}
+
+static void random_values(int16_t *data, size_t size)
+{
+    switch (rng() % 4) {
+        case 0:     // full scale noise
+            for (size_t i = 0; i < size; i++) {
+                data[i] = (int16_t) rng();
+            }
+            break;
+        case 1: {   // audio-like: a tone around a DC offset
+            int32_t dc = (int32_t)(rng() % 20001) - 10000;
+            int32_t amp = rng() % 20000;
+            double w = 0.01 + (rng() % 1000) / 1000.0;
+            for (size_t i = 0; i < size; i++) {
+                data[i] = (int16_t) MAX(-32768, MIN(32767, dc + (int32_t)(amp * sin(w * i))));
+            }
+            break;
+        }
+        case 2: {   // constant, the extremes included
+            int16_t v = (rng() & 1)? ((rng() & 1)? 32767 : -32768) : (int16_t) rng();
+            for (size_t i = 0; i < size; i++) {
+                data[i] = v;
+            }
+            break;
+        }
+        default:    // small values
+            for (size_t i = 0; i < size; i++) {
+                data[i] = (int16_t)(rng() % 64) - 32;
+            }
+            break;
+    }
+}
+
+static long double exact_average(const int16_t *data, size_t size, int32_t *peak)
+{
+    long double sum = 0;
+
+    *peak = 1;
+
+    for (size_t i = 0; i < size; i++) {
+        sum += data[i];
+        *peak = MAX(*peak, abs(data[i]));
+    }
+
+    return size? sum / size : 0;
+}
+
+static int32_t failures = 0;
+
+static void report(const char *kernel, const char *variant, size_t size, const char *where, size_t misalign, const char *what)
+{
+    if (failures++ < 20) {
+        fprintf(stdout, "FAIL %s %s: size %zu, %s, misalign %zu: %s\n", kernel, variant, size, where, misalign, what);
+    }
+}
+
+static void check_case(GuardedBuffer &buf, size_t size, bool at_end, size_t misalign)
+{
+    static std::vector<int16_t> data, expected;
+    const char *where = at_end? "at guard" : "after guard";
+    int16_t *p = at_end? buf.AtEnd(size) : buf.AtStart(misalign);
+
+    if (at_end) {
+        misalign = ((uintptr_t)p & 63) / sizeof(int16_t);
+    }
+
+    data.resize(size);
+    random_values(data.data(), size);
+    memcpy(p, data.data(), size * sizeof(int16_t));
+
+    int32_t peak;
+    const long double exact = exact_average(p, size, &peak);
+    char what[128];
+
+    for (const auto &v : average_variants) {
+        double avg = 0;
+
+        if (!run_guarded([&]() { avg = v.fn(p, size); })) {
+            snprintf(what, sizeof what, "signal %d, out of bounds access", (int) fault_signal);
+            report("average", v.name, size, where, misalign, what);
+            continue;
+        }
+
+        if (memcmp(p, data.data(), size * sizeof(int16_t)) != 0) {
+            report("average", v.name, size, where, misalign, "input modified");
+            memcpy(p, data.data(), size * sizeof(int16_t));
+        }
+
+        // the running mean loses precision as the buffer grows
+        if (!(fabsl(avg - exact) <= v.tolerance * peak)) {
+            snprintf(what, sizeof what, "%.6f, expected %.6Lf", avg, exact);
+            report("average", v.name, size, where, misalign, what);
+        }
+    }
+
+    int16_t dc = (int16_t) rng();
+
+    expected = data;
+    int16_subtract(expected.data(), size, dc);
+
+    for (const auto &v : subtract_variants) {
+        memcpy(p, data.data(), size * sizeof(int16_t));
+
+        if (!run_guarded([&]() { v.fn(p, size, dc); })) {
+            snprintf(what, sizeof what, "signal %d, out of bounds access", (int) fault_signal);
+            report("subtract", v.name, size, where, misalign, what);
+            continue;
+        }
+
+        if (memcmp(p, expected.data(), size * sizeof(int16_t)) != 0) {
+            size_t i = 0;
+            while (p[i] == expected[i]) {
+                i++;
+            }
+            snprintf(what, sizeof what, "sample %zu is %d, expected %d", i, p[i], expected[i]);
+            report("subtract", v.name, size, where, misalign, what);
+        }
+    }
+
+    // the input is what the guard pages protect, the outputs are checked for their length
+    memcpy(p, data.data(), size * sizeof(int16_t));
+
+    for (int32_t channels : deinterleave_channels) {
+        static std::vector<int16_t> planes[8];
+        int16_t *out[8];
+        const size_t frames = size / channels;
+
+        for (int32_t c = 0; c < channels; c++) {
+            planes[c].assign(frames + 1, 0x5a5a);
+            out[c] = planes[c].data();
+        }
+
+        for (const auto &v : deinterleave_variants) {
+            if (!run_guarded([&]() { v.fn(p, frames, channels, out); })) {
+                snprintf(what, sizeof what, "%d channels: signal %d, out of bounds access", channels, (int) fault_signal);
+                report("deinterleave", v.name, size, where, misalign, what);
+                continue;
+            }
+
+            for (int32_t c = 0; c < channels; c++) {
+                for (size_t i = 0; i <= frames; i++) {
+                    int16_t want = (i < frames)? data[i * channels + c] : 0x5a5a;
+
+                    if (planes[c][i] != want) {
+                        snprintf(what, sizeof what, "%d channels: channel %d frame %zu is %d, expected %d",
+                            channels, c, i, planes[c][i], want);
+                        report("deinterleave", v.name, size, where, misalign, what);
+                        c = channels;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Calls "unit" until min_time has passed, returns Msamples/s
+template<typename F> static double measure(F unit, size_t size, double min_time)
+{
+    uint64_t calls = 0;
+    double start = now(), elapsed;
+
+    do {
+        for (int32_t i = 0; i < 16; i++) {
+            unit();
+        }
+        calls += 16;
+        elapsed = now() - start;
+    } while (elapsed < min_time);
+
+    return calls * size / elapsed / 1e6;
+}
+
+static void timing(size_t size, double min_time)
+{
+    std::vector<int16_t> data(size);
+    volatile double sink = 0;
+
+    random_values(data.data(), size);
+    fprintf(stdout, "\nTiming, %zu samples per call:\n", size);
+
+    double base = 0;
+
+    for (const auto &v : average_variants) {
+        double msps = measure([&]() { sink = sink + v.fn(data.data(), size); }, size, min_time);
+        base = (base == 0)? msps : base;
+        fprintf(stdout, "  average  %-14s %9.1f Msamples/s  %5.2fx\n", v.name, msps, msps / base);
+    }
+
+    base = 0;
+
+    for (const auto &v : subtract_variants) {
+        // alternating sign keeps the data bounded
+        int16_t dc = 1;
+        double msps = measure([&]() { v.fn(data.data(), size, dc); dc = -dc; }, size, min_time);
+        base = (base == 0)? msps : base;
+        fprintf(stdout, "  subtract %-14s %9.1f Msamples/s  %5.2fx\n", v.name, msps, msps / base);
+    }
+
+    for (int32_t channels : deinterleave_channels) {
+        std::vector<int16_t> planes(size);
+        int16_t *out[8];
+
+        for (int32_t c = 0; c < channels; c++) {
+            out[c] = planes.data() + c * (size / channels);
+        }
+
+        base = 0;
+
+        for (const auto &v : deinterleave_variants) {
+            double msps = measure([&]() { v.fn(data.data(), size / channels, channels, out); }, size, min_time);
+            base = (base == 0)? msps : base;
+            fprintf(stdout, "  deinterleave %d ch %-7s %7.1f Msamples/s  %5.2fx\n", channels, v.name, msps, msps / base);
+        }
+    }
+}
+
+int main(int argc, char *const * argv)
+{
+    fprintf(stdout, "Radio Fax sample kernel check v" VERSION "\n");
+
+    int32_t cases {20000};
+    size_t max_size {96000};
+    size_t time_size {12000};
+    double min_time {0.5};
+
+    rng_state = time(NULL) | 1;
+
+    static struct option long_options[] =
+    {
+        {"cases",     required_argument, 0, 'n'},
+        {"seed",      required_argument, 0, 'S'},
+        {"max_size",  required_argument, 0, 'm'},
+        {"time_size", required_argument, 0, 'z'},
+        {"time",      required_argument, 0, 't'},
+        {0, 0, 0, 0}
+    };
+
+    int opt_idx = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "n:S:m:z:t:", long_options, &opt_idx)) >= 0) {
+        switch(c) {
+            case 'n': cases = atoi(optarg); break;
+            case 'S': rng_state = strtoull(optarg, NULL, 0) | 1; break;
+            case 'm': max_size = strtoull(optarg, NULL, 0); break;
+            case 'z': time_size = strtoull(optarg, NULL, 0); break;
+            case 't': min_time = atof(optarg); break;
+        }
+    }
+
+    fprintf(stdout, "Seed %llu, %d cases, sizes up to %zu samples\n", (unsigned long long) rng_state, cases, max_size);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = fault_handler;
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS, &sa, NULL);
+
+    GuardedBuffer buf(MAX(max_size, (size_t)4096 + 352));
+
+    // every size around the lane counts first, then random ones
+    for (size_t size = 0; size < 1024; size++) {
+        check_case(buf, size, true, 0);
+    }
+
+    for (int32_t n = 0; n < cases; n++) {
+        bool at_end = rng() & 1;
+        check_case(buf, random_size(max_size), at_end, rng() % 32);
+    }
+
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGBUS, SIG_DFL);
+
+    if (failures > 0) {
+        fprintf(stdout, "%d failures\n", failures);
+    } else {
+        fprintf(stdout, "All variants match the reference\n");
+    }
+
+    if (min_time > 0) {
+        timing(time_size, min_time);
+    }
+
+    return failures? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+#include "channelizer.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define IQ_MIN_RATE         8000    // of a channel, the fax signal and the tuning offset fit
+#define IQ_PROTO_TAPS       16      // per channel, ~80 dB stopband from 1.2 channel spacings
+#define IQ_NARROW_CUTOFF    1700    // Hz around the station center
+#define IQ_NARROW_WIDTH     600     // Hz of the transition
+
+// Blackman windowed sinc, cutoff in cycles per sample, unity DC gain
+static std::vector<float> lowpass(int32_t taps, double cutoff)
+{
+    std::vector<float> h(taps);
+    double sum = 0;
+
+    for (int32_t n = 0; n < taps; n++) {
+        double t = n - (taps - 1) / 2.0;
+        double sinc = (t == 0)? 2 * cutoff : sin(K_2PI * cutoff * t) / (K_PI * t);
+        double w = 0.42 - 0.5 * cos(K_2PI * n / (taps - 1)) + 0.08 * cos(2 * K_2PI * n / (taps - 1));
+
+        h[n] = sinc * w;
+        sum += h[n];
+    }
+
+    for (auto &v : h) {
+        v /= sum;
+    }
+
+    return h;
+}
+
+PolyphaseChannelizer::PolyphaseChannelizer():
+    m_channels {0},
+    m_taps {0},
+    m_length {0},
+    m_pos {0},
+    m_phase {0},
+    m_rows {0},
+    m_plan {NULL}
+{
+}
+
+void PolyphaseChannelizer::Configure(int32_t channels, int32_t taps)
+{
+    m_channels = channels;
+    m_taps = taps;
+    m_length = channels * taps;
+    m_proto = lowpass(m_length, 1.0 / channels);
+    m_history.assign(2 * m_length, tSComplex {0, 0});
+    m_work.resize(channels);
+    m_plan = fft_plan(channels, true);
+    m_pos = 0;
+    m_phase = 0;
+    m_rows = 0;
+}
+
+/*
+    Channel k is the input mixed down by k*Fs/M, filtered and decimated by D:
+
+        y_k[m] = sum_n h[n] x[mD - n] e^(-j2pi k (mD - n) / M)
+
+    With n = p + qM the sum over q is a polyphase branch u_p, the sum over p
+    an inverse DFT, and for D = M/2 the remaining e^(-j2pi k mD / M) is
+    (-1)^(km).
+*/
+size_t PolyphaseChannelizer::Process(const tSComplex *in, size_t count, std::vector<tSComplex> &out)
+{
+    const int32_t M = m_channels, D = M / 2, L = m_length;
+    const float *h = m_proto.data();
+    size_t rows = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        // every sample is stored twice, the last L are always contiguous from m_pos on
+        m_history[m_pos] = m_history[m_pos + L] = in[i];
+        m_pos = (m_pos + 1 == L)? 0 : m_pos + 1;
+
+        if (++m_phase < D) {
+            continue;
+        }
+
+        m_phase = 0;
+
+        // x[mD - j] is w[L - 1 - j]
+        const tSComplex *w = &m_history[m_pos];
+
+        for (int32_t p = 0; p < M; p++) {
+            float re = 0, im = 0;
+
+            for (int32_t j = p; j < L; j += M) {
+                re += h[j] * w[L - 1 - j].re;
+                im += h[j] * w[L - 1 - j].im;
+            }
+
+            m_work[p].re = re;
+            m_work[p].im = im;
+        }
+
+        m_plan->Execute(m_work.data());
+
+        if (m_rows & 1) {
+            for (int32_t k = 1; k < M; k += 2) {
+                m_work[k].re = -m_work[k].re;
+                m_work[k].im = -m_work[k].im;
+            }
+        }
+
+        out.insert(out.end(), m_work.begin(), m_work.end());
+        m_rows++;
+        rows++;
+    }
+
+    return rows;
+}
+
+IqChannelizer::IqChannelizer():
+    m_outputRate {0},
+    m_carrierStep {0},
+    m_carrierPhase {0}
+{
+}
+
+bool IqChannelizer::Configure(double sample_rate, const std::vector<double> &offsets, double audio_carrier)
+{
+    // as many channels as keep their rate above IQ_MIN_RATE
+    int32_t channels = 2;
+
+    while (2 * sample_rate / (channels * 2) >= IQ_MIN_RATE && channels < 65536) {
+        channels *= 2;
+    }
+
+    m_bank.Configure(channels, IQ_PROTO_TAPS);
+    m_outputRate = 2 * sample_rate / channels;
+
+    const double spacing = sample_rate / channels;
+
+    m_stations.clear();
+
+    for (double offset : offsets) {
+        if (fabs(offset) > sample_rate / 2 - IQ_NARROW_CUTOFF) {
+            FAX_ERROR("Station at %.0f Hz is outside of the I/Q band (+-%.0f Hz)\n", offset, sample_rate / 2);
+            return false;
+        }
+
+        station_t st;
+        int32_t k = lround(offset / spacing);
+
+        st.bin = (k + channels) % channels;
+        st.tune = -K_2PI * (offset - k * spacing) / m_outputRate;
+        st.phase = 0;
+        st.pos = 0;
+        m_stations.push_back(st);
+
+        FAX_DEBUG("Station %.0f Hz: channel %d, tuned %.0f Hz\n", offset, st.bin, offset - k * spacing);
+    }
+
+    int32_t taps = (int32_t)(5.5 * m_outputRate / IQ_NARROW_WIDTH) | 1;
+    m_narrow = lowpass(taps, IQ_NARROW_CUTOFF / m_outputRate);
+
+    for (auto &st : m_stations) {
+        st.history.assign(2 * taps, tSComplex {0, 0});
+    }
+
+    m_carrierStep = K_2PI * audio_carrier / m_outputRate;
+    m_carrierPhase = 0;
+
+    FAX_INFO("I/Q %.0f samples/sec: %d channels %.0f Hz apart, %.0f samples/sec each\n",
+        sample_rate, channels, spacing, m_outputRate);
+    return true;
+}
+
+size_t IqChannelizer::Process(const int16_t *iq, size_t frames, int16_t *const *out)
+{
+    m_in.resize(frames);
+
+    for (size_t i = 0; i < frames; i++) {
+        m_in[i].re = iq[2 * i];
+        m_in[i].im = iq[2 * i + 1];
+    }
+
+    m_rows.clear();
+
+    const size_t rows = m_bank.Process(m_in.data(), frames, m_rows);
+    const int32_t M = m_bank.Channels();
+    const int32_t N = m_narrow.size();
+    const float *h = m_narrow.data();
+
+    for (size_t s = 0; s < m_stations.size(); s++) {
+        station_t &st = m_stations[s];
+        double carrier = m_carrierPhase;
+
+        for (size_t r = 0; r < rows; r++) {
+            const tSComplex v = m_rows[r * M + st.bin];
+            const float c = cos(st.phase), si = sin(st.phase);
+
+            // onto the station center
+            tSComplex x = {v.re * c - v.im * si, v.re * si + v.im * c};
+            st.history[st.pos] = st.history[st.pos + N] = x;
+            st.pos = (st.pos + 1 == N)? 0 : st.pos + 1;
+
+            st.phase = remainder(st.phase + st.tune, K_2PI);
+
+            const tSComplex *w = &st.history[st.pos];
+            float re = 0, im = 0;
+
+            for (int32_t j = 0; j < N; j++) {
+                re += h[j] * w[j].re;
+                im += h[j] * w[j].im;
+            }
+
+            // up to the audio carrier, the real part is the USB audio
+            float a = re * cos(carrier) - im * sin(carrier);
+            carrier += m_carrierStep;
+
+            out[s][r] = (int16_t) lrintf(std::min(32767.0f, std::max(-32768.0f, a)));
+        }
+    }
+
+    m_carrierPhase = remainder(m_carrierPhase + rows * m_carrierStep, K_2PI);
+    return rows;
+}
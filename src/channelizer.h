@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "datatypes.h"
+#include "fft.h"
+
+// Polyphase FFT filter bank: complex samples at rate Fs are split into M
+// channels Fs/M apart, each at 2*Fs/M. Oversampled by 2, so a signal half
+// way between two channel centers is still well inside the passband of
+// either of them. Channel k is centered at k*Fs/M, the upper half of them
+// are the negative frequencies.
+class PolyphaseChannelizer
+{
+public:
+    PolyphaseChannelizer();
+
+    // channels a power of 2 (at least 2), taps of the prototype filter per channel
+    void Configure(int32_t channels, int32_t taps);
+
+    int32_t Channels() const { return m_channels; }
+    int32_t Decimation() const { return m_channels / 2; }
+
+    // One row of Channels() outputs per Decimation() input samples, appended
+    // to out. Returns the rows added.
+    size_t Process(const tSComplex *in, size_t count, std::vector<tSComplex> &out);
+
+private:
+    int32_t m_channels, m_taps, m_length;
+    std::vector<float> m_proto;         // lowpass, cut off at Fs/M
+    std::vector<tSComplex> m_history;   // twice the filter length, see Process()
+    int32_t m_pos;
+    int32_t m_phase;                    // input samples since the last row
+    uint64_t m_rows;
+    std::vector<tSComplex> m_work;
+    const FftPlan *m_plan;
+};
+
+// Stations out of wideband I/Q: the channel nearest to each of them, tuned
+// exactly, narrowed to the fax signal and turned into upper side band audio
+// with the fax carrier at audio_carrier Hz, as a receiver would deliver it.
+class IqChannelizer
+{
+public:
+    IqChannelizer();
+
+    // offsets: center frequencies of the stations relative to the middle of the band, Hz
+    bool Configure(double sample_rate, const std::vector<double> &offsets, double audio_carrier = 1900);
+
+    double OutputRate() const { return m_outputRate; }
+    // Upper bound of the samples per station Process() gives for frames of input
+    size_t MaxOutput(size_t frames) const { return frames / m_bank.Decimation() + 1; }
+
+    // Interleaved 16 bit I/Q frames in, audio of every station into out[station]
+    // (at least MaxOutput() long). Returns the samples per station.
+    size_t Process(const int16_t *iq, size_t frames, int16_t *const *out);
+
+private:
+    struct station_t {
+        int32_t bin;
+        double tune;                    // rad/sample, what is left after the bin
+        double phase;
+        std::vector<tSComplex> history; // of the narrowing filter, twice its length
+        int32_t pos;
+    };
+
+    PolyphaseChannelizer m_bank;
+    std::vector<station_t> m_stations;
+    std::vector<float> m_narrow;        // lowpass at the channel rate
+    std::vector<tSComplex> m_in, m_rows;
+    double m_outputRate;
+    double m_carrierStep;               // rad/sample of the audio carrier
+    double m_carrierPhase;
+};
@@ -69,6 +69,8 @@ typedef struct {
  #define MFFTW_PLAN_DFT_1D fftw_plan_dft_1d
  #define MFFTW_DESTROY_PLAN fftw_destroy_plan
  #define MFFTW_EXECUTE fftw_execute
+ #define MFFTW_EXECUTE_DFT fftw_execute_dft
+ #define MFFTW_IMPORT_SYSTEM_WISDOM fftw_import_system_wisdom
 #else
  #define MSIN(x) sinf(x)
  #define MCOS(x) cosf(x)
@@ -91,6 +93,8 @@ typedef struct {
  #define MFFTW_PLAN_DFT_1D fftwf_plan_dft_1d
  #define MFFTW_DESTROY_PLAN fftwf_destroy_plan
  #define MFFTW_EXECUTE fftwf_execute
+ #define MFFTW_EXECUTE_DFT fftwf_execute_dft
+ #define MFFTW_IMPORT_SYSTEM_WISDOM fftwf_import_system_wisdom
 #endif
 
 #define MAX(a,b) ((a)>(b)?(a):(b))
@@ -0,0 +1,134 @@
+#include "demod_q15.h"
+#include "datatypes.h"
+
+#include <array>
+#include <cmath>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define DEMOD_Q15_TABLE_BITS    12
+#define DEMOD_Q15_TABLE_SIZE    (1 << DEMOD_Q15_TABLE_BITS)
+
+// cos() over one turn in Q15, sin() is a quarter of the table behind
+static const std::array<int16_t, DEMOD_Q15_TABLE_SIZE> &cos_table()
+{
+    static const std::array<int16_t, DEMOD_Q15_TABLE_SIZE> table = []() {
+        std::array<int16_t, DEMOD_Q15_TABLE_SIZE> t;
+
+        for (int32_t n = 0; n < DEMOD_Q15_TABLE_SIZE; n++) {
+            t[n] = lrint(cos(2 * 3.14159265358979323846 * n / DEMOD_Q15_TABLE_SIZE) * 32767);
+        }
+        return t;
+    }();
+
+    return table;
+}
+
+void demod_q15_mix(const int16_t *samples, int32_t count, uint32_t phase_inc, int16_t *i, int16_t *q)
+{
+    const int16_t *table = cos_table().data();
+    const uint32_t mask = DEMOD_Q15_TABLE_SIZE - 1;
+    uint32_t phase = 0;
+
+    for (int32_t n = 0; n < count; n++) {
+        uint32_t index = phase >> (32 - DEMOD_Q15_TABLE_BITS);
+        int32_t s = samples[n];
+
+        i[n] = (s * table[index] + (1 << 14)) >> 15;
+        q[n] = (s * table[(index - DEMOD_Q15_TABLE_SIZE / 4) & mask] + (1 << 14)) >> 15;
+        phase += phase_inc;
+    }
+}
+
+// One sample of demod_q15_discriminate(), power is that of the previous one
+static inline void discriminate_one(demod_q15_t *d, int32_t i, int32_t q, float *power, uint8_t *out)
+{
+    int64_t cross = (int64_t)q * d->iprev - (int64_t)i * d->qprev;
+    float pc = (float)((uint32_t)(i * i) + (uint32_t)(q * q));
+    float sum = pc + *power;
+    // digital silence is black, as the float discriminator's 0/0 comes out
+    float v = (sum > 0)? 127.5f + 2 * d->gain * cross / sum : 0;
+
+    if (v > d->white_lo && v < d->white_hi) {
+        if (v > d->white)
+            d->white_above++;
+        else
+            d->white_below++;
+    }
+
+    int32_t pixel = v;
+    *out = (pixel < 0)? 0 : ((pixel > 255)? 255 : pixel);
+
+    d->iprev = i;
+    d->qprev = q;
+    *power = pc;
+}
+
+void demod_q15_discriminate(demod_q15_t *d, const int16_t *i, const int16_t *q, int32_t count, uint8_t *out)
+{
+    float power = (float)((int32_t)d->iprev * d->iprev + (int32_t)d->qprev * d->qprev);
+    int32_t n = 0;
+
+#if defined(__ARM_NEON)
+    if (count >= 4) {
+        int16x4_t ilast = vdup_n_s16(d->iprev), qlast = vdup_n_s16(d->qprev);
+        float32x4_t plast = vdupq_n_f32(power);
+        const float32x4_t gain = vdupq_n_f32(2 * d->gain);
+        const float32x4_t lo = vdupq_n_f32(d->white_lo), white = vdupq_n_f32(d->white), hi = vdupq_n_f32(d->white_hi);
+        uint32x4_t above = vdupq_n_u32(0), below = vdupq_n_u32(0);
+
+        for (; n + 4 <= count; n += 4) {
+            int16x4_t ic = vld1_s16(i + n), qc = vld1_s16(q + n);
+            // the previous sample of every lane
+            int16x4_t ip = vext_s16(ilast, ic, 3), qp = vext_s16(qlast, qc, 3);
+
+            int32x4_t cross = vqsubq_s32(vmull_s16(qc, ip), vmull_s16(ic, qp));
+            // up to 2^31, unsigned
+            uint32x4_t pc_u = vaddq_u32(vreinterpretq_u32_s32(vmull_s16(ic, ic)), vreinterpretq_u32_s32(vmull_s16(qc, qc)));
+            float32x4_t pc = vcvtq_f32_u32(pc_u);
+            float32x4_t sum = vaddq_f32(pc, vextq_f32(plast, pc, 3));
+
+            // 1/sum, the estimate refined twice to float precision. Infinite
+            // for silence, v is NaN then and converts to 0 like the scalar one
+            float32x4_t r = vrecpeq_f32(sum);
+            r = vmulq_f32(vrecpsq_f32(sum, r), r);
+            r = vmulq_f32(vrecpsq_f32(sum, r), r);
+
+            float32x4_t v = vmlaq_f32(vdupq_n_f32(127.5f), vmulq_f32(gain, vcvtq_f32_s32(cross)), r);
+
+            uint32x4_t in = vandq_u32(vcgtq_f32(v, lo), vcltq_f32(v, hi));
+            uint32x4_t up = vcgtq_f32(v, white);
+            above = vsubq_u32(above, vandq_u32(in, up));
+            below = vsubq_u32(below, vbicq_u32(in, up));
+
+            // truncated like the scalar cast, then saturated to 0..255
+            uint16x4_t p16 = vqmovun_s32(vcvtq_s32_f32(v));
+            uint8x8_t p8 = vqmovn_u16(vcombine_u16(p16, p16));
+            vst1_lane_u32((uint32_t*)(out + n), vreinterpret_u32_u8(p8), 0);
+
+            ilast = ic;
+            qlast = qc;
+            plast = pc;
+        }
+
+#if defined(__aarch64__)
+        d->white_above += vaddvq_u32(above);
+        d->white_below += vaddvq_u32(below);
+#else
+        // ARMv7 has no across vector add, pairwise to two lanes instead
+        uint64x2_t above2 = vpaddlq_u32(above), below2 = vpaddlq_u32(below);
+        d->white_above += vgetq_lane_u64(above2, 0) + vgetq_lane_u64(above2, 1);
+        d->white_below += vgetq_lane_u64(below2, 0) + vgetq_lane_u64(below2, 1);
+#endif
+        d->iprev = vget_lane_s16(ilast, 3);
+        d->qprev = vget_lane_s16(qlast, 3);
+        power = vgetq_lane_f32(plast, 3);
+    }
+#endif
+
+    for (; n < count; n++) {
+        discriminate_one(d, i[n], q[n], &power, out + n);
+    }
+}
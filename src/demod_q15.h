@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+    Fixed point FM demodulation, the int16 counterpart of the decoder's float
+    mixer and discriminator for CPUs where float is slow (Raspberry Pi).
+    Samples, I and Q are Q15, the oscillator is a 32 bit phase accumulator
+    and a cosine table.
+*/
+
+// Mixes count samples to I and Q with the oscillator starting at phase 0,
+// phase_inc is the carrier over the sample rate in 2^-32 turns
+void demod_q15_mix(const int16_t *samples, int32_t count, uint32_t phase_inc, int16_t *i, int16_t *q);
+
+struct demod_q15_t {
+    int16_t iprev, qprev;       // last sample of the previous block
+    float gain;                 // pixel = 127.5 + gain * sin(phase change)
+    float white_lo, white, white_hi;    // AFC window, unclamped pixels
+    int32_t white_above, white_below;   // counted in the window
+};
+
+/*
+    Phase change per sample to pixels (0..255, 128 for no change). The change
+    is the cross product of the sample and the previous one over the product
+    of their magnitudes; the product is approximated by the mean of their
+    powers, exact for a constant envelope like FM and without a square root.
+    Pixels in the AFC window are counted into white_above/white_below.
+*/
+void demod_q15_discriminate(demod_q15_t *d, const int16_t *i, const int16_t *q, int32_t count, uint8_t *out);
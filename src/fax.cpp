@@ -28,42 +28,261 @@
  **********************************************************************************
  */
 #define VERSION "1.0.6"
+#include <cinttypes>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <vector>
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <time.h>
 
 #include "avg.h"
+#include "channelizer.h"
+#include "log.h"
+#include "multichannel.h"
+#include "pcmsource.h"
+#include "skew.h"
+#include "spectrum.h"
+#include "stats.h"
+#include "wav.h"
 #include "FaxDecoder.h"
 
-struct wav_header_t {
-    char signature[4];            // "RIFF"
-    uint32_t fileSize;            // data bytes + sizeof(WavHeader_t) - 8
-    char file_type[4];            // "WAVE"
-    char format_marker[4];        // "fmt "
-    uint32_t format_header_length;// Always 16
-    uint16_t sample_type;         // PCM (1)
-    uint16_t channels;
-    uint32_t sample_rate;
-    uint32_t bytes_per_second;
-    uint16_t bytes_per_sample;
-    uint16_t bit_depth;
-    char data_marker[4];          // "data"
-    uint32_t data_size;
-};
+static volatile sig_atomic_t stats_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stats(int)
+{
+    stats_requested = 1;
+}
+
+static void request_stop(int)
+{
+    stop_requested = 1;
+}
+
+// JSON goes to stderr, away from the decoder messages, or replaces the file
+static void write_stats(FaxDecoder &faxdec, const char *stats_name)
+{
+    if (stats_name == NULL) {
+        fax_stats_json(faxdec.Stats(), stderr);
+        return;
+    }
+
+    FILE *f = fopen(stats_name, "w");
+
+    if (f == NULL) {
+        FAX_ERROR("open(%s) failed: %s\n", stats_name, strerror(errno));
+        return;
+    }
+
+    fax_stats_json(faxdec.Stats(), f);
+    fclose(f);
+}
+
+// One decoder thread per channel of an interleaved recording, 1 second of frames at a time
+static int decode_channels(FILE *fd, const wav_header_t &hdr, const channel_config_t &defaults,
+                           const std::vector<std::pair<int32_t, const char*>> &specs,
+                           const std::string &name, bool continuous, int64_t rotate_lines)
+{
+    std::vector<channel_config_t> channels(hdr.channels, defaults);
+
+    for (int32_t c = 0; c < hdr.channels; c++) {
+        // <name>-ch<n>.pgm, or the prefix of the rotated files
+        channels[c].output = name + "-ch" + std::to_string(c) + (continuous? "" : ".pgm");
+    }
+
+    for (const auto &[c, spec] : specs) {
+        if (c < 0 || c >= hdr.channels) {
+            FAX_ERROR("No channel %d, the recording has %d\n", c, hdr.channels);
+            return -1;
+        }
+
+        if (!channel_config_parse(spec, &channels[c])) {
+            return -1;
+        }
+    }
+
+    MultiChannelDecoder decoder;
+
+    if (!decoder.Start(channels, hdr.sample_rate, continuous, rotate_lines)) {
+        return -1;
+    }
+
+    size_t frames = continuous? MAX(1u, hdr.sample_rate / 10) : hdr.sample_rate;
+    FilePcmSource source(fd, hdr.sample_rate, frames * hdr.channels);
+
+    if (continuous) {
+        signal(SIGINT, request_stop);
+        signal(SIGTERM, request_stop);
+    }
+
+    while (!stop_requested) {
+        int16_t *data;
+        size_t n = source.Next(&data, frames * hdr.channels);
+
+        if (n == 0 || !decoder.Process(data, n / hdr.channels)) {
+            break;
+        }
+    }
+
+    decoder.Finish();
+    return 0;
+}
+
+// Stations out of wideband I/Q, each decoded on its own thread
+static int decode_iq(FILE *fd, const wav_header_t &hdr, const channel_config_t &defaults,
+                     const std::vector<const char*> &specs, double iq_center,
+                     const std::string &name, bool continuous, int64_t rotate_lines)
+{
+    std::vector<channel_config_t> stations(specs.size(), defaults);
+    std::vector<double> offsets;
+
+    for (size_t i = 0; i < specs.size(); i++) {
+        // "<frequency>[:<settings>]"
+        char *end;
+        double freq = strtod(specs[i], &end);
+        char label[32];
+
+        snprintf(label, sizeof label, "%.0f", freq);
+        stations[i].output = name + "-" + label + (continuous? "" : ".pgm");
+        stations[i].center_freq = 0;
+
+        if (*end == ':' && !channel_config_parse(end + 1, &stations[i])) {
+            return -1;
+        }
+
+        // the channelizer puts every station on 1900 Hz, another carrier would detune it
+        if (stations[i].center_freq != 0) {
+            FAX_ERROR("Station %s: freq= can't be set, the station frequency tunes it\n", specs[i]);
+            return -1;
+        }
+        stations[i].center_freq = 1900;
+
+        offsets.push_back(freq - iq_center);
+    }
+
+    IqChannelizer channelizer;
+
+    if (!channelizer.Configure(hdr.sample_rate, offsets, 1900)) {
+        return -1;
+    }
+
+    MultiChannelDecoder decoder;
+
+    if (!decoder.Start(stations, channelizer.OutputRate(), continuous, rotate_lines)) {
+        return -1;
+    }
+
+    size_t frames = continuous? MAX(1u, hdr.sample_rate / 10) : hdr.sample_rate;
+    FilePcmSource source(fd, hdr.sample_rate, frames * 2);
+
+    if (continuous) {
+        signal(SIGINT, request_stop);
+        signal(SIGTERM, request_stop);
+    }
+
+    while (!stop_requested) {
+        int16_t *data;
+        size_t n = source.Next(&data, frames * 2);
+
+        if (n == 0) {
+            break;
+        }
+
+        size_t out = channelizer.Process(data, n / 2, decoder.Buffers(channelizer.MaxOutput(n / 2)));
+
+        if (out > 0 && !decoder.Commit(out)) {
+            break;
+        }
+    }
+
+    decoder.Finish();
+    return 0;
+}
+
+// Several decoder configurations tried on one mono input, each on its own
+// thread. The input is read and DC corrected once for all of them.
+static int decode_configs(PcmSource &source, const channel_config_t &defaults,
+                          const std::vector<const char*> &specs,
+                          const std::string &name, bool continuous, int64_t rotate_lines)
+{
+    std::vector<channel_config_t> configs(specs.size(), defaults);
+    bool remove_dc = false;
+
+    for (size_t i = 0; i < specs.size(); i++) {
+        configs[i].output = name + "-cfg" + std::to_string(i) + (continuous? "" : ".pgm");
+
+        if (!channel_config_parse(specs[i], &configs[i])) {
+            return -1;
+        }
+
+        remove_dc |= configs[i].enabled && configs[i].remove_dc;
+    }
+
+    MultiChannelDecoder decoder;
+
+    if (!decoder.Start(configs, source.SampleRate(), continuous, rotate_lines)) {
+        return -1;
+    }
+
+    const size_t block = continuous? MAX(1u, source.SampleRate() / 10) : source.SampleRate();
+
+    if (continuous) {
+        signal(SIGINT, request_stop);
+        signal(SIGTERM, request_stop);
+    }
+
+    while (!stop_requested) {
+        int16_t *data;
+        size_t n = source.Next(&data, block);
+
+        if (n == 0) {
+            if (source.Eof()) {
+                break;
+            }
+            // a live input was idle
+            continue;
+        }
+
+        if (remove_dc) {
+            float avg = FLOAT_AVERAGE(data, n);
+            SAMPLES_SUBTRACT(data, n, avg);
+        }
+
+        if (!decoder.Broadcast(data, n)) {
+            break;
+        }
+    }
+
+    decoder.Finish();
+
+    if (source.Lost()) {
+        FAX_WARN("%" PRIu64 " samples lost in transport\n", source.Lost());
+    }
+
+    return 0;
+}
 
 int main(int argc, char *const * argv)
 {
-    fprintf(stdout, "Radio Fax decoder v" VERSION "\n");
 
     char *file_name = NULL;
+    char *output_name = NULL;
+    const char *udp_spec = NULL;
+    const char *shm_name = NULL;
+    UdpPcmSource::Format udp_format {UdpPcmSource::RAW};
+    uint32_t sample_rate {48000};
     double center_freq {1900};
+    double deviation {400};
     uint8_t lpm {120};
     double srcorr {1.0};
     // Use "long" to comply with "fseek" API
@@ -72,20 +291,60 @@ int main(int argc, char *const * argv)
     long drop_pixels {0};
     uint32_t pixels_width {1809};
     uint32_t line_limit {0};
+    int32_t estimate_lines {0};
+    int32_t align_lines {0};
+    int64_t rotate_lines {0};
+    double report_sec {60};
 
     int no_header {0};
     int no_phasing {0};
     int auto_stop {0};
     int remove_dc {0};
+    int carrier_gate {0};
+    int auto_carrier {0};
+    int afc {0};
+    int fixed_point {0};
+    int auto_lpm {0};
+    int perf_counters {0};
+    int continuous {0};
+    bool stats {false};
+    int log_level {FAX_LOG_INFO};
+    const char *stats_name = NULL;
+    std::vector<std::pair<int32_t, const char*>> channel_specs;
+    std::vector<const char*> station_specs;
+    std::vector<const char*> config_specs;
+    double iq_center {0};
+    int iq {0};
 
     static struct option long_options[] =
     {
         {"no_header",   no_argument,  &no_header, 1},
         {"remove_dc",   no_argument,  &remove_dc, 1},
         {"auto_stop",   auto_stop,    &auto_stop, 1},
+        {"gate",        no_argument,  &carrier_gate, 1},
+        {"auto_carrier", no_argument, &auto_carrier, 1},
+        {"afc",         no_argument,  &afc, 1},
+        {"fixed_point", no_argument,  &fixed_point, 1},
+        {"auto_lpm",    no_argument,  &auto_lpm, 1},
+        {"perf_counters", no_argument, &perf_counters, 1},
+        {"perf-counters", no_argument, &perf_counters, 1},
+        {"continuous",  no_argument,  &continuous, 1},
+        {"iq",          no_argument,  &iq, 1},
 
         {"wav_file",    required_argument, 0, 'w'},
+        {"output",      required_argument, 0, 'o'},
+        {"channel",     required_argument, 0, 'C'},
+        {"station",     required_argument, 0, 'K'},
+        {"config",      required_argument, 0, 'G'},
+        {"iq_center",   required_argument, 0, 'F'},
+        {"udp",         required_argument, 0, 'U'},
+        {"rtp",         required_argument, 0, 'T'},
+        {"shm",         required_argument, 0, 'M'},
+        {"sample_rate", required_argument, 0, 'H'},
+        {"rotate_lines", required_argument, 0, 'O'},
+        {"report",      required_argument, 0, 'R'},
         {"center_freq", required_argument, 0, 'f'},
+        {"deviation",   required_argument, 0, 'D'},
         {"lpm",         required_argument, 0, 'l'},
         {"srcorr",      required_argument, 0, 's'},
         {"drop",        required_argument, 0, 'd'},
@@ -94,6 +353,11 @@ int main(int argc, char *const * argv)
         {"drop_pixels", required_argument, 0, 'x'},
         {"no_phasing",  required_argument, 0, 'n'},
         {"line_limit",  required_argument, 0, 'L'},
+        {"estimate_skew", required_argument, 0, 'e'},
+        {"auto_align",  required_argument, 0, 'a'},
+        {"stats",       optional_argument, 0, 'S'},
+        {"quiet",       no_argument,       0, 'q'},
+        {"verbose",     no_argument,       0, 'v'},
         {0, 0, 0, 0}
     };
 
@@ -101,7 +365,7 @@ int main(int argc, char *const * argv)
     int8_t c;
 
     while(1) {
-        c = getopt_long(argc, argv, "w:f:l:s:d:r:x:nL:", long_options, &opt_idx);
+        c = getopt_long(argc, argv, "w:o:C:f:D:l:s:d:r:x:nL:e:a:cqv", long_options, &opt_idx);
 
         if (c < 0) {
             break;
@@ -112,10 +376,63 @@ int main(int argc, char *const * argv)
                 file_name = optarg;
             break;
 
+            case 'o':
+                output_name = optarg;
+            break;
+
+            case 'C': {
+                // "<channel>:<settings>"
+                char *colon = strchr(optarg, ':');
+                channel_specs.push_back({atoi(optarg), colon? colon + 1 : ""});
+            }
+            break;
+
+            case 'K':
+                station_specs.push_back(optarg);
+            break;
+
+            case 'G':
+                config_specs.push_back(optarg);
+            break;
+
+            case 'F':
+                iq_center = atof(optarg);
+            break;
+
+            case 'U':
+            case 'T':
+                udp_spec = optarg;
+                udp_format = (c == 'T')? UdpPcmSource::RTP : UdpPcmSource::RAW;
+            break;
+
+            case 'M':
+                shm_name = optarg;
+            break;
+
+            case 'H':
+                sample_rate = atoi(optarg);
+            break;
+
+            case 'O':
+                rotate_lines = atol(optarg);
+            break;
+
+            case 'R':
+                report_sec = atof(optarg);
+            break;
+
+            case 'c':
+                continuous = 1;
+            break;
+
             case 'f':
                 center_freq = atof(optarg);
             break;
 
+            case 'D':
+                deviation = atof(optarg);
+            break;
+
             case 'l':
                 lpm = atoi(optarg);
             break;
@@ -147,38 +464,215 @@ int main(int argc, char *const * argv)
             case 'L':
                 line_limit = atoi(optarg);
             break;
+
+            case 'e':
+                estimate_lines = atoi(optarg);
+            break;
+
+            case 'a':
+                align_lines = atoi(optarg);
+            break;
+
+            case 'S':
+                stats = true;
+                stats_name = optarg;
+            break;
+
+            case 'q':
+                log_level = FAX_LOG_WARN;
+            break;
+
+            case 'v':
+                // -vv for the per line detector values, if compiled in
+                log_level = MAX(log_level, FAX_LOG_INFO) + 1;
+            break;
         }
     }
 
-    if (file_name == NULL) {
-        fprintf(stdout, "File name is required: -w <file name>\n");
+    fax_log_set_level(log_level);
+    FAX_INFO("Radio Fax decoder v" VERSION "\n");
+
+    // an SDR process on the same host sends the audio, it never ends
+    bool live = udp_spec != NULL || shm_name != NULL;
+
+    if (file_name == NULL && !live) {
+        FAX_ERROR("File name is required: -w <file name>, or --udp, --rtp, --shm\n");
         exit(-1);
     }
 
-    std::filesystem::path full_path = file_name;
+    if (live) {
+        continuous = 1;
+    }
+
+    // "-" reads stdin, e.g. "arecord -t wav ... | fax -c -w -"
+    bool from_stdin = live || strcmp(file_name, "-") == 0;
+
+    std::filesystem::path full_path = from_stdin? "fax" : file_name;
+    // output file, or the prefix of the rotated ones
     std::filesystem::path local_name = full_path.filename().stem();
-    local_name +=  ".pgm";
-    
-    FILE *fd = fopen(file_name, "r");
-    
-    if (fd == NULL) {
-        fprintf(stderr, "open(%s) failed: %s\n", file_name, strerror(errno));
-        exit(EXIT_FAILURE);
+
+    if (output_name != NULL) {
+        local_name = output_name;
+    } else if (!continuous) {
+        local_name +=  ".pgm";
     }
 
+    std::unique_ptr<PcmSource> source;
+    FILE *fd = NULL;
     wav_header_t hdr;
-    
-    auto nread = fread(&hdr, sizeof(wav_header_t), 1, fd);
+    memset(&hdr, 0, sizeof(hdr));
 
-    fprintf(stdout, "Sample rate: %d\n", hdr.sample_rate);
-    fprintf(stdout, "   Channels: %d\n", hdr.channels);
-    fprintf(stdout, "        BPS: %d\n", hdr.bytes_per_sample);
+    if (udp_spec != NULL) {
+        auto udp = std::make_unique<UdpPcmSource>();
 
-    if (hdr.channels > 1) {
-        fprintf(stderr, "FAX Decoder only supports MONO (1 channel) WAV files.\n");
+        if (!udp->Open(udp_spec, udp_format, sample_rate)) {
+            exit(EXIT_FAILURE);
+        }
+
+        source = std::move(udp);
+    } else if (shm_name != NULL) {
+        auto shm = std::make_unique<ShmPcmSource>();
+
+        if (!shm->Open(shm_name)) {
+            exit(EXIT_FAILURE);
+        }
+
+        source = std::move(shm);
+    } else {
+        fd = from_stdin? stdin : fopen(file_name, "r");
+
+        if (fd == NULL) {
+            FAX_ERROR("open(%s) failed: %s\n", file_name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (fread(&hdr, sizeof(wav_header_t), 1, fd) != 1) {
+            FAX_ERROR("%s: no WAV header\n", file_name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (source) {
+        hdr.sample_rate = source->SampleRate();
+        hdr.channels = 1;
+        hdr.bytes_per_sample = sizeof(int16_t);
+    }
+
+    // pipes, FIFOs and sockets can not seek, and usually deliver in real time
+    struct stat st;
+    bool seekable = fd != NULL && fstat(fileno(fd), &st) == 0 && S_ISREG(st.st_mode);
+
+    FAX_INFO("Sample rate: %d\n", hdr.sample_rate);
+    FAX_INFO("   Channels: %d\n", hdr.channels);
+    FAX_INFO("        BPS: %d\n", hdr.bytes_per_sample);
+
+    if (iq && (hdr.channels != 2 || station_specs.empty())) {
+        FAX_ERROR("--iq needs a 2 channel (I/Q) recording and at least one --station\n");
         return -1;
     }
 
+    // settings of every channel, station or configuration, changed per item
+    channel_config_t defaults;
+    defaults.lpm = lpm;
+    defaults.pixels = pixels_width;
+    defaults.center_freq = center_freq;
+    defaults.deviation = deviation;
+    defaults.srcorr = srcorr;
+    defaults.align_lines = align_lines;
+    defaults.line_limit = line_limit;
+    defaults.header = !no_header;
+    defaults.phasing = !no_phasing;
+    defaults.auto_stop = auto_stop;
+    defaults.remove_dc = remove_dc;
+    defaults.gate = carrier_gate;
+    defaults.afc = afc;
+    defaults.fixed_point = fixed_point;
+    defaults.auto_lpm = auto_lpm;
+
+    // -o names the files of all of them
+    std::string name = (output_name != NULL)? output_name : full_path.filename().stem().string();
+
+    if ((hdr.channels > 1 || !config_specs.empty()) &&
+        (auto_carrier || estimate_lines || stats || drop || drop_lines || drop_pixels)) {
+        FAX_WARN("--auto_carrier, -e, --stats and -d, -r, -x are not supported with several channels or configurations\n");
+    }
+
+    if (hdr.channels > 1) {
+        if (!config_specs.empty()) {
+            FAX_WARN("--config is for mono recordings, use -C\n");
+        }
+
+        int err = iq? decode_iq(fd, hdr, defaults, station_specs, iq_center, name, continuous, rotate_lines) :
+                      decode_channels(fd, hdr, defaults, channel_specs, name, continuous, rotate_lines);
+
+        fclose(fd);
+        return err;
+    }
+
+    if (!channel_specs.empty()) {
+        FAX_WARN("-C is for recordings of several channels\n");
+    }
+
+    if (!config_specs.empty()) {
+        if (!source) {
+            source = std::make_unique<FilePcmSource>(fd, hdr.sample_rate, hdr.sample_rate);
+        }
+
+        int err = decode_configs(*source, defaults, config_specs, name, continuous, rotate_lines);
+
+        source.reset();
+
+        if (fd != NULL) {
+            fclose(fd);
+        }
+
+        return err;
+    }
+
+    if (auto_carrier && !seekable) {
+        FAX_WARN("Carrier scan needs a file, using %.1f Hz\n", center_freq);
+        auto_carrier = 0;
+    }
+
+    if (auto_carrier) {
+        // Survey a subset of the recording: a few seconds from evenly spread places
+        const long chunks = 32;
+        const long chunk_len = hdr.sample_rate * 4;
+        long data_start = ftell(fd);
+
+        fseek(fd, 0, SEEK_END);
+        long total = (ftell(fd) - data_start) / sizeof(int16_t);
+        long stride = (total > chunks * chunk_len)? (total - chunk_len) / (chunks - 1) : chunk_len;
+
+        std::vector<int16_t> subset;
+
+        for (long pos = 0; pos < total; pos += stride) {
+            size_t have = subset.size();
+            subset.resize(have + chunk_len);
+            fseek(fd, data_start + pos * sizeof(int16_t), SEEK_SET);
+            subset.resize(have + fread(&subset[have], sizeof(int16_t), chunk_len, fd));
+        }
+
+        fseek(fd, data_start, SEEK_SET);
+
+        carrier_estimate_t est;
+
+        if (carrier_scan(subset.data(), subset.size(), hdr.sample_rate, deviation, 0, &est)) {
+            FAX_INFO("Carrier scan: black %.1f Hz, white %.1f Hz%s, confidence %.1f dB\n",
+                est.black, est.white, est.paired? "" : " (deviation assumed)", est.confidence);
+            center_freq = est.carrier;
+            deviation = est.deviation;
+            FAX_INFO("Using center frequency %.1f Hz, deviation %.1f Hz\n", center_freq, deviation);
+        } else {
+            FAX_WARN("Carrier scan failed, recording too short\n");
+        }
+    }
+
+    if (estimate_lines) {
+        // Phasing would shift lines midst the block and spoil the slant
+        no_phasing = 1;
+    }
+
     int buf_size_b = 1048576;
 
     if (no_phasing) {
@@ -186,11 +680,20 @@ int main(int argc, char *const * argv)
     }
 
     int read_buf_size = ((int)(((float)(buf_size_b / sizeof(int16_t)) / hdr.sample_rate))) * hdr.sample_rate;
-    fprintf(stdout, "read_buf_size: %d\n", read_buf_size);
-    
-    // auto readbuf = new int16_t[read_buf_size];
-    auto readbuf = (int16_t *)operator new (sizeof(int16_t) * read_buf_size, std::align_val_t(64));
+
+    if (continuous) {
+        // a live feed is decoded as it comes, 1/10 second at a time
+        read_buf_size = MAX(1, hdr.sample_rate / 10);
+    }
+    FAX_DEBUG("read_buf_size: %d\n", read_buf_size);
+
+    if (!source) {
+        source = std::make_unique<FilePcmSource>(fd, hdr.sample_rate, read_buf_size);
+    }
+
+    int16_t *readbuf;
     int16_t *inbuf;
+    size_t nread;
 
     FaxDecoder faxdec;
 
@@ -199,7 +702,7 @@ int main(int argc, char *const * argv)
         pixels_width,
         8,
         center_freq,
-        400,
+        deviation,
         FaxDecoder::firfilter::MIDDLE,     // bandwidth
         15.0,       // double minus_saturation_threshold
         !no_header,       // bool bIncludeHeadersInImages
@@ -212,7 +715,39 @@ int main(int argc, char *const * argv)
         line_limit
     );
 
-    faxdec.FileOpen(local_name.c_str());
+    // the slant estimate only needs the first lines, kept in memory
+    MemoryLineSink estimate_sink(pixels_width, estimate_lines);
+    RotatingPgmSink rotating_sink(local_name.string(), pixels_width, rotate_lines);
+
+    if (estimate_lines) {
+        faxdec.SetLineSink(&estimate_sink);
+    } else if (continuous) {
+        faxdec.SetLineSink(&rotating_sink);
+        faxdec.SetAutoAlign(align_lines);
+    } else {
+        faxdec.FileOpen(local_name.c_str());
+        faxdec.SetAutoAlign(align_lines);
+    }
+
+    faxdec.SetCarrierGate(carrier_gate);
+    faxdec.SetAfc(afc);
+    faxdec.SetFixedPoint(fixed_point);
+    faxdec.SetAutoLpm(auto_lpm);
+    faxdec.SetStats(stats);
+
+    if (perf_counters) {
+        // reported with the stats
+        stats = true;
+
+        if (!faxdec.SetPerfCounters(true)) {
+            FAX_WARN("Hardware performance counters not available: %s\n", strerror(errno));
+            faxdec.SetStats(true);
+        }
+    }
+
+    if (stats) {
+        signal(SIGUSR1, request_stats);
+    }
 
     if (drop_lines) {
         drop += hdr.sample_rate * drop_lines * 60 / lpm;
@@ -223,13 +758,68 @@ int main(int argc, char *const * argv)
     }
     
     if (drop) {
-        fseek(fd, ftell(fd) + (drop * sizeof(int16_t)), SEEK_SET);
+        if (seekable) {
+            fseek(fd, ftell(fd) + (drop * sizeof(int16_t)), SEEK_SET);
+        } else {
+            for (long left = drop; left > 0 && !source->Eof(); left -= nread) {
+                nread = source->Next(&readbuf, MIN(left, (long) read_buf_size));
+            }
+        }
+    }
+
+    if (continuous) {
+        signal(SIGINT, request_stop);
+        signal(SIGTERM, request_stop);
     }
 
     bool continue_reading = true;
+    uint64_t total_samples = 0, report_samples = 0;
+    int64_t report_lines = 0;
+    uint64_t start_ns = 0, report_ns = 0;
+
+    while (!stop_requested) {
+        {
+            FaxStageTimer timer(faxdec.Stats(), FAX_STAGE_READ);
+            nread = source->Next(&readbuf, read_buf_size);
+        }
+
+        if (nread == 0) {
+            if (source->Eof()) {
+                break;
+            }
+            // a live input was idle
+            continue;
+        }
+
+        if (start_ns == 0) {
+            // a live feed is behind real time by what was buffered before
+            start_ns = report_ns = fax_clock_ns(CLOCK_MONOTONIC);
+        }
+        total_samples += nread;
+
+        if (continuous && report_sec > 0 && fax_clock_ns(CLOCK_MONOTONIC) - report_ns >= report_sec * 1e9) {
+            uint64_t now = fax_clock_ns(CLOCK_MONOTONIC);
+            double interval = (now - report_ns) / 1e9;
+            double lag = (now - start_ns) / 1e9 - (double) total_samples / hdr.sample_rate;
+            double speed = (total_samples - report_samples) / (double) hdr.sample_rate / interval;
+
+            FAX_INFO("%" PRId64 " lines in %" PRId64 " files, %.1f lines/sec, %s %.1f sec, %.1fx real time\n",
+                rotating_sink.Lines(), rotating_sink.Files(), (rotating_sink.Lines() - report_lines) / interval,
+                (lag >= 0)? "lag" : "ahead", fabs(lag), speed);
+
+            report_ns = now;
+            report_samples = total_samples;
+            report_lines = rotating_sink.Lines();
+        }
+
+        if (stats_requested) {
+            stats_requested = 0;
+            write_stats(faxdec, stats_name);
+        }
 
-    while ((nread = fread(readbuf, sizeof(int16_t), read_buf_size, fd)) > 0) {
         if (remove_dc) {
+            FaxStageTimer timer(faxdec.Stats(), FAX_STAGE_DC);
+
             // ****** Time test *******
             /*clock_t start, end;
             start = clock();
@@ -255,6 +845,10 @@ int main(int argc, char *const * argv)
             inbuf = &readbuf[i];
             continue_reading = faxdec.ProcessSamples(inbuf, sample_length, 0);
 
+            if (estimate_lines && estimate_sink.Full()) {
+                continue_reading = false;
+            }
+
             if (!continue_reading) {
                 break;
             }
@@ -268,9 +862,39 @@ int main(int argc, char *const * argv)
 
     faxdec.FileClose();
 
-    fclose(fd);
-    
-    delete readbuf;
+    if (carrier_gate) {
+        FAX_INFO("Carrier gate skipped %.1f of %.1f sec\n", faxdec.GateSkippedSeconds(), faxdec.GateTotalSeconds());
+    }
+
+    if (afc) {
+        FAX_INFO("AFC carrier offset at the end: %.1f Hz\n", faxdec.AfcOffset());
+    }
+
+    if (stats) {
+        write_stats(faxdec, stats_name);
+    }
+
+    if (estimate_lines) {
+        skew_estimate_t est;
+        int32_t lines = (int32_t) estimate_sink.Lines();
+
+        if (skew_estimate(estimate_sink.Data(), estimate_sink.Width(), lines, srcorr, 2000.0, 4, 0, &est)) {
+            fprintf(stdout, "Slant estimated on %d lines: drift %.4f px/line, confidence %.2f\n", lines, est.drift, est.confidence);
+            fprintf(stdout, "Suggested correction: -s %.2f\n", est.ppm);
+        } else {
+            fprintf(stdout, "Not enough decoded lines (%d) to estimate slant\n", lines);
+        }
+    }
+
+    if (source->Lost()) {
+        FAX_WARN("%" PRIu64 " samples lost in transport\n", source->Lost());
+    }
+
+    source.reset();
+
+    if (fd != NULL) {
+        fclose(fd);
+    }
 
     return 0;
 }
@@ -0,0 +1,574 @@
+/*********************************************************************************
+ *
+ * Project:  FAX Decoder
+ * Purpose:  stage level benchmarks of the decoder hot paths
+ * Author:   Darau, Blė
+ *
+ **********************************************************************************
+ *   Copyright (C) 2023 by Darau, Blė                                             *
+ *                                                                                *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ * of this software and associated documentation files (the "Software"), to deal  *
+ * in the Software without restriction, including without limitation the rights   *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ * copies of the Software, and to permit persons to whom the Software is          *
+ * furnished to do so, subject to the following conditions:                       *
+ *                                                                                *
+ * The above copyright notice and this permission notice shall be included in all *
+ * copies or substantial portions of the Software.                                *
+ *                                                                                *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ * SOFTWARE.                                                                      *
+ *                                                                                *
+ **********************************************************************************
+ */
+#define VERSION "1.0.6"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#include "avg.h"
+#include "log.h"
+#include "wav.h"
+#include "FaxDecoder.h"
+#include "FaxEncoder.h"
+
+// Private hot paths of FaxDecoder, one call per line
+class FaxBench
+{
+public:
+    static int32_t SamplesPerLine(FaxDecoder &d) { return d.m_SamplesPerLine; }
+    static void LoadLine(FaxDecoder &d, const int16_t *samples)
+        { memcpy(d.m_samples, samples, d.m_SamplesPerLine * sizeof(int16_t)); }
+    static void Demodulate(FaxDecoder &d) { d.DemodulateData(); }
+    static int32_t DetectLineType(FaxDecoder &d)
+        { return d.DetectLineType(d.m_demod_data, d.m_SamplesPerLine, MIN(d.m_SamplesPerLine, MAX(3000, (int32_t)(d.m_SamplesPerSec_nom / 4)))); }
+    static int32_t PhasingPosition(FaxDecoder &d)
+        { return d.FaxPhasingLinePosition(d.m_demod_data, d.m_SamplesPerLine); }
+    static void DecodeImageLine(FaxDecoder &d, uint8_t *image)
+        { d.DecodeImageLine<false>(d.m_demod_data, d.m_SamplesPerLine, image); d.m_imageline = 1; }
+};
+
+struct bench_result_t {
+    std::string stage;
+    int32_t sample_rate;
+    int32_t lpm;
+    uint64_t samples;
+    uint64_t lines;
+    double seconds;
+    uint64_t cycles;
+};
+
+static std::vector<bench_result_t> results;
+static double min_time = 0.25;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles()
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Repeat one unit of work (it returns the samples and lines it covered) for at least min_time
+template <typename F>
+static void run(const char *stage, int32_t sample_rate, int32_t lpm, F &&unit)
+{
+    bench_result_t r {stage, sample_rate, lpm, 0, 0, 0, 0};
+    uint64_t lines;
+
+    double start = now();
+    uint64_t c_start = cycles();
+
+    do {
+        r.samples += unit(&lines);
+        r.lines += lines;
+        r.seconds = now() - start;
+    } while (r.seconds < min_time);
+
+    r.cycles = cycles() - c_start;
+
+    fprintf(stdout, "%-24s %6d %4d %10.2f Msps", stage, sample_rate, lpm, r.samples / r.seconds / 1e6);
+    if (r.lines) {
+        fprintf(stdout, " %12.0f ns/line", r.seconds * 1e9 / r.lines);
+    } else {
+        fprintf(stdout, " %20s", "");
+    }
+#ifdef HAVE_TSC
+    fprintf(stdout, " %8.2f cycles/sample", (double)r.cycles / r.samples);
+#endif
+    fprintf(stdout, "\n");
+
+    results.push_back(r);
+}
+
+static void configure(FaxDecoder &faxdec, int32_t sample_rate, int32_t lpm, bool phasing)
+{
+    faxdec.Configure(lpm, 1809, 8, 1900, 400, FaxDecoder::firfilter::MIDDLE, 15.0,
+                     true, phasing, false, false, false, sample_rate, 1.0, 0);
+}
+
+static void bench_stages(int32_t sample_rate, int32_t lpm)
+{
+    // some seconds of image lines with a bit of noise
+    FaxEncoder faxenc;
+    std::vector<uint8_t> image(1809 * 64);
+    std::vector<int16_t> signal;
+
+    FaxEncoder::TestPattern(image.data(), 1809, 64);
+    faxenc.Configure(lpm, sample_rate, 1900, 400, 0, 16384, 1000, 0, 1);
+    for (int32_t y = 0; y < 64; y++) {
+        faxenc.ImageLine(&image[y * 1809], 1809, signal);
+    }
+
+    FaxDecoder faxdec;
+    configure(faxdec, sample_rate, lpm, true);
+
+    const int32_t spl = FaxBench::SamplesPerLine(faxdec);
+    const int32_t nlines = signal.size() / spl;
+    int32_t line = 0;
+
+    FaxDecoder::firfilter filter(FaxDecoder::firfilter::MIDDLE);
+    float coeff[FIR_MAX_TAPS];
+    fir_kernel_t fir = fir_kernel(sample_rate, FaxDecoder::firfilter::MIDDLE, coeff);
+    std::vector<float> fsignal(signal.begin(), signal.end()), fout(fsignal.size());
+    volatile float sink = 0;
+
+    run("fir_block", sample_rate, lpm, [&](uint64_t *lines) {
+        fir.block(coeff, fir.taps, &filter.state, fsignal.data(), fout.data(), fsignal.size());
+        sink = fout.back();
+        *lines = 0;
+        return (uint64_t) fsignal.size();
+    });
+
+    int16_t coeff_q15[FIR_MAX_TAPS + FIR_Q15_PAD];
+    std::vector<int16_t> qout(signal.size());
+
+    fir_coeff_q15(coeff, fir.taps, coeff_q15);
+
+    run("fir_block_q15", sample_rate, lpm, [&](uint64_t *lines) {
+        fir_block_q15(coeff_q15, fir.taps, &filter.state_q15, signal.data(), qout.data(), signal.size());
+        sink = qout.back();
+        *lines = 0;
+        return (uint64_t) signal.size();
+    });
+
+    run("DemodulateData", sample_rate, lpm, [&](uint64_t *lines) {
+        FaxBench::LoadLine(faxdec, &signal[(line++ % nlines) * spl]);
+        FaxBench::Demodulate(faxdec);
+        *lines = 1;
+        return (uint64_t) spl;
+    });
+
+    faxdec.SetFixedPoint(true);
+
+    run("DemodulateData_q15", sample_rate, lpm, [&](uint64_t *lines) {
+        FaxBench::LoadLine(faxdec, &signal[(line++ % nlines) * spl]);
+        FaxBench::Demodulate(faxdec);
+        *lines = 1;
+        return (uint64_t) spl;
+    });
+
+    faxdec.SetFixedPoint(false);
+
+    volatile int32_t isink = 0;
+
+    run("DetectLineType", sample_rate, lpm, [&](uint64_t *lines) {
+        isink = FaxBench::DetectLineType(faxdec);
+        *lines = 1;
+        return (uint64_t) spl;
+    });
+
+    run("FaxPhasingLinePosition", sample_rate, lpm, [&](uint64_t *lines) {
+        isink = FaxBench::PhasingPosition(faxdec);
+        *lines = 1;
+        return (uint64_t) spl;
+    });
+
+    // current and previous line for the blending
+    std::vector<uint8_t> rows(1809 * 2);
+
+    run("DecodeImageLine", sample_rate, lpm, [&](uint64_t *lines) {
+        FaxBench::DecodeImageLine(faxdec, &rows[1809]);
+        *lines = 1;
+        return (uint64_t) spl;
+    });
+
+    char pgm_name[] = "/tmp/fax_bench_XXXXXX";
+    int fd = mkstemp(pgm_name);
+    close(fd);
+
+    faxdec.FileOpen(pgm_name);
+
+    run("FileWrite", sample_rate, lpm, [&](uint64_t *lines) {
+        faxdec.FileWrite(&rows[1809], 1809);
+        *lines = 1;
+        return (uint64_t) spl;
+    });
+
+    faxdec.FileClose();
+    unlink(pgm_name);
+}
+
+static void bench_avg()
+{
+    std::vector<int16_t> data(1 << 20);
+    uint32_t x = 1;
+
+    for (auto &d : data) {
+        x = x * 1664525 + 1013904223;
+        d = (int16_t)(x >> 16) / 4 + 300;
+    }
+
+    volatile double sink = 0;
+
+#define BENCH_AVERAGE(fn) \
+    run(#fn, 0, 0, [&](uint64_t *lines) { sink = fn(data.data(), data.size()); *lines = 0; return (uint64_t) data.size(); })
+#define BENCH_SUBTRACT(fn) \
+    run(#fn, 0, 0, [&](uint64_t *lines) { fn(data.data(), data.size(), 0); *lines = 0; return (uint64_t) data.size(); })
+
+    BENCH_AVERAGE(int16_float_average);
+    BENCH_AVERAGE(int16_average);
+    BENCH_SUBTRACT(int16_subtract);
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+    BENCH_AVERAGE(int16_float_avx512_average);
+    BENCH_AVERAGE(int16_avx512_average);
+    BENCH_SUBTRACT(int16_avx512_subtract);
+#elif defined(__ARM_NEON)
+    BENCH_AVERAGE(int16_float_neon_average);
+#endif
+}
+
+static void spin(FaxStats *stats, FaxStage stage, double seconds)
+{
+    FaxStageTimer timer(stats, stage);
+    double start = now();
+
+    while (now() - start < seconds) {
+    }
+}
+
+/* Stage times are exclusive, so they can't add up to more than the time they
+   were measured in: nested timers by hand, then a decoder with stats on. */
+static bool check_stage_timers(int32_t sample_rate, int32_t lpm)
+{
+    FaxStats stats;
+    bool ok = true;
+
+    fax_stats_reset(&stats);
+
+    double start = now();
+    {
+        FaxStageTimer line(&stats, FAX_STAGE_LINE);
+        spin(&stats, FAX_STAGE_LINE, 0.02);
+        spin(&stats, FAX_STAGE_WRITE, 0.03);
+        spin(&stats, FAX_STAGE_LINE, 0.02);
+    }
+    double wall = now() - start;
+    double line = stats.stage[FAX_STAGE_LINE].wall_ns / 1e9, write = stats.stage[FAX_STAGE_WRITE].wall_ns / 1e9;
+    bool nested_ok = line + write <= wall + 1e-6 && line < 0.045;
+
+    fprintf(stdout, "%-24s line %.4f + write %.4f s of %.4f s wall  %s\n", "nested timers", line, write, wall,
+        nested_ok? "ok" : "FAIL");
+    ok = ok && nested_ok;
+
+    FaxEncoder faxenc;
+    std::vector<uint8_t> image(1809 * 100);
+    std::vector<int16_t> signal;
+
+    FaxEncoder::TestPattern(image.data(), 1809, 100);
+    faxenc.Configure(lpm, sample_rate, 1900, 400, 0, 16384, 1000, 0, 1);
+    faxenc.Gap(2, signal);
+    faxenc.Transmission(image.data(), 1809, 100, signal);
+
+    char pgm_name[] = "/tmp/fax_bench_XXXXXX";
+    int fd = mkstemp(pgm_name);
+    close(fd);
+
+    FaxDecoder faxdec;
+    configure(faxdec, sample_rate, lpm, true);
+    faxdec.FileOpen(pgm_name);
+    faxdec.SetStats(true);
+
+    start = now();
+    for (size_t i = 0; i < signal.size(); i += sample_rate) {
+        faxdec.ProcessSamples(&signal[i], MIN(signal.size() - i, (size_t)sample_rate), 0);
+    }
+    wall = now() - start;
+
+    faxdec.FileClose();
+    unlink(pgm_name);
+
+    double sum = 0;
+    for (int32_t i = 0; i < FAX_STAGE_COUNT; i++) {
+        sum += faxdec.Stats()->stage[i].wall_ns / 1e9;
+    }
+
+    bool decoder_ok = sum <= wall + 1e-6;
+
+    fprintf(stdout, "%-24s %6d %4d stages %.4f s of %.4f s wall  %s\n", "stage timers", sample_rate, lpm, sum, wall,
+        decoder_ok? "ok" : "FAIL");
+
+    return ok && decoder_ok;
+}
+
+/* The same steps as the fax utility: read WAV in big blocks, remove DC,
+   feed one second at a time and write PGM. */
+static void bench_pipeline(int32_t sample_rate, int32_t lpm, int32_t image_lines)
+{
+    char wav_name[] = "/tmp/fax_bench_XXXXXX";
+    char pgm_name[] = "/tmp/fax_bench_XXXXXX";
+    int fd = mkstemp(wav_name);
+    close(fd);
+    fd = mkstemp(pgm_name);
+    close(fd);
+
+    FaxEncoder faxenc;
+    std::vector<uint8_t> image(1809 * image_lines);
+    std::vector<int16_t> signal;
+
+    FaxEncoder::TestPattern(image.data(), 1809, image_lines);
+    faxenc.Configure(lpm, sample_rate, 1900, 400, 0, 16384, 1000, 300, 1);
+    faxenc.Gap(2, signal);
+    faxenc.Transmission(image.data(), 1809, image_lines, signal);
+    faxenc.Gap(2, signal);
+
+    FILE *wav = fopen(wav_name, "wb");
+    wav_write_header(wav, sample_rate, 1, signal.size() * sizeof(int16_t));
+    fwrite(signal.data(), sizeof(int16_t), signal.size(), wav);
+    fclose(wav);
+
+    const int32_t read_buf_size = (1048576 / sizeof(int16_t) / sample_rate) * sample_rate;
+    std::vector<int16_t> readbuf(read_buf_size);
+
+    run("pipeline", sample_rate, lpm, [&](uint64_t *lines) {
+        FaxDecoder faxdec;
+        wav_header_t hdr;
+        uint64_t total = 0;
+        size_t nread;
+
+        FILE *in = fopen(wav_name, "r");
+        nread = fread(&hdr, sizeof(wav_header_t), 1, in);
+
+        configure(faxdec, hdr.sample_rate, lpm, true);
+        faxdec.FileOpen(pgm_name);
+
+        while ((nread = fread(readbuf.data(), sizeof(int16_t), read_buf_size, in)) > 0) {
+            float avg = FLOAT_AVERAGE(readbuf.data(), nread);
+            SAMPLES_SUBTRACT(readbuf.data(), nread, avg);
+
+            for (size_t i = 0; i < nread; i += hdr.sample_rate) {
+                faxdec.ProcessSamples(&readbuf[i], MIN(nread - i, (size_t)hdr.sample_rate), 0);
+            }
+            total += nread;
+        }
+
+        *lines = faxdec.m_imageline;
+        faxdec.FileClose();
+        fclose(in);
+
+        return total;
+    });
+
+    unlink(wav_name);
+    unlink(pgm_name);
+}
+
+static std::vector<int32_t> parse_list(const char *s)
+{
+    std::vector<int32_t> list;
+
+    while (*s) {
+        list.push_back(atoi(s));
+        s = strchr(s, ',');
+        if (s == NULL) {
+            break;
+        }
+        s++;
+    }
+
+    return list;
+}
+
+static std::string cpu_model()
+{
+    std::string model = "unknown";
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    char line[512];
+
+    while (f != NULL && fgets(line, sizeof line, f)) {
+        // "model name" on x86, "Model" on Raspberry Pi
+        if (strncmp(line, "model name", 10) == 0 || strncmp(line, "Model", 5) == 0) {
+            char *v = strchr(line, ':');
+            if (v != NULL) {
+                model = v + 2;
+                model.erase(model.find_last_not_of(" \n") + 1);
+            }
+            if (line[0] == 'm') {
+                break;
+            }
+        }
+    }
+
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    return model;
+}
+
+static void write_json(const char *file_name)
+{
+    FILE *f = fopen(file_name, "w");
+
+    if (f == NULL) {
+        fprintf(stderr, "Can't write %s\n", file_name);
+        return;
+    }
+
+    struct utsname un;
+    uname(&un);
+    time_t t = time(NULL);
+    char stamp[32];
+    strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"version\": \"%s\",\n", VERSION);
+    fprintf(f, "  \"timestamp\": \"%s\",\n", stamp);
+    fprintf(f, "  \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(f, "  \"machine\": {\"arch\": \"%s\", \"cpu\": \"%s\", \"cores\": %u, \"kernel\": \"%s\"},\n",
+        un.machine, cpu_model().c_str(), std::thread::hardware_concurrency(), un.release);
+    fprintf(f, "  \"results\": [\n");
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result_t &r = results[i];
+
+        fprintf(f, "    {\"stage\": \"%s\", \"sample_rate\": %d, \"lpm\": %d, \"samples\": %" PRIu64 ", \"lines\": %" PRIu64 ", "
+                   "\"seconds\": %.6f, \"msamples_per_sec\": %.3f, ",
+            r.stage.c_str(), r.sample_rate, r.lpm, r.samples, r.lines, r.seconds, r.samples / r.seconds / 1e6);
+
+        if (r.lines) {
+            fprintf(f, "\"ns_per_line\": %.1f, ", r.seconds * 1e9 / r.lines);
+        } else {
+            fprintf(f, "\"ns_per_line\": null, ");
+        }
+
+        if (r.cycles) {
+            fprintf(f, "\"cycles_per_sample\": %.3f}", (double)r.cycles / r.samples);
+        } else {
+            fprintf(f, "\"cycles_per_sample\": null}");
+        }
+
+        fprintf(f, "%s\n", (i + 1 < results.size())? "," : "");
+    }
+
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+}
+
+static void usage()
+{
+    fprintf(stdout,
+        "Usage: fax_bench [options]\n"
+        "  -j, --json <file>          write the results as JSON\n"
+        "  -R, --rates <list>         sample rates, comma separated (default: 8000,12000,48000)\n"
+        "  -l, --lpm <list>           LPMs, comma separated (default: 60,120)\n"
+        "  -t, --min_time <sec>       minimal time of one measurement (default: 0.25)\n"
+        "  -e, --e2e_lines <lines>    image lines of the end to end pipeline run (default: 300)\n");
+}
+
+int main(int argc, char *const * argv)
+{
+    fprintf(stdout, "Radio Fax decoder benchmark v" VERSION "\n");
+
+    // keep the decoder messages away from the measurements
+    fax_log_set_level(FAX_LOG_WARN);
+
+    char *json_name = NULL;
+    std::vector<int32_t> rates {8000, 12000, 48000};
+    std::vector<int32_t> lpms {60, 120};
+    int32_t e2e_lines {300};
+
+    static struct option long_options[] =
+    {
+        {"json",        required_argument, 0, 'j'},
+        {"rates",       required_argument, 0, 'R'},
+        {"lpm",         required_argument, 0, 'l'},
+        {"min_time",    required_argument, 0, 't'},
+        {"e2e_lines",   required_argument, 0, 'e'},
+        {0, 0, 0, 0}
+    };
+
+    int opt_idx = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "j:R:l:t:e:", long_options, &opt_idx)) >= 0) {
+        switch(c) {
+            case 'j': json_name = optarg; break;
+            case 'R': rates = parse_list(optarg); break;
+            case 'l': lpms = parse_list(optarg); break;
+            case 't': min_time = atof(optarg); break;
+            case 'e': e2e_lines = atoi(optarg); break;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    fprintf(stdout, "%-24s %6s %4s %15s %20s%s\n", "stage", "rate", "lpm", "throughput", "per line",
+#ifdef HAVE_TSC
+        "   per sample (TSC)"
+#else
+        ""
+#endif
+    );
+
+    for (int32_t rate : rates) {
+        for (int32_t lpm : lpms) {
+            bench_stages(rate, lpm);
+        }
+    }
+
+    bench_avg();
+
+    for (int32_t rate : rates) {
+        for (int32_t lpm : lpms) {
+            bench_pipeline(rate, lpm, e2e_lines);
+        }
+    }
+
+    bool timers_ok = check_stage_timers(rates[0], lpms[0]);
+
+    if (json_name != NULL) {
+        write_json(json_name);
+        fprintf(stdout, "Results written to %s\n", json_name);
+    }
+
+    return timers_ok? 0 : 1;
+}
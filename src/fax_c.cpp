@@ -0,0 +1,344 @@
+#include "fax_c.h"
+#include "FaxDecoder.h"
+#include "log.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// Callback first, then a ring of the last queue_lines lines for pulling
+class QueueLineSink : public FaxLineSink
+{
+public:
+    QueueLineSink():
+        m_cb {NULL},
+        m_user {NULL},
+        m_width {0},
+        m_capacity {0},
+        m_head {0},
+        m_count {0},
+        m_emitted {0},
+        m_dropped {0}
+    {
+    }
+
+    void Setup(int32_t width, int32_t capacity)
+    {
+        m_width = width;
+        m_capacity = capacity;
+        m_lines.resize((size_t)width * capacity);
+        m_index.resize(capacity);
+        m_time.resize(capacity);
+    }
+
+    void Line(std::span<const uint8_t> line, int64_t index, double timestamp) override
+    {
+        m_emitted++;
+
+        if (m_cb != NULL) {
+            m_cb(m_user, line.data(), (int32_t) line.size(), index, timestamp);
+        }
+
+        if (m_capacity == 0) return;
+
+        if (m_count == m_capacity) {
+            m_head = (m_head + 1) % m_capacity;
+            m_count--;
+            m_dropped++;
+        }
+
+        int32_t slot = (m_head + m_count) % m_capacity;
+        memcpy(&m_lines[(size_t)slot * m_width], line.data(), std::min((size_t)m_width, line.size()));
+        m_index[slot] = index;
+        m_time[slot] = timestamp;
+        m_count++;
+    }
+
+    void Clear()
+    {
+        m_head = m_count = 0;
+        m_emitted = m_dropped = 0;
+    }
+
+    bool Pop(uint8_t *buf, int64_t *index, double *timestamp)
+    {
+        if (m_count == 0) return false;
+
+        memcpy(buf, &m_lines[(size_t)m_head * m_width], m_width);
+        if (index) *index = m_index[m_head];
+        if (timestamp) *timestamp = m_time[m_head];
+
+        m_head = (m_head + 1) % m_capacity;
+        m_count--;
+        return true;
+    }
+
+    faxdec_line_cb m_cb;
+    void *m_user;
+    int32_t m_width, m_capacity, m_head, m_count;
+    uint64_t m_emitted, m_dropped;
+
+private:
+    std::vector<uint8_t> m_lines;
+    std::vector<int64_t> m_index;
+    std::vector<double> m_time;
+};
+
+// the first released layout, anything shorter is not a faxdec_config_t
+#define CONFIG_MIN_SIZE (offsetof(faxdec_config_t, queue_lines) + sizeof(int32_t))
+
+struct faxdec {
+    FaxDecoder dec;
+    QueueLineSink sink;
+    uint64_t samples;
+    bool finished;
+};
+
+// No exception may leave the library, allocation failures become FAXDEC_ERR_NOMEM
+template <typename F>
+static int guarded(F f)
+{
+    try {
+        return f();
+    } catch (const std::bad_alloc &) {
+        return FAXDEC_ERR_NOMEM;
+    } catch (...) {
+        return FAXDEC_ERR_INVALID;
+    }
+}
+
+const char *faxdec_version(void)
+{
+    return FAX_VERSION;
+}
+
+const char *faxdec_strerror(int err)
+{
+    switch (err) {
+        case FAXDEC_OK: return "no error";
+        case FAXDEC_ERR_INVALID: return "invalid argument";
+        case FAXDEC_ERR_NOMEM: return "out of memory";
+        case FAXDEC_ERR_STATE: return "not available in this state";
+    }
+    return "unknown error";
+}
+
+void faxdec_set_log_level(int level)
+{
+    fax_log_set_level(level);
+}
+
+void faxdec_config_init(faxdec_config_t *config)
+{
+    memset(config, 0, sizeof(faxdec_config_t));
+    config->size = sizeof(faxdec_config_t);
+    config->lpm = 120;
+    config->width = 1809;
+    config->carrier = 1900;
+    config->deviation = 400;
+    config->bandwidth = FAXDEC_BANDWIDTH_MIDDLE;
+    config->include_headers = 1;
+    config->phasing = 1;
+}
+
+faxdec_t *faxdec_create(const faxdec_config_t *config)
+{
+    if (config == NULL || config->size < CONFIG_MIN_SIZE) {
+        return NULL;
+    }
+
+    // an older caller knows only the front of the struct, the rest keeps the defaults
+    faxdec_config_t cfg;
+    faxdec_config_init(&cfg);
+    memcpy(&cfg, config, std::min(config->size, sizeof(faxdec_config_t)));
+
+    if (cfg.sample_rate <= 0 || cfg.lpm < FAX_MIN_LPM || cfg.lpm > 240 || cfg.width < 16 ||
+        cfg.carrier <= 0 || cfg.deviation <= 0 || cfg.queue_lines < 0 || cfg.line_limit < 0 ||
+        cfg.bandwidth < FAXDEC_BANDWIDTH_NARROW || cfg.bandwidth > FAXDEC_BANDWIDTH_WIDE) {
+        return NULL;
+    }
+
+    faxdec_t *h = new (std::nothrow) faxdec_t;
+
+    if (h == NULL) {
+        return NULL;
+    }
+
+    int err = guarded([&]() {
+        h->dec.Configure(cfg.lpm, cfg.width, 8, cfg.carrier, cfg.deviation,
+            (FaxDecoder::firfilter::Bandwidth) cfg.bandwidth, 15.0,
+            cfg.include_headers != 0, cfg.phasing != 0, cfg.auto_stop != 0, false, false,
+            cfg.sample_rate, cfg.srcorr_ppm / 1000000 + 1, cfg.line_limit);
+
+        h->dec.SetAutoAlign(cfg.auto_align);
+        h->dec.SetCarrierGate(cfg.carrier_gate != 0);
+        h->dec.SetAfc(cfg.afc != 0);
+        h->dec.SetAutoLpm(cfg.auto_lpm != 0);
+        h->dec.SetStats(cfg.stats != 0);
+
+        h->sink.Setup(cfg.width, cfg.queue_lines);
+        h->dec.SetLineSink(&h->sink);
+        return FAXDEC_OK;
+    });
+
+    if (err != FAXDEC_OK) {
+        delete h;
+        return NULL;
+    }
+
+    h->samples = 0;
+    h->finished = false;
+    return h;
+}
+
+void faxdec_destroy(faxdec_t *dec)
+{
+    delete dec;
+}
+
+int faxdec_reset(faxdec_t *dec)
+{
+    if (dec == NULL) {
+        return FAXDEC_ERR_INVALID;
+    }
+
+    return guarded([&]() {
+        dec->dec.Reset();
+        dec->dec.SetLineSink(&dec->sink);
+        dec->sink.Clear();
+        dec->samples = 0;
+        dec->finished = false;
+        return FAXDEC_OK;
+    });
+}
+
+void faxdec_set_line_callback(faxdec_t *dec, faxdec_line_cb cb, void *user)
+{
+    if (dec == NULL) return;
+
+    dec->sink.m_cb = cb;
+    dec->sink.m_user = user;
+}
+
+int faxdec_push_samples(faxdec_t *dec, const int16_t *samples, size_t count)
+{
+    if (dec == NULL || (samples == NULL && count > 0)) {
+        return FAXDEC_ERR_INVALID;
+    }
+
+    if (dec->finished) {
+        return 0;
+    }
+
+    return guarded([&]() {
+        // ProcessSamples takes an int32_t count
+        while (count > 0) {
+            int32_t n = (int32_t) std::min(count, (size_t) 1 << 20);
+
+            // a chunk is decoded whole or, after the end, not at all
+            if (!dec->dec.ProcessSamples(samples, n, 0)) {
+                dec->finished = true;
+                return 0;
+            }
+
+            dec->samples += n;
+            samples += n;
+            count -= n;
+        }
+
+        return 1;
+    });
+}
+
+int faxdec_finish(faxdec_t *dec)
+{
+    if (dec == NULL) {
+        return FAXDEC_ERR_INVALID;
+    }
+
+    return guarded([&]() {
+        dec->dec.FileClose();
+        dec->finished = true;
+        return FAXDEC_OK;
+    });
+}
+
+int32_t faxdec_width(const faxdec_t *dec)
+{
+    return dec? dec->sink.m_width : 0;
+}
+
+int faxdec_pull_line(faxdec_t *dec, uint8_t *buf, size_t buf_size, int64_t *index, double *timestamp)
+{
+    if (dec == NULL || buf == NULL || buf_size < (size_t) dec->sink.m_width) {
+        return FAXDEC_ERR_INVALID;
+    }
+
+    return dec->sink.Pop(buf, index, timestamp)? 1 : 0;
+}
+
+int faxdec_get_stats(const faxdec_t *dec, faxdec_stats_t *stats)
+{
+    if (dec == NULL || stats == NULL) {
+        return FAXDEC_ERR_INVALID;
+    }
+
+    memset(stats, 0, sizeof(faxdec_stats_t));
+    stats->samples = dec->samples;
+    stats->lines_emitted = dec->sink.m_emitted;
+    stats->lines_dropped = dec->sink.m_dropped;
+    stats->lines_queued = dec->sink.m_count;
+    stats->lpm = dec->dec.Lpm();
+    stats->afc_offset = dec->dec.AfcOffset();
+
+    const FaxStats *s = dec->dec.Stats();
+
+    if (s != NULL) {
+        stats->lines_decoded = s->lines_decoded;
+        stats->start_events = s->start_events;
+        stats->stop_events = s->stop_events;
+        stats->phasing_accepted = s->phasing_accepted;
+        stats->phasing_rejected = s->phasing_rejected;
+
+        for (int32_t i = 0; i < FAX_STAGE_COUNT; i++) {
+            stats->cpu_seconds += s->stage[i].cpu_ns / 1e9;
+        }
+    }
+
+    return FAXDEC_OK;
+}
+
+int faxdec_stats_json(const faxdec_t *dec, char *buf, size_t buf_size)
+{
+    if (dec == NULL || (buf == NULL && buf_size > 0)) {
+        return FAXDEC_ERR_INVALID;
+    }
+
+    if (dec->dec.Stats() == NULL) {
+        return FAXDEC_ERR_STATE;
+    }
+
+    return guarded([&]() {
+        char *text = NULL;
+        size_t len = 0;
+        FILE *f = open_memstream(&text, &len);
+
+        if (f == NULL) {
+            return FAXDEC_ERR_NOMEM;
+        }
+
+        fax_stats_json(dec->dec.Stats(), f);
+        fclose(f);
+
+        if (buf_size > 0) {
+            size_t n = std::min(len, buf_size - 1);
+            memcpy(buf, text, n);
+            buf[n] = 0;
+        }
+
+        free(text);
+        return (int) len;
+    });
+}
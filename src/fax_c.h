@@ -0,0 +1,133 @@
+#pragma once
+
+/*
+    C interface of the fax decoder, built as libfax.so.
+
+    A decoder is an opaque handle: create it from a faxdec_config_t, push
+    16 bit mono samples into it and get the image lines either through a
+    callback or by pulling them from a bounded queue. Handles are
+    independent but not thread safe, use one per thread.
+
+    The interface only grows: new config fields are appended, the size
+    field tells the library how much of the struct the caller knows about.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define FAXDEC_API __attribute__((visibility("default")))
+#else
+#define FAXDEC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FAXDEC_OK           0
+#define FAXDEC_ERR_INVALID  -1      /* bad argument or configuration */
+#define FAXDEC_ERR_NOMEM    -2
+#define FAXDEC_ERR_STATE    -3      /* not available in this state, e.g. stats disabled */
+
+#define FAXDEC_BANDWIDTH_NARROW 0
+#define FAXDEC_BANDWIDTH_MIDDLE 1
+#define FAXDEC_BANDWIDTH_WIDE   2
+
+#define FAXDEC_LOG_ERROR    0
+#define FAXDEC_LOG_WARN     1
+#define FAXDEC_LOG_INFO     2
+#define FAXDEC_LOG_DEBUG    3
+#define FAXDEC_LOG_TRACE    4
+
+typedef struct faxdec faxdec_t;
+
+typedef struct faxdec_config {
+    size_t size;                /* sizeof(faxdec_config_t), set by faxdec_config_init() */
+
+    double sample_rate;         /* Hz, required */
+    int32_t lpm;                /* lines per minute, 60..240 */
+    int32_t width;              /* pixels per line */
+    double carrier;             /* Hz */
+    double deviation;           /* Hz, black and white are carrier -+ deviation */
+    int32_t bandwidth;          /* FAXDEC_BANDWIDTH_* */
+    double srcorr_ppm;          /* sound card clock error */
+
+    int32_t include_headers;    /* START/STOP and phasing lines in the image */
+    int32_t phasing;            /* align lines on the phasing pulses */
+    int32_t auto_stop;          /* end on the STOP tone */
+    int32_t line_limit;         /* end after so many lines, 0 for none */
+    int32_t auto_align;         /* lines for the white margin alignment, 0 disables */
+    int32_t carrier_gate;       /* skip blocks without a fax carrier */
+    int32_t afc;                /* track carrier drift */
+    int32_t auto_lpm;           /* switch to the line rate of the phasing lines */
+    int32_t stats;              /* per stage timers, see faxdec_stats_json() */
+
+    int32_t queue_lines;        /* lines kept for faxdec_pull_line(), oldest dropped when full */
+} faxdec_config_t;
+
+typedef struct faxdec_stats {
+    uint64_t samples;           /* decoded, not those pushed after the end */
+    uint64_t lines_emitted;     /* passed to the callback or the queue */
+    uint64_t lines_dropped;     /* queue overflows */
+    int32_t lines_queued;
+    int32_t lpm;                /* current line rate */
+    double afc_offset;          /* Hz */
+
+    /* only with config.stats, zero otherwise */
+    uint64_t lines_decoded;
+    uint32_t start_events, stop_events;
+    uint32_t phasing_accepted, phasing_rejected;
+    double cpu_seconds;         /* in the decoder */
+} faxdec_stats_t;
+
+/* The line buffer is only valid during the call */
+typedef void (*faxdec_line_cb)(void *user, const uint8_t *line, int32_t width,
+                               int64_t index, double timestamp);
+
+FAXDEC_API const char *faxdec_version(void);
+FAXDEC_API const char *faxdec_strerror(int err);
+
+/* Messages go to stdout/stderr, FAXDEC_LOG_INFO by default. Process wide. */
+FAXDEC_API void faxdec_set_log_level(int level);
+
+/* Defaults of the fax command: 120 LPM, 1809 pixels, 1900 +- 400 Hz, phasing */
+FAXDEC_API void faxdec_config_init(faxdec_config_t *config);
+
+/* NULL on a bad configuration or out of memory */
+FAXDEC_API faxdec_t *faxdec_create(const faxdec_config_t *config);
+FAXDEC_API void faxdec_destroy(faxdec_t *dec);
+
+/* Ready for the next input with the same configuration. Queued lines are
+   dropped, buffers are kept: a handle reused for many jobs does not allocate. */
+FAXDEC_API int faxdec_reset(faxdec_t *dec);
+
+/* Called for every line, before it is queued. NULL removes it. */
+FAXDEC_API void faxdec_set_line_callback(faxdec_t *dec, faxdec_line_cb cb, void *user);
+
+/* 1 while more samples are wanted, 0 once the decoder has finished (STOP
+   tone with auto_stop, line limit), negative on error. Lines come out
+   through the callback during the call. */
+FAXDEC_API int faxdec_push_samples(faxdec_t *dec, const int16_t *samples, size_t count);
+
+/* End of input: delivers the lines held back for auto_align */
+FAXDEC_API int faxdec_finish(faxdec_t *dec);
+
+FAXDEC_API int32_t faxdec_width(const faxdec_t *dec);
+
+/* Oldest queued line into buf (at least width bytes). 1 when a line was
+   copied, 0 when the queue is empty, negative on error. index and timestamp
+   (input position in seconds) may be NULL. */
+FAXDEC_API int faxdec_pull_line(faxdec_t *dec, uint8_t *buf, size_t buf_size,
+                                int64_t *index, double *timestamp);
+
+FAXDEC_API int faxdec_get_stats(const faxdec_t *dec, faxdec_stats_t *stats);
+
+/* Full stats as JSON, like "fax --stats". Writes at most buf_size bytes
+   including the terminating 0 and returns the length of the whole text,
+   as snprintf(), or a negative error. Needs config.stats. */
+FAXDEC_API int faxdec_stats_json(const faxdec_t *dec, char *buf, size_t buf_size);
+
+#ifdef __cplusplus
+}
+#endif
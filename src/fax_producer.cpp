@@ -0,0 +1,257 @@
+/*********************************************************************************
+ *
+ * Project:  FAX Decoder
+ * Purpose:  test producer sending a WAV file as a live SDR feed (UDP, RTP, shm)
+ * Author:   Darau, Blė
+ *
+ **********************************************************************************
+ *   Copyright (C) 2023 by Darau, Blė                                             *
+ *                                                                                *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ * of this software and associated documentation files (the "Software"), to deal  *
+ * in the Software without restriction, including without limitation the rights   *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ * copies of the Software, and to permit persons to whom the Software is          *
+ * furnished to do so, subject to the following conditions:                       *
+ *                                                                                *
+ * The above copyright notice and this permission notice shall be included in all *
+ * copies or substantial portions of the Software.                                *
+ *                                                                                *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ * SOFTWARE.                                                                      *
+ *                                                                                *
+ **********************************************************************************
+ */
+#define VERSION "1.0.6"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "pcmsource.h"
+#include "wav.h"
+
+/*
+    Stand-in for an SDR demodulator: sends the samples of a WAV file the way
+    a receiver would, paced in real time, to try the live inputs of fax:
+
+        fax_producer -w fax.wav --rtp 127.0.0.1:5004 --drop_every 50 &
+        fax --rtp 127.0.0.1:5004 --sample_rate 12000
+*/
+
+#define RTP_PAYLOAD_TYPE    96      // dynamic, as L16 at rates other than 44100
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int)
+{
+    stop_requested = 1;
+}
+
+static int udp_connect(const char *spec)
+{
+    const char *colon = strrchr(spec, ':');
+
+    if (colon == NULL) {
+        FAX_ERROR("UDP destination is host:port, not %s\n", spec);
+        return -1;
+    }
+
+    std::string host(spec, colon - spec);
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    int err = getaddrinfo(host.c_str(), colon + 1, &hints, &ai);
+
+    if (err != 0) {
+        FAX_ERROR("UDP address %s: %s\n", spec, gai_strerror(err));
+        return -1;
+    }
+
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (s < 0 || connect(s, ai->ai_addr, ai->ai_addrlen) < 0) {
+        FAX_ERROR("connect(%s) failed: %s\n", spec, strerror(errno));
+        freeaddrinfo(ai);
+        return -1;
+    }
+
+    freeaddrinfo(ai);
+    return s;
+}
+
+int main(int argc, char *const * argv)
+{
+    char *file_name = NULL;
+    const char *udp_spec = NULL;
+    const char *shm_name = NULL;
+    bool rtp {false};
+    double block_ms {20};
+    double speed {1};
+    double ring_sec {2};
+    int32_t drop_every {0};
+
+    static struct option long_options[] =
+    {
+        {"wav_file",    required_argument, 0, 'w'},
+        {"udp",         required_argument, 0, 'U'},
+        {"rtp",         required_argument, 0, 'T'},
+        {"shm",         required_argument, 0, 'M'},
+        {"block",       required_argument, 0, 'b'},
+        {"speed",       required_argument, 0, 'x'},
+        {"ring",        required_argument, 0, 'r'},
+        {"drop_every",  required_argument, 0, 'd'},
+        {0, 0, 0, 0}
+    };
+
+    int opt_idx = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "w:b:x:r:d:", long_options, &opt_idx)) >= 0) {
+        switch(c) {
+            case 'w': file_name = optarg; break;
+            case 'U': udp_spec = optarg; rtp = false; break;
+            case 'T': udp_spec = optarg; rtp = true; break;
+            case 'M': shm_name = optarg; break;
+            case 'b': block_ms = atof(optarg); break;
+            case 'x': speed = atof(optarg); break;
+            case 'r': ring_sec = atof(optarg); break;
+            case 'd': drop_every = atoi(optarg); break;
+        }
+    }
+
+    if (file_name == NULL || (udp_spec == NULL) == (shm_name == NULL)) {
+        fprintf(stderr, "Usage: %s -w <file name> --udp|--rtp <host:port> | --shm <name>\n"
+            "    [--block <ms>] [--speed <x real time, 0 unpaced>] [--ring <sec>] [--drop_every <n>]\n", argv[0]);
+        exit(-1);
+    }
+
+    FILE *fd = fopen(file_name, "r");
+    wav_header_t hdr;
+
+    if (fd == NULL || fread(&hdr, sizeof(hdr), 1, fd) != 1) {
+        FAX_ERROR("Can't read %s\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    if (hdr.channels != 1 || hdr.bit_depth != 16) {
+        FAX_ERROR("%s: 16 bit mono expected\n", file_name);
+        exit(EXIT_FAILURE);
+    }
+
+    // a datagram must stay below the 64 kB limit
+    size_t block = std::max((size_t) 1, (size_t)(hdr.sample_rate * block_ms / 1000));
+
+    if (udp_spec != NULL) {
+        block = std::min(block, (size_t) 16000);
+    }
+
+    int sock = -1;
+    ShmPcmWriter ring;
+
+    if (udp_spec != NULL) {
+        if ((sock = udp_connect(udp_spec)) < 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (!ring.Create(shm_name, hdr.sample_rate, hdr.sample_rate * ring_sec)) {
+        exit(EXIT_FAILURE);
+    }
+
+    FAX_INFO("Sending %s, %u samples/sec, %zu samples per block, %.1fx real time\n",
+        file_name, hdr.sample_rate, block, speed);
+
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+    // the decoder may go away first
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<int16_t> samples(block);
+    std::vector<uint8_t> packet(12 + block * sizeof(int16_t));
+    srand(time(NULL) ^ getpid());
+    uint16_t seq = rand();
+    uint32_t ts = rand();
+    const uint32_t ssrc = rand();
+    uint64_t sent = 0, dropped = 0;
+    int64_t packets = 0;
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    size_t n;
+
+    while (!stop_requested && (n = fread(samples.data(), sizeof(int16_t), block, fd)) > 0) {
+        packets++;
+
+        if (sock >= 0 && drop_every > 0 && packets % drop_every == 0) {
+            // lost on the way: RTP sees the gap in the timestamps
+            dropped += n;
+        } else if (sock >= 0 && rtp) {
+            uint8_t *h = packet.data();
+            h[0] = 0x80;
+            h[1] = RTP_PAYLOAD_TYPE;
+            *(uint16_t*)(h + 2) = htons(seq);
+            *(uint32_t*)(h + 4) = htonl(ts);
+            *(uint32_t*)(h + 8) = htonl(ssrc);
+
+            for (size_t i = 0; i < n; i++) {
+                h[12 + 2 * i] = (uint16_t) samples[i] >> 8;
+                h[12 + 2 * i + 1] = (uint16_t) samples[i] & 0xff;
+            }
+
+            send(sock, h, 12 + n * sizeof(int16_t), 0);
+        } else if (sock >= 0) {
+            send(sock, samples.data(), n * sizeof(int16_t), 0);
+        } else {
+            // unpaced there is time to wait for the decoder, live there is not
+            ring.Write(samples.data(), n, speed <= 0);
+        }
+
+        seq++;
+        ts += n;
+        sent += n;
+
+        if (speed > 0) {
+            uint64_t ns = next.tv_nsec + (uint64_t)(n * 1e9 / hdr.sample_rate / speed);
+            next.tv_sec += ns / 1000000000;
+            next.tv_nsec = ns % 1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+
+    if (sock >= 0) {
+        FAX_INFO("Sent %.1f sec of audio, dropped %.1f sec on purpose\n",
+            (double) sent / hdr.sample_rate, (double) dropped / hdr.sample_rate);
+        close(sock);
+    } else {
+        FAX_INFO("Sent %.1f sec of audio, ring overruns %.1f sec\n",
+            (double) sent / hdr.sample_rate, (double) ring.Overruns() / hdr.sample_rate);
+
+        // the decoder drains the ring before it is removed
+        while (!stop_requested && ring.Pending() > 0) {
+            usleep(10000);
+        }
+        ring.Close();
+    }
+
+    fclose(fd);
+    return 0;
+}
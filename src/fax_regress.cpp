@@ -0,0 +1,627 @@
+/*********************************************************************************
+ *
+ * Project:  FAX Decoder
+ * Purpose:  decode synthetic signals and check image fidelity and throughput
+ * Author:   Darau, Blė
+ *
+ **********************************************************************************
+ *   Copyright (C) 2023 by Darau, Blė                                             *
+ *                                                                                *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ * of this software and associated documentation files (the "Software"), to deal  *
+ * in the Software without restriction, including without limitation the rights   *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ * copies of the Software, and to permit persons to whom the Software is          *
+ * furnished to do so, subject to the following conditions:                       *
+ *                                                                                *
+ * The above copyright notice and this permission notice shall be included in all *
+ * copies or substantial portions of the Software.                                *
+ *                                                                                *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ * SOFTWARE.                                                                      *
+ *                                                                                *
+ **********************************************************************************
+ */
+#define VERSION "1.0.6"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "avg.h"
+#include "log.h"
+#include "image.h"
+#include "FaxDecoder.h"
+#include "FaxEncoder.h"
+
+#define WIDTH 1809
+
+#ifndef FAX_EXAMPLES_DIR
+#define FAX_EXAMPLES_DIR "example"
+#endif
+
+// One signal to decode. The source image is the test pattern, or a picture
+// loaded from the examples directory (these are decoded images, not signals,
+// so they are encoded first like any other picture).
+struct regress_case_t {
+    const char *name;
+    const char *source;     // NULL for the test pattern
+    int32_t sample_rate;
+    int32_t lpm;
+    double skew_ppm;
+    double noise;
+    double dc_offset;
+    double min_psnr;        // against the source image, dB
+};
+
+// Sample rates with a whole number of samples per line, the decoder slants
+// the image otherwise. The PSNR floors are a couple of dB under what the
+// current decoder achieves.
+static const regress_case_t cases[] = {
+    {"clean-12000-120",  NULL, 12000, 120,    0,    0,    0, 25},
+    {"noise-12000-120",  NULL, 12000, 120,    0, 1500,    0, 22},
+    {"dc-8000-120",      NULL,  8000, 120,    0,  500, 3000, 24},
+    {"skew-12000-120",   NULL, 12000, 120,   50,  300,    0, 25},
+    {"lpm60-22050-60",   NULL, 22050,  60,    0,  300,    0, 18},
+    {"lpm240-12000-240", NULL, 12000, 240,    0,  300,    0, 21},
+    {"noise-44100-120",  NULL, 44100, 120,    0, 1500,    0, 22},
+    {"noise-48000-120",  NULL, 48000, 120,    0, 1500,    0, 22},
+    {"example-straight", "example-straight-image.png", 12000, 120, 0, 1000, 0, 21},
+    {"example-slanted",  "example-slanted-image.png",  12000, 120, 0, 1000, 0, 21},
+};
+
+struct regress_result_t {
+    int32_t lines;
+    double psnr;            // against the source
+    double golden_psnr;     // against the golden image, negative without one
+    double msps;
+    double baseline_msps;   // zero without a baseline
+    double float_diff;      // mean gray level difference of fixed point from float, negative without
+    bool ok;
+};
+
+// The decoder is single threaded, CPU time is steadier than wall time on a busy machine
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double psnr(double mse)
+{
+    // identical images are reported as 99 dB
+    return (mse > 255.0 * 255.0 * 1e-10)? 10 * log10(255.0 * 255.0 / mse) : 99;
+}
+
+// Mean squared error of the decoded image against the reference, the decoded
+// one moved down by dy lines and circularly right by dx pixels. Negative when
+// less than half of the reference is covered.
+static double shifted_mse(const std::vector<uint8_t> &img, int32_t lines, const std::vector<uint8_t> &ref, int32_t ref_lines,
+                          int32_t dx, int32_t dy)
+{
+    int32_t first = MAX(0, dy), last = MIN(ref_lines, lines + dy);
+
+    if ((last - first) * 2 < ref_lines) {
+        return -1;
+    }
+
+    double sum = 0;
+
+    for (int32_t y = first; y < last; y++) {
+        const uint8_t *r = &ref[(size_t)y * WIDTH];
+        const uint8_t *d = &img[(size_t)(y - dy) * WIDTH];
+
+        for (int32_t x = 0; x < WIDTH; x++) {
+            int32_t e = (int32_t)d[(x - dx + WIDTH) % WIDTH] - r[x];
+            sum += e * e;
+        }
+    }
+
+    return sum / ((double)(last - first) * WIDTH);
+}
+
+// Phasing and the START/STOP detection decide where the image begins, some
+// lines or pixels either way is not a fidelity problem, so the best match wins.
+// The vertical offset (lines decoded before the image, like the end of
+// phasing) is found on the line averages first, then refined with the pixels.
+static double aligned_psnr(const std::vector<uint8_t> &img, int32_t lines, const std::vector<uint8_t> &ref, int32_t ref_lines)
+{
+    std::vector<double> img_rows(lines), ref_rows(ref_lines);
+
+    for (int32_t y = 0; y < lines; y++) {
+        img_rows[y] = std::accumulate(&img[(size_t)y * WIDTH], &img[(size_t)(y + 1) * WIDTH], 0.0) / WIDTH;
+    }
+    for (int32_t y = 0; y < ref_lines; y++) {
+        ref_rows[y] = std::accumulate(&ref[(size_t)y * WIDTH], &ref[(size_t)(y + 1) * WIDTH], 0.0) / WIDTH;
+    }
+
+    int32_t best_dx = 0, best_dy = 0;
+    double best = 1e300;
+
+    for (int32_t dy = ref_lines / 2 - lines; dy <= ref_lines / 2; dy++) {
+        int32_t first = MAX(0, dy), last = MIN(ref_lines, lines + dy);
+        double sum = 0;
+
+        for (int32_t y = first; y < last; y++) {
+            sum += (img_rows[y - dy] - ref_rows[y]) * (img_rows[y - dy] - ref_rows[y]);
+        }
+
+        if (last > first && sum / (last - first) < best) {
+            best = sum / (last - first);
+            best_dy = dy;
+        }
+    }
+
+    const int32_t coarse_dy = best_dy;
+    best = 1e300;
+
+    for (int32_t pass = 0; pass < 2; pass++) {
+        for (int32_t dy = coarse_dy - 3; dy <= coarse_dy + 3; dy++) {
+            double mse = shifted_mse(img, lines, ref, ref_lines, best_dx, dy);
+            if (mse >= 0 && mse < best) {
+                best = mse;
+                best_dy = dy;
+            }
+        }
+
+        for (int32_t dx = -40; dx <= 40; dx++) {
+            double mse = shifted_mse(img, lines, ref, ref_lines, dx, best_dy);
+            if (mse >= 0 && mse < best) {
+                best = mse;
+                best_dx = dx;
+            }
+        }
+    }
+
+    return (best < 1e300)? psnr(best) : 0;
+}
+
+static double golden_psnr(const std::vector<uint8_t> &img, int32_t lines, const char *file_name)
+{
+    std::vector<uint8_t> golden;
+    int32_t width, height;
+
+    if (!image_load_pgm(file_name, golden, &width, &height) || width != WIDTH || height != lines) {
+        return 0;
+    }
+
+    double sum = 0;
+
+    for (size_t i = 0; i < golden.size(); i++) {
+        int32_t e = (int32_t)img[i] - golden[i];
+        sum += e * e;
+    }
+
+    return psnr(golden.size()? sum / golden.size() : 0);
+}
+
+// Mean absolute difference of two decodes of the same signal. START/STOP
+// may be told a line apart, so the lines are matched with the best of a few
+// offsets. Negative when the line counts differ by more.
+static double gray_diff(const std::vector<uint8_t> &img, int32_t lines, const char *file_name)
+{
+    std::vector<uint8_t> other;
+    int32_t width, height;
+
+    if (!image_load_pgm(file_name, other, &width, &height) || width != WIDTH || abs(height - lines) > 2) {
+        return -1;
+    }
+
+    double best = -1;
+
+    for (int32_t dy = -2; dy <= 2; dy++) {
+        int32_t first = MAX(0, dy), last = MIN(height, lines + dy);
+        double sum = 0;
+
+        for (int32_t y = first; y < last; y++) {
+            for (int32_t x = 0; x < WIDTH; x++) {
+                sum += abs((int32_t)img[(size_t)(y - dy) * WIDTH + x] - other[(size_t)y * WIDTH + x]);
+            }
+        }
+
+        if (last > first && (best < 0 || sum / ((double)(last - first) * WIDTH) < best)) {
+            best = sum / ((double)(last - first) * WIDTH);
+        }
+    }
+
+    return best;
+}
+
+// Same read, DC removal and one second chunks as the fax utility
+static double decode(const std::vector<int16_t> &signal, const regress_case_t &c, const char *pgm_name, bool fixed_point)
+{
+    std::vector<int16_t> readbuf(signal.size());
+    const size_t read_buf_size = (1048576 / sizeof(int16_t) / c.sample_rate) * c.sample_rate;
+    FaxDecoder faxdec;
+
+    faxdec.Configure(c.lpm, WIDTH, 8, 1900, 400, FaxDecoder::firfilter::MIDDLE, 15.0,
+                     false, true, false, false, false, c.sample_rate, 1.0 + c.skew_ppm / 1000000.0, 0);
+    faxdec.SetFixedPoint(fixed_point);
+    faxdec.FileOpen(pgm_name);
+
+    double start = now();
+
+    for (size_t pos = 0; pos < signal.size(); pos += read_buf_size) {
+        size_t nread = MIN(read_buf_size, signal.size() - pos);
+        int16_t *buf = &readbuf[pos];
+
+        memcpy(buf, &signal[pos], nread * sizeof(int16_t));
+        float avg = FLOAT_AVERAGE(buf, nread);
+        SAMPLES_SUBTRACT(buf, nread, avg);
+
+        for (size_t i = 0; i < nread; i += c.sample_rate) {
+            faxdec.ProcessSamples(&buf[i], MIN(nread - i, (size_t)c.sample_rate), 0);
+        }
+    }
+
+    double elapsed = now() - start;
+
+    faxdec.FileClose();
+
+    return elapsed;
+}
+
+static void decode_into(FaxDecoder &faxdec, const std::vector<int16_t> &signal, int32_t sample_rate, const char *pgm_name)
+{
+    faxdec.FileOpen(pgm_name);
+
+    for (size_t i = 0; i < signal.size(); i += sample_rate) {
+        faxdec.ProcessSamples(&signal[i], MIN(signal.size() - i, (size_t)sample_rate), 0);
+    }
+
+    faxdec.FileClose();
+}
+
+static std::vector<uint8_t> read_file(const char *file_name)
+{
+    std::vector<uint8_t> data;
+    FILE *f = fopen(file_name, "rb");
+    int c;
+
+    while (f != NULL && (c = fgetc(f)) != EOF) {
+        data.push_back(c);
+    }
+
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    return data;
+}
+
+// A decoder reset after AFC followed a drifted carrier must decode the next
+// input like a new one, from the configured carrier
+static bool check_reset_afc(const char *pgm_name, const char *other_name)
+{
+    const int32_t rate = 12000, lpm = 120, height = 100;
+    std::vector<uint8_t> source((size_t)WIDTH * height);
+    std::vector<int16_t> drifted, signal;
+    FaxEncoder faxenc;
+
+    FaxEncoder::TestPattern(source.data(), WIDTH, height);
+    faxenc.Configure(lpm, rate, 1900 + 150, 400, 0, 16384, 300, 0, 1);
+    faxenc.Gap(2, drifted);
+    faxenc.Transmission(source.data(), WIDTH, height, drifted);
+    faxenc.Configure(lpm, rate, 1900, 400, 0, 16384, 300, 0, 2);
+    faxenc.Gap(2, signal);
+    faxenc.Transmission(source.data(), WIDTH, height, signal);
+
+    FaxDecoder reused, fresh;
+
+    reused.Configure(lpm, WIDTH, 8, 1900, 400, FaxDecoder::firfilter::MIDDLE, 15.0,
+                     false, true, false, false, false, rate, 1.0, 0);
+    reused.SetAfc(true);
+    decode_into(reused, drifted, rate, other_name);
+    double drift = reused.AfcOffset();
+    reused.Reset();
+    decode_into(reused, signal, rate, other_name);
+
+    fresh.Configure(lpm, WIDTH, 8, 1900, 400, FaxDecoder::firfilter::MIDDLE, 15.0,
+                    false, true, false, false, false, rate, 1.0, 0);
+    fresh.SetAfc(true);
+    decode_into(fresh, signal, rate, pgm_name);
+
+    std::vector<uint8_t> a = read_file(pgm_name), b = read_file(other_name);
+    bool same = !a.empty() && a == b;
+    // the first input has to move the carrier, or there is nothing to reset
+    bool ok = fabs(drift) > 50 && same;
+
+    fprintf(stdout, "%-18s AFC moved %+.0f Hz, after Reset() %s a new decoder  %s\n", "reset-afc", drift,
+        same? "same as" : "differs from", ok? "ok" : "FAIL");
+    return ok;
+}
+
+static bool load_baseline(const char *file_name, std::vector<std::pair<std::string, double>> &baseline)
+{
+    FILE *f = fopen(file_name, "r");
+    char name[128];
+    double msps;
+
+    if (f == NULL) {
+        return false;
+    }
+
+    while (fscanf(f, "%127s %lf", name, &msps) == 2) {
+        baseline.emplace_back(name, msps);
+    }
+
+    fclose(f);
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stdout,
+        "Usage: fax_regress [options]\n"
+        "  -x, --examples <dir>       directory with the example PNGs\n"
+        "                             (default: " FAX_EXAMPLES_DIR ")\n"
+        "  -g, --golden <dir>         compare the decoded images with <dir>/<case>.pgm\n"
+        "  -u, --update               write the decoded images to the golden directory instead\n"
+        "  -b, --baseline <file>      fail when a case decodes slower than the recorded throughput\n"
+        "  -B, --save_baseline <file> record the measured throughput\n"
+        "  -T, --threshold <percent>  allowed slowdown of the whole run against the baseline,\n"
+        "                             twice as much for a single case (default: 10)\n"
+        "  -r, --repeat <n>           decode each case n times, the fastest run counts (default: 3)\n"
+        "  -H, --height <lines>       test pattern height (default: 300)\n"
+        "  -c, --case <name>          run only the cases containing <name>\n"
+        "  -Q, --fixed_point          decode in fixed point, and fail when the images differ from\n"
+        "                             the float ones by more than 2 gray levels on average\n");
+}
+
+int main(int argc, char *const * argv)
+{
+    fprintf(stdout, "Radio Fax regression v" VERSION "\n");
+
+    // the decoder messages would bury the results
+    fax_log_set_level(FAX_LOG_WARN);
+
+    const char *examples_dir = FAX_EXAMPLES_DIR;
+    const char *golden_dir = NULL;
+    const char *baseline_name = NULL;
+    const char *save_baseline_name = NULL;
+    const char *only = NULL;
+    bool update = false;
+    bool fixed_point = false;
+    double threshold {10};
+    int32_t repeat {3};
+    int32_t pattern_height {300};
+
+    static struct option long_options[] =
+    {
+        {"examples",      required_argument, 0, 'x'},
+        {"golden",        required_argument, 0, 'g'},
+        {"update",        no_argument,       0, 'u'},
+        {"baseline",      required_argument, 0, 'b'},
+        {"save_baseline", required_argument, 0, 'B'},
+        {"threshold",     required_argument, 0, 'T'},
+        {"repeat",        required_argument, 0, 'r'},
+        {"height",        required_argument, 0, 'H'},
+        {"case",          required_argument, 0, 'c'},
+        {"fixed_point",   no_argument,       0, 'Q'},
+        {"help",          no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt_idx = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "x:g:ub:B:T:r:H:c:Qh", long_options, &opt_idx)) >= 0) {
+        switch(c) {
+            case 'x': examples_dir = optarg; break;
+            case 'g': golden_dir = optarg; break;
+            case 'u': update = true; break;
+            case 'b': baseline_name = optarg; break;
+            case 'B': save_baseline_name = optarg; break;
+            case 'T': threshold = atof(optarg); break;
+            case 'r': repeat = MAX(1, atoi(optarg)); break;
+            case 'H': pattern_height = atoi(optarg); break;
+            case 'c': only = optarg; break;
+            case 'Q': fixed_point = true; break;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    if (update && golden_dir == NULL) {
+        fprintf(stdout, "--update needs the golden directory: -g <dir>\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::pair<std::string, double>> baseline;
+
+    if (baseline_name != NULL && !load_baseline(baseline_name, baseline)) {
+        fprintf(stdout, "Can't read baseline %s\n", baseline_name);
+        return EXIT_FAILURE;
+    }
+
+    char pgm_name[] = "/tmp/fax_regress_XXXXXX";
+    int fd = mkstemp(pgm_name);
+    close(fd);
+
+    char float_name[] = "/tmp/fax_regress_XXXXXX";
+    if (fixed_point) {
+        fd = mkstemp(float_name);
+        close(fd);
+    }
+
+    std::vector<std::pair<std::string, double>> measured;
+    int32_t failed = 0, skipped = 0;
+    // whole run, and what it took with the baseline throughput
+    double total_samples = 0, total_seconds = 0, expected_seconds = 0;
+
+    fprintf(stdout, "%-18s %6s %8s %8s %9s %9s", "case", "lines", "PSNR", "golden", "Msps", "baseline");
+    fprintf(stdout, fixed_point? " %6s\n" : "\n", "float");
+
+    for (const regress_case_t &rc : cases) {
+        if (only != NULL && strstr(rc.name, only) == NULL) {
+            continue;
+        }
+
+        // source picture and its reference at the decoder width
+        std::vector<uint8_t> source, ref;
+        int32_t width = WIDTH, height = pattern_height;
+
+        if (rc.source != NULL) {
+            std::string path = std::string(examples_dir) + "/" + rc.source;
+
+            if (!image_load(path.c_str(), source, &width, &height)) {
+                fprintf(stdout, "%-18s skipped, can't load %s\n", rc.name, path.c_str());
+                skipped++;
+                continue;
+            }
+        } else {
+            source.resize((size_t)width * height);
+            FaxEncoder::TestPattern(source.data(), width, height);
+        }
+
+        ref.resize((size_t)WIDTH * height);
+
+        for (int32_t y = 0; y < height; y++) {
+            for (int32_t x = 0; x < WIDTH; x++) {
+                ref[(size_t)y * WIDTH + x] = source[(size_t)y * width + (int64_t)x * width / WIDTH];
+            }
+        }
+
+        FaxEncoder faxenc;
+        std::vector<int16_t> signal;
+
+        faxenc.Configure(rc.lpm, rc.sample_rate, 1900, 400, rc.skew_ppm, 16384, rc.noise, rc.dc_offset, 1);
+        faxenc.Gap(2, signal);
+        faxenc.Transmission(source.data(), width, height, signal);
+        faxenc.Gap(2, signal);
+
+        double best = 1e300;
+
+        for (int32_t n = 0; n < repeat; n++) {
+            best = MIN(best, decode(signal, rc, pgm_name, fixed_point));
+        }
+
+        if (fixed_point) {
+            decode(signal, rc, float_name, false);
+        }
+
+        regress_result_t r;
+        std::vector<uint8_t> img;
+        int32_t img_width = 0;
+
+        if (!image_load_pgm(pgm_name, img, &img_width, &r.lines) || img_width != WIDTH) {
+            r.lines = 0;
+        }
+
+        r.psnr = (r.lines > 0)? aligned_psnr(img, r.lines, ref, height) : 0;
+        r.msps = signal.size() / best / 1e6;
+        r.ok = r.psnr >= rc.min_psnr;
+        r.golden_psnr = -1;
+        r.baseline_msps = 0;
+        r.float_diff = -1;
+
+        if (fixed_point) {
+            r.float_diff = (r.lines > 0)? gray_diff(img, r.lines, float_name) : -1;
+            r.ok = r.ok && r.float_diff >= 0 && r.float_diff <= 2;
+        }
+
+        if (golden_dir != NULL) {
+            std::string golden = std::string(golden_dir) + "/" + rc.name + ".pgm";
+
+            if (update) {
+                if (!image_save_pgm(golden.c_str(), img.data(), WIDTH, r.lines)) {
+                    fprintf(stdout, "Can't write %s\n", golden.c_str());
+                    r.ok = false;
+                }
+            } else {
+                r.golden_psnr = golden_psnr(img, r.lines, golden.c_str());
+                r.ok = r.ok && r.golden_psnr >= 45;
+            }
+        }
+
+        // single runs are noisy, the case limit is twice the one of the whole run
+        for (const auto &b : baseline) {
+            if (b.first == rc.name) {
+                r.baseline_msps = b.second;
+                r.ok = r.ok && r.msps >= b.second * (1 - 2 * threshold / 100);
+                expected_seconds += signal.size() / b.second / 1e6;
+            }
+        }
+
+        total_samples += signal.size();
+        total_seconds += best;
+
+        measured.emplace_back(rc.name, r.msps);
+        failed += !r.ok;
+
+        fprintf(stdout, "%-18s %6d %8.2f", rc.name, r.lines, r.psnr);
+        if (r.golden_psnr >= 0) {
+            fprintf(stdout, " %8.2f", r.golden_psnr);
+        } else {
+            fprintf(stdout, " %8s", "-");
+        }
+        fprintf(stdout, " %9.2f", r.msps);
+        if (r.baseline_msps > 0) {
+            fprintf(stdout, " %+8.1f%%", (r.msps / r.baseline_msps - 1) * 100);
+        } else {
+            fprintf(stdout, " %9s", "-");
+        }
+        if (fixed_point) {
+            fprintf(stdout, " %6.2f", r.float_diff);
+        }
+        fprintf(stdout, "  %s\n", r.ok? "ok" : "FAIL");
+    }
+
+    if (only == NULL || strstr("reset-afc", only) != NULL) {
+        char other_name[] = "/tmp/fax_regress_XXXXXX";
+        fd = mkstemp(other_name);
+        close(fd);
+
+        failed += !check_reset_afc(pgm_name, other_name);
+        unlink(other_name);
+    }
+
+    unlink(pgm_name);
+    if (fixed_point) {
+        unlink(float_name);
+    }
+
+    if (save_baseline_name != NULL) {
+        FILE *f = fopen(save_baseline_name, "w");
+
+        if (f == NULL) {
+            fprintf(stdout, "Can't write %s\n", save_baseline_name);
+            return EXIT_FAILURE;
+        }
+
+        for (const auto &m : measured) {
+            fprintf(f, "%s %.3f\n", m.first.c_str(), m.second);
+        }
+        fclose(f);
+    }
+
+    if (total_seconds > 0) {
+        fprintf(stdout, "Total %.2f Msps", total_samples / total_seconds / 1e6);
+
+        if (expected_seconds > 0) {
+            double change = expected_seconds / total_seconds - 1;
+            bool ok = change >= -threshold / 100;
+
+            fprintf(stdout, ", %+.1f%% against the baseline  %s", change * 100, ok? "ok" : "FAIL");
+            failed += !ok;
+        }
+        fprintf(stdout, "\n");
+    }
+
+    fprintf(stdout, "%zu cases, %d failed, %d skipped\n", measured.size(), failed, skipped);
+
+    return failed? EXIT_FAILURE : EXIT_SUCCESS;
+}
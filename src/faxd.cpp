@@ -0,0 +1,618 @@
+/*********************************************************************************
+ *
+ * Project:  FAX Decoder
+ * Purpose:  daemon decoding the WAV files dropped into spool directories
+ * Author:   Darau, Blė
+ *
+ **********************************************************************************
+ *   Copyright (C) 2023 by Darau, Blė                                             *
+ *                                                                                *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ * of this software and associated documentation files (the "Software"), to deal  *
+ * in the Software without restriction, including without limitation the rights   *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ * copies of the Software, and to permit persons to whom the Software is          *
+ * furnished to do so, subject to the following conditions:                       *
+ *                                                                                *
+ * The above copyright notice and this permission notice shall be included in all *
+ * copies or substantial portions of the Software.                                *
+ *                                                                                *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ * SOFTWARE.                                                                      *
+ *                                                                                *
+ **********************************************************************************
+ */
+#define VERSION "1.0.6"
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "avg.h"
+#include "log.h"
+#include "mem.h"
+#include "stats.h"
+#include "wav.h"
+#include "FaxDecoder.h"
+
+/*
+    Watches spool directories for finished WAV files (closed after writing or
+    moved in) and decodes them on a pool of workers. Every worker keeps one
+    decoder for its whole life, so after the first jobs nothing is allocated.
+    The image is written under a temporary name and renamed when complete.
+*/
+
+struct decode_options_t {
+    double center_freq {1900};
+    double deviation {400};
+    int32_t lpm {120};
+    double srcorr {1.0};
+    int32_t pixels_width {1809};
+    int32_t align_lines {0};
+    int no_header {0};
+    int no_phasing {0};
+    int remove_dc {0};
+    int carrier_gate {0};
+    int afc {0};
+    int fixed_point {0};
+    int auto_lpm {0};
+};
+
+struct job_t {
+    std::string wav;
+    std::string out_dir;
+};
+
+// Bounded FIFO of files to decode, the watcher waits when it is full. A file
+// is known from Push() until its worker calls Done(), events for it are dropped
+class JobQueue
+{
+public:
+    JobQueue(size_t limit):
+        m_limit {limit},
+        m_closed {false}
+    {
+    }
+
+    // false when the queue was closed or the file is already waiting or decoding
+    bool Push(const job_t &job)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        if (m_pending.count(job.wav)) {
+            return false;
+        }
+
+        m_notFull.wait(lock, [&]() { return m_jobs.size() < m_limit || m_closed; });
+
+        if (m_closed) {
+            return false;
+        }
+
+        m_jobs.push_back(job);
+        m_pending.insert(job.wav);
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    // false once closed and drained
+    bool Pop(job_t *job)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_notEmpty.wait(lock, [&]() { return !m_jobs.empty() || m_closed; });
+
+        if (m_jobs.empty()) {
+            return false;
+        }
+
+        *job = m_jobs.front();
+        m_jobs.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    // the file from Pop() is decoded, later events for it are new files
+    void Done(const job_t &job)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_pending.erase(job.wav);
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+    size_t Depth()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_jobs.size();
+    }
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_notEmpty, m_notFull;
+    std::deque<job_t> m_jobs;
+    std::set<std::string> m_pending;        // queued or decoding
+    size_t m_limit;
+    bool m_closed;
+};
+
+static struct {
+    std::atomic<int32_t> busy;
+    std::atomic<uint64_t> files_done, files_failed;
+    std::atomic<uint64_t> samples;          // decoded
+    std::atomic<uint64_t> audio_ms;         // decoded recording length
+    std::atomic<uint64_t> decode_ns;        // wall time in the workers
+} counters;
+
+static int stop_pipe[2] = {-1, -1};
+static volatile sig_atomic_t report_requested = 0;
+
+static void request_stop(int)
+{
+    char c = 's';
+    (void) !write(stop_pipe[1], &c, 1);
+}
+
+static void request_report(int)
+{
+    report_requested = 1;
+    char c = 'r';
+    (void) !write(stop_pipe[1], &c, 1);
+}
+
+static bool is_wav(const char *name)
+{
+    size_t len = strlen(name);
+    return name[0] != '.' && len > 4 && strcasecmp(name + len - 4, ".wav") == 0;
+}
+
+static bool decode_file(FaxDecoder &faxdec, double *rate, const decode_options_t &opt, const job_t &job)
+{
+    FILE *fd = fopen(job.wav.c_str(), "r");
+
+    if (fd == NULL) {
+        FAX_ERROR("open(%s) failed: %s\n", job.wav.c_str(), strerror(errno));
+        return false;
+    }
+
+    wav_header_t hdr;
+
+    if (fread(&hdr, sizeof(wav_header_t), 1, fd) != 1 || memcmp(hdr.signature, "RIFF", 4) != 0 ||
+        hdr.channels != 1 || hdr.bit_depth != 16 || hdr.sample_rate == 0) {
+        FAX_ERROR("%s: not a 16 bit mono WAV file\n", job.wav.c_str());
+        fclose(fd);
+        return false;
+    }
+
+    // the same sample rate as the last job only needs a reset, buffers stay as they are
+    if (hdr.sample_rate == *rate) {
+        faxdec.Reset();
+    } else {
+        faxdec.Configure(opt.lpm, opt.pixels_width, 8, opt.center_freq, opt.deviation,
+            FaxDecoder::firfilter::MIDDLE, 15.0, !opt.no_header, !opt.no_phasing, false, false, false,
+            hdr.sample_rate, opt.srcorr, 0);
+        faxdec.SetAutoAlign(opt.align_lines);
+        faxdec.SetCarrierGate(opt.carrier_gate);
+        faxdec.SetAfc(opt.afc);
+        faxdec.SetFixedPoint(opt.fixed_point);
+        faxdec.SetAutoLpm(opt.auto_lpm);
+        *rate = hdr.sample_rate;
+    }
+
+    std::filesystem::path stem = std::filesystem::path(job.wav).stem();
+    std::filesystem::path out = std::filesystem::path(job.out_dir) / stem;
+    out += ".pgm";
+    std::filesystem::path tmp = std::filesystem::path(job.out_dir) / ("." + stem.string() + ".pgm.tmp");
+
+    faxdec.FileOpen(tmp.c_str());
+
+    if (faxdec.LineSink() == NULL) {
+        fclose(fd);
+        return false;
+    }
+
+    std::vector<int16_t> buf(hdr.sample_rate);
+    uint64_t total = 0;
+    size_t nread;
+
+    while ((nread = fread(buf.data(), sizeof(int16_t), buf.size(), fd)) > 0) {
+        if (opt.remove_dc) {
+            float avg = FLOAT_AVERAGE(buf.data(), nread);
+            SAMPLES_SUBTRACT(buf.data(), nread, avg);
+        }
+
+        total += nread;
+
+        if (!faxdec.ProcessSamples(buf.data(), nread, 0)) {
+            break;
+        }
+    }
+
+    bool ok = !ferror(fd);
+    fclose(fd);
+    faxdec.FileClose();
+    faxdec.SetLineSink(NULL);
+
+    if (ok && rename(tmp.c_str(), out.c_str()) != 0) {
+        FAX_ERROR("rename(%s) failed: %s\n", out.c_str(), strerror(errno));
+        ok = false;
+    }
+
+    if (!ok) {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    counters.samples += total;
+    counters.audio_ms += total * 1000 / hdr.sample_rate;
+    FAX_INFO("%s -> %s, %.0f sec\n", job.wav.c_str(), out.c_str(), (double) total / hdr.sample_rate);
+    return true;
+}
+
+static void worker(int32_t id, JobQueue *queue, const decode_options_t *opt)
+{
+    char tag[16];
+    snprintf(tag, sizeof tag, "w%d", id);
+    fax_log_set_thread_tag(tag);
+
+    FaxDecoder faxdec;
+    double rate = 0;
+    job_t job;
+
+    while (queue->Pop(&job)) {
+        counters.busy++;
+        uint64_t start = fax_clock_ns(CLOCK_MONOTONIC);
+
+        if (decode_file(faxdec, &rate, *opt, job)) {
+            counters.files_done++;
+        } else {
+            counters.files_failed++;
+        }
+
+        counters.decode_ns += fax_clock_ns(CLOCK_MONOTONIC) - start;
+        counters.busy--;
+        queue->Done(job);
+    }
+}
+
+// Queue depth and throughput since the last report, also as JSON for monitoring
+static void report(JobQueue &queue, int32_t jobs, const char *status_name, uint64_t start_ns)
+{
+    static uint64_t last_ns, last_samples, last_audio_ms;
+
+    uint64_t now = fax_clock_ns(CLOCK_MONOTONIC);
+    uint64_t samples = counters.samples, audio_ms = counters.audio_ms;
+    double interval = (now - (last_ns? last_ns : start_ns)) / 1e9;
+    double msps = (samples - last_samples) / interval / 1e6;
+    double realtime = (audio_ms - last_audio_ms) / 1000.0 / interval;
+    size_t depth = queue.Depth();
+    // an idle daemon stays quiet
+    bool idle = samples == last_samples && depth == 0 && counters.busy == 0;
+
+    last_ns = now;
+    last_samples = samples;
+    last_audio_ms = audio_ms;
+
+    FAX_LOG(idle? FAX_LOG_DEBUG : FAX_LOG_INFO, "queue %zu, busy %d/%d, done %" PRIu64 ", failed %" PRIu64 ", %.2f Msps, %.0fx real time\n",
+        depth, counters.busy.load(), jobs, counters.files_done.load(), counters.files_failed.load(), msps, realtime);
+
+    if (status_name == NULL) {
+        return;
+    }
+
+    fax_mem_stats_t mem;
+    fax_mem_get_stats(&mem);
+
+    std::string tmp = std::string(status_name) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+
+    if (f == NULL) {
+        FAX_ERROR("open(%s) failed: %s\n", tmp.c_str(), strerror(errno));
+        return;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"uptime_sec\": %.1f,\n", (now - start_ns) / 1e9);
+    fprintf(f, "  \"queue_depth\": %zu,\n", depth);
+    fprintf(f, "  \"workers\": %d,\n", jobs);
+    fprintf(f, "  \"busy\": %d,\n", counters.busy.load());
+    fprintf(f, "  \"files_done\": %" PRIu64 ",\n", counters.files_done.load());
+    fprintf(f, "  \"files_failed\": %" PRIu64 ",\n", counters.files_failed.load());
+    fprintf(f, "  \"samples\": %" PRIu64 ",\n", samples);
+    fprintf(f, "  \"audio_sec\": %.1f,\n", audio_ms / 1000.0);
+    fprintf(f, "  \"decode_sec\": %.3f,\n", counters.decode_ns / 1e9);
+    fprintf(f, "  \"msps\": %.3f,\n", msps);
+    fprintf(f, "  \"realtime_factor\": %.1f,\n", realtime);
+    fprintf(f, "  \"mem_system_allocs\": %zu,\n", mem.system_allocs);
+    fprintf(f, "  \"mem_bytes\": %zu,\n", mem.bytes_in_use + mem.bytes_cached);
+    fprintf(f, "  \"peak_rss_kb\": %" PRId64 "\n", fax_peak_rss_kb());
+    fprintf(f, "}\n");
+    fclose(f);
+
+    if (rename(tmp.c_str(), status_name) != 0) {
+        FAX_ERROR("rename(%s) failed: %s\n", status_name, strerror(errno));
+    }
+}
+
+int main(int argc, char *const * argv)
+{
+    decode_options_t opt;
+    std::vector<std::string> watch_dirs;
+    const char *out_dir = NULL;
+    const char *status_name = NULL;
+    int32_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    int32_t queue_limit {64};
+    double report_sec {60};
+    int existing {0};
+    double settle_sec {5};
+    int huge_pages {0};
+    int log_level {FAX_LOG_INFO};
+
+    static struct option long_options[] =
+    {
+        {"no_header",   no_argument,  &opt.no_header, 1},
+        {"remove_dc",   no_argument,  &opt.remove_dc, 1},
+        {"gate",        no_argument,  &opt.carrier_gate, 1},
+        {"afc",         no_argument,  &opt.afc, 1},
+        {"fixed_point", no_argument,  &opt.fixed_point, 1},
+        {"auto_lpm",    no_argument,  &opt.auto_lpm, 1},
+        {"existing",    no_argument,  &existing, 1},
+        {"huge_pages",  no_argument,  &huge_pages, 1},
+        {"watch",       required_argument, 0, 'W'},
+        {"output",      required_argument, 0, 'o'},
+        {"jobs",        required_argument, 0, 'j'},
+        {"queue",       required_argument, 0, 'Q'},
+        {"report",      required_argument, 0, 'R'},
+        {"settle",      required_argument, 0, 'S'},
+        {"status",      required_argument, 0, 'T'},
+        {"center_freq", required_argument, 0, 'f'},
+        {"deviation",   required_argument, 0, 'D'},
+        {"lpm",         required_argument, 0, 'l'},
+        {"srcorr",      required_argument, 0, 's'},
+        {"pixels",      required_argument, 0, 'p'},
+        {"no_phasing",  no_argument,       0, 'n'},
+        {"auto_align",  required_argument, 0, 'a'},
+        {"quiet",       no_argument,       0, 'q'},
+        {"verbose",     no_argument,       0, 'v'},
+        {0, 0, 0, 0}
+    };
+
+    int opt_idx = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "W:o:j:Q:R:S:f:D:l:s:p:na:qv", long_options, &opt_idx)) >= 0) {
+        switch (c) {
+            case 'W': watch_dirs.push_back(optarg); break;
+            case 'o': out_dir = optarg; break;
+            case 'j': jobs = std::max(1, atoi(optarg)); break;
+            case 'Q': queue_limit = std::max(1, atoi(optarg)); break;
+            case 'R': report_sec = atof(optarg); break;
+            case 'S': settle_sec = atof(optarg); break;
+            case 'T': status_name = optarg; break;
+            case 'f': opt.center_freq = atof(optarg); break;
+            case 'D': opt.deviation = atof(optarg); break;
+            case 'l': opt.lpm = atoi(optarg); break;
+            case 's': opt.srcorr = atof(optarg) / 1000000 + 1; break;
+            case 'p': opt.pixels_width = atoi(optarg); break;
+            case 'n': opt.no_phasing = 1; break;
+            case 'a': opt.align_lines = atoi(optarg); break;
+            case 'q': log_level = FAX_LOG_WARN; break;
+            case 'v': log_level = std::max(log_level, FAX_LOG_INFO) + 1; break;
+        }
+    }
+
+    fax_log_set_level(log_level);
+    FAX_INFO("Radio Fax decoder daemon v" VERSION "\n");
+
+    if (watch_dirs.empty()) {
+        FAX_ERROR("Directory to watch is required: -W <dir>\n");
+        exit(-1);
+    }
+
+    if (huge_pages) {
+        fax_mem_huge_pages(true);
+    }
+
+    int ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+
+    if (ifd < 0 || pipe(stop_pipe) != 0) {
+        FAX_ERROR("inotify_init1 failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // watch descriptor -> directory
+    std::vector<std::pair<int, std::string>> watches;
+
+    for (auto &dir : watch_dirs) {
+        // files written in place are complete on close, others are moved in
+        int wd = inotify_add_watch(ifd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+
+        if (wd < 0) {
+            FAX_ERROR("inotify_add_watch(%s) failed: %s\n", dir.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        watches.push_back({wd, dir});
+        FAX_INFO("Watching %s\n", dir.c_str());
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = request_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = request_report;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    JobQueue queue(queue_limit);
+    std::vector<std::thread> workers;
+
+    for (int32_t i = 0; i < jobs; i++) {
+        workers.emplace_back(worker, i, &queue, &opt);
+    }
+
+    auto enqueue = [&](const std::string &dir, const char *name) {
+        if (!is_wav(name)) {
+            return;
+        }
+
+        job_t job {(std::filesystem::path(dir) / name).string(), out_dir? out_dir : dir};
+
+        if (queue.Push(job)) {
+            FAX_DEBUG("queued %s, depth %zu\n", job.wav.c_str(), queue.Depth());
+        }
+    };
+
+    // Files found by --existing that were written to in the last settle_sec, as
+    // (dir, name). They may still be recorded, or may have been closed before the
+    // watch was added, so they are queued on their close event or once they have
+    // not changed for settle_sec, whichever comes first
+    std::set<std::pair<std::string, std::string>> deferred;
+    const auto settle = std::chrono::duration_cast<std::filesystem::file_time_type::duration>(
+        std::chrono::duration<double>(settle_sec));
+
+    auto check_deferred = [&]() {
+        for (auto it = deferred.begin(); it != deferred.end(); ) {
+            std::error_code ec;
+            auto mtime = std::filesystem::last_write_time(std::filesystem::path(it->first) / it->second, ec);
+
+            if (ec) {
+                // removed or moved away meanwhile
+                it = deferred.erase(it);
+            } else if (mtime <= std::filesystem::file_time_type::clock::now() - settle) {
+                enqueue(it->first, it->second.c_str());
+                it = deferred.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    };
+
+    // after the watches are in place, so nothing falls in between
+    if (existing) {
+        for (auto &dir : watch_dirs) {
+            std::error_code ec;
+
+            for (auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+                if (entry.is_regular_file() && is_wav(entry.path().filename().c_str())) {
+                    deferred.insert({dir, entry.path().filename().string()});
+                }
+            }
+        }
+
+        check_deferred();
+
+        for (auto &d : deferred) {
+            FAX_DEBUG("%s/%s was written to recently, waiting for it to settle\n", d.first.c_str(), d.second.c_str());
+        }
+    }
+
+    const uint64_t start_ns = fax_clock_ns(CLOCK_MONOTONIC);
+    uint64_t next_report = start_ns + report_sec * 1e9;
+    alignas(struct inotify_event) char events[16384];
+    bool running = true;
+
+    while (running) {
+        struct pollfd pfd[2] = {{ifd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+        int timeout = -1;
+
+        if (report_sec > 0) {
+            int64_t left = (int64_t)(next_report - fax_clock_ns(CLOCK_MONOTONIC));
+            timeout = std::max((int64_t) 0, left / 1000000);
+        }
+
+        if (!deferred.empty()) {
+            timeout = (timeout < 0)? 1000 : std::min(timeout, 1000);
+        }
+
+        if (poll(pfd, 2, timeout) < 0 && errno != EINTR) {
+            FAX_ERROR("poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        if (pfd[1].revents & POLLIN) {
+            char cmd[16];
+            ssize_t n = read(stop_pipe[0], cmd, sizeof cmd);
+
+            for (ssize_t i = 0; i < n; i++) {
+                if (cmd[i] == 's') {
+                    running = false;
+                }
+            }
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            ssize_t len;
+
+            while ((len = read(ifd, events, sizeof events)) > 0) {
+                for (char *p = events; p < events + len; ) {
+                    struct inotify_event *ev = (struct inotify_event *) p;
+                    p += sizeof(struct inotify_event) + ev->len;
+
+                    if (ev->mask & IN_Q_OVERFLOW) {
+                        FAX_WARN("inotify queue overflow, events lost, restart with --existing to catch up\n");
+                        continue;
+                    }
+
+                    for (auto &w : watches) {
+                        if (w.first == ev->wd && ev->len > 0) {
+                            deferred.erase({w.second, ev->name});
+                            enqueue(w.second, ev->name);
+                        }
+                    }
+                }
+            }
+        }
+
+        if (!deferred.empty()) {
+            check_deferred();
+        }
+
+        if (report_requested || (report_sec > 0 && fax_clock_ns(CLOCK_MONOTONIC) >= next_report)) {
+            report_requested = 0;
+            report(queue, jobs, status_name, start_ns);
+            next_report = fax_clock_ns(CLOCK_MONOTONIC) + report_sec * 1e9;
+        }
+    }
+
+    FAX_INFO("Stopping, finishing %zu queued files\n", queue.Depth());
+    queue.Close();
+
+    for (auto &t : workers) {
+        t.join();
+    }
+
+    report(queue, jobs, status_name, start_ns);
+    close(ifd);
+    return 0;
+}
@@ -0,0 +1,205 @@
+/*********************************************************************************
+ *
+ * Project:  FAX Decoder
+ * Purpose:  command line utility to generate synthetic weather fax wav files
+ * Author:   Darau, Blė
+ *
+ **********************************************************************************
+ *   Copyright (C) 2023 by Darau, Blė                                             *
+ *                                                                                *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy   *
+ * of this software and associated documentation files (the "Software"), to deal  *
+ * in the Software without restriction, including without limitation the rights   *
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      *
+ * copies of the Software, and to permit persons to whom the Software is          *
+ * furnished to do so, subject to the following conditions:                       *
+ *                                                                                *
+ * The above copyright notice and this permission notice shall be included in all *
+ * copies or substantial portions of the Software.                                *
+ *                                                                                *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         *
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  *
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  *
+ * SOFTWARE.                                                                      *
+ *                                                                                *
+ **********************************************************************************
+ */
+#define VERSION "1.0.6"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "FaxEncoder.h"
+#include "image.h"
+#include "wav.h"
+
+int main(int argc, char *const * argv)
+{
+    fprintf(stdout, "Radio Fax generator v" VERSION "\n");
+
+    char *file_name = NULL;
+    char *image_name = NULL;
+    double sample_rate {12000};
+    double center_freq {1900};
+    double deviation {400};
+    int32_t lpm {120};
+    double skew {0};
+    double amplitude {16384};
+    double noise {0};
+    double dc_offset {0};
+    uint64_t seed {1};
+    int32_t count {1};
+    double gap {5};
+    double minutes {0};
+    int32_t pixels_width {1809};
+    int32_t pattern_height {800};
+    int iq {0};
+
+    static struct option long_options[] =
+    {
+        {"wav_file",    required_argument, 0, 'w'},
+        {"image",       required_argument, 0, 'i'},
+        {"sample_rate", required_argument, 0, 'R'},
+        {"center_freq", required_argument, 0, 'f'},
+        {"deviation",   required_argument, 0, 'D'},
+        {"lpm",         required_argument, 0, 'l'},
+        {"skew",        required_argument, 0, 's'},
+        {"amplitude",   required_argument, 0, 'A'},
+        {"noise",       required_argument, 0, 'n'},
+        {"dc_offset",   required_argument, 0, 'o'},
+        {"seed",        required_argument, 0, 'S'},
+        {"count",       required_argument, 0, 'c'},
+        {"gap",         required_argument, 0, 'g'},
+        {"minutes",     required_argument, 0, 't'},
+        {"pixels",      required_argument, 0, 'p'},
+        {"height",      required_argument, 0, 'H'},
+        {"iq",          no_argument,       &iq, 1},
+        {0, 0, 0, 0}
+    };
+
+    int opt_idx = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "w:i:R:f:D:l:s:A:n:o:S:c:g:t:p:H:", long_options, &opt_idx)) >= 0) {
+        switch(c) {
+            case 'w': file_name = optarg; break;
+            case 'i': image_name = optarg; break;
+            case 'R': sample_rate = atof(optarg); break;
+            case 'f': center_freq = atof(optarg); break;
+            case 'D': deviation = atof(optarg); break;
+            case 'l': lpm = atoi(optarg); break;
+            case 's': skew = atof(optarg); break;
+            case 'A': amplitude = atof(optarg); break;
+            case 'n': noise = atof(optarg); break;
+            case 'o': dc_offset = atof(optarg); break;
+            case 'S': seed = strtoull(optarg, NULL, 0); break;
+            case 'c': count = atoi(optarg); break;
+            case 'g': gap = atof(optarg); break;
+            case 't': minutes = atof(optarg); break;
+            case 'p': pixels_width = atoi(optarg); break;
+            case 'H': pattern_height = atoi(optarg); break;
+        }
+    }
+
+    if (file_name == NULL) {
+        fprintf(stdout, "Output file name is required: -w <file name>\n");
+        exit(-1);
+    }
+
+    std::vector<uint8_t> image;
+    int32_t width = pixels_width, height = pattern_height;
+
+    if (image_name != NULL) {
+        if (!image_load(image_name, image, &width, &height)) {
+            fprintf(stderr, "Can't load image %s (binary PGM"
+#ifdef HAVE_PNG
+                " or PNG"
+#endif
+                " expected)\n", image_name);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        image.resize((size_t)width * height);
+        FaxEncoder::TestPattern(image.data(), width, height);
+    }
+
+    FaxEncoder faxenc;
+    faxenc.SetIq(iq);
+    const int32_t channels = iq? 2 : 1;
+
+    if (!faxenc.Configure(lpm, sample_rate, center_freq, deviation, skew, amplitude, noise, dc_offset, seed)) {
+        fprintf(stderr, "Bad configuration: lpm=%d sample_rate=%.0f\n", lpm, sample_rate);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *fd = fopen(file_name, "wb");
+
+    if (fd == NULL) {
+        fprintf(stderr, "open(%s) failed: %s\n", file_name, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stdout, "Image: %dx%d, %d LPM, %.0f samples/sec%s, carrier %.1f, deviation %.1f, skew %.2f ppm\n",
+        width, height, lpm, sample_rate, iq? " I/Q" : "", center_freq, deviation, skew);
+
+    wav_write_header(fd, sample_rate, channels, 0);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    std::vector<int16_t> out;
+    uint64_t total = 0;
+    const uint64_t total_limit = minutes * 60 * sample_rate * channels;
+
+    auto flush = [&]() {
+        fwrite(out.data(), sizeof(int16_t), out.size(), fd);
+        total += out.size();
+        out.clear();
+    };
+
+    for (int32_t n = 0; n < count || total < total_limit; n++) {
+        faxenc.Gap(gap, out);
+        faxenc.Tone(FaxEncoder::m_StartFrequency, FaxEncoder::m_StartStopSeconds, out);
+        faxenc.PhasingLines(FaxEncoder::m_PhasingSeconds * lpm / 60, out);
+        flush();
+
+        for (int32_t y = 0; y < height; y++) {
+            faxenc.ImageLine(&image[(size_t)y * width], width, out);
+
+            if (out.size() > 1048576) {
+                flush();
+            }
+        }
+
+        faxenc.Tone(FaxEncoder::m_StopFrequency, FaxEncoder::m_StartStopSeconds, out);
+    }
+
+    faxenc.Gap(gap, out);
+    flush();
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (total * sizeof(int16_t) > UINT32_MAX - sizeof(wav_header_t)) {
+        fprintf(stdout, "Warning: more than 4 GB of data, WAV header sizes are capped\n");
+    }
+
+    wav_write_header(fd, sample_rate, channels, total * sizeof(int16_t));
+    fclose(fd);
+
+    const double seconds = total / channels / sample_rate;
+
+    fprintf(stdout, "Generated %.1f sec of audio in %.3f sec (%.0fx real time)\n",
+        seconds, elapsed, seconds / elapsed);
+
+    return 0;
+}
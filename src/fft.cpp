@@ -0,0 +1,356 @@
+#include "fft.h"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifdef HAVE_FFTW
+#include <fftw3.h>
+
+static_assert(sizeof(MFFTW_COMPLEX) == sizeof(tSComplex), "FFTW runs on tSComplex in place");
+
+// only the planner (and wisdom) of FFTW is not thread safe
+static std::mutex fftw_planner;
+#endif
+
+FftPlan::FftPlan(int32_t n, bool inverse):
+    m_n {n},
+    m_inverse {inverse},
+    m_radix2First {false},
+    m_fftw {NULL}
+{
+    const double sign = inverse? 1 : -1;
+
+#ifdef HAVE_FFTW
+    {
+        std::lock_guard<std::mutex> lock(fftw_planner);
+        MFFTW_COMPLEX *buf = (MFFTW_COMPLEX*) MFFTW_MALLOC(sizeof(MFFTW_COMPLEX) * n);
+
+        m_fftw = MFFTW_PLAN_DFT_1D(n, buf, buf, inverse? FFTW_BACKWARD : FFTW_FORWARD, FFTW_ESTIMATE | FFTW_UNALIGNED);
+        MFFTW_FREE(buf);
+    }
+
+    if (m_fftw != NULL) {
+        return;
+    }
+#endif
+
+    if (n == fft_size_pow2(n)) {
+        for (int32_t i = 1, j = 0; i < n; i++) {
+            int32_t bit = n >> 1;
+
+            for (; j & bit; bit >>= 1) {
+                j ^= bit;
+            }
+            j ^= bit;
+
+            if (i < j) {
+                m_swaps.push_back(i);
+                m_swaps.push_back(j);
+            }
+        }
+
+        int32_t L = 1;
+
+        // log2(n) odd: the first stage is radix-2, it needs no twiddles
+        if (n > 1 && (__builtin_ctz(n) & 1)) {
+            m_radix2First = true;
+            L = 2;
+        }
+
+        for (; 4 * L <= n; L *= 4) {
+            for (int32_t k = 0; k < L; k++) {
+                double a = sign * K_2PI * k / (2 * L);
+                m_twiddles.push_back(tSComplex {(float) cos(a), (float) sin(a)});
+            }
+
+            for (int32_t k = 0; k < L; k++) {
+                double a = sign * K_2PI * k / (4 * L);
+                m_twiddles.push_back(tSComplex {(float) cos(a), (float) sin(a)});
+            }
+        }
+
+        return;
+    }
+
+    /*
+        Bluestein: with jk = (j^2 + k^2 - (k - j)^2) / 2 the transform is a
+        convolution with the chirp exp(-+j*pi*k^2/n), done by transforms of
+        a power of 2 at least 2n - 1 long.
+    */
+    const int32_t m = fft_size_pow2(2 * n - 1);
+
+    m_fwd = std::make_unique<FftPlan>(m, false);
+    m_inv = std::make_unique<FftPlan>(m, true);
+    m_chirp.resize(n);
+
+    for (int32_t k = 0; k < n; k++) {
+        // k^2 mod 2n keeps the angle exact for large k
+        double a = sign * K_PI * (double)(((int64_t) k * k) % (2 * (int64_t) n)) / n;
+        m_chirp[k] = tSComplex {(float) cos(a), (float) sin(a)};
+    }
+
+    m_kernel.assign(m, tSComplex {0, 0});
+
+    for (int32_t k = 0; k < n; k++) {
+        tSComplex c = {m_chirp[k].re / m, -m_chirp[k].im / m};
+
+        m_kernel[k] = c;
+        if (k > 0) {
+            m_kernel[m - k] = c;
+        }
+    }
+
+    m_fwd->Execute(m_kernel.data());
+}
+
+FftPlan::~FftPlan()
+{
+#ifdef HAVE_FFTW
+    if (m_fftw != NULL) {
+        std::lock_guard<std::mutex> lock(fftw_planner);
+        MFFTW_DESTROY_PLAN((MFFTW_PLAN) m_fftw);
+    }
+#endif
+}
+
+void FftPlan::Execute(tSComplex *data) const
+{
+#ifdef HAVE_FFTW
+    if (m_fftw != NULL) {
+        MFFTW_EXECUTE_DFT((MFFTW_PLAN) m_fftw, (MFFTW_COMPLEX*) data, (MFFTW_COMPLEX*) data);
+        return;
+    }
+#endif
+
+    if (m_fwd) {
+        Bluestein(data);
+    } else {
+        Radix4(data);
+    }
+}
+
+#if defined(__AVX512F__)
+// x * w of 8 complex values, re and im interleaved
+static inline __m512 cmul_avx512(__m512 x, __m512 w)
+{
+    __m512 t = _mm512_mul_ps(_mm512_movehdup_ps(x), _mm512_permute_ps(w, 0xB1));
+    return _mm512_fmaddsub_ps(_mm512_moveldup_ps(x), w, t);
+}
+#endif
+
+/*
+    Two radix-2 decimation in time stages in one pass: a group of 4L points
+    after the stages up to L is
+
+        b0,1 = a0 +- W(2L)^k a1,  b2,3 = a2 +- W(2L)^k a3
+        out k, k+2L = b0 +- W(4L)^k b2,  out k+L, k+3L = b1 +- W(4L)^k W(4) b3
+
+    three complex multiplications instead of four, W(4) is j4 * j: -j
+    forward, +j inverse. Points are floats, re and im interleaved.
+*/
+static void radix4_stage(float *data, int32_t n, int32_t L, const float *w2, const float *w4, float j4)
+{
+    for (int32_t base = 0; base < n; base += 4 * L) {
+        float *p0 = data + 2 * base;
+        float *p1 = p0 + 2 * L;
+        float *p2 = p1 + 2 * L;
+        float *p3 = p2 + 2 * L;
+        int32_t c = 0;
+
+#if defined(__AVX512F__)
+        const __m512 jsign = _mm512_setr_ps(-j4, j4, -j4, j4, -j4, j4, -j4, j4,
+                                            -j4, j4, -j4, j4, -j4, j4, -j4, j4);
+
+        for (; c + 8 <= L; c += 8) {
+            const int32_t k = 2 * c;
+            const __m512 wa = _mm512_loadu_ps(w2 + k), wb = _mm512_loadu_ps(w4 + k);
+            const __m512 a0 = _mm512_loadu_ps(p0 + k), a2 = _mm512_loadu_ps(p2 + k);
+            const __m512 t1 = cmul_avx512(_mm512_loadu_ps(p1 + k), wa);
+            const __m512 t3 = cmul_avx512(_mm512_loadu_ps(p3 + k), wa);
+
+            const __m512 b0 = _mm512_add_ps(a0, t1), b1 = _mm512_sub_ps(a0, t1);
+            const __m512 b2 = _mm512_add_ps(a2, t3), b3 = _mm512_sub_ps(a2, t3);
+
+            const __m512 u = cmul_avx512(b2, wb);
+            const __m512 v = _mm512_mul_ps(_mm512_permute_ps(cmul_avx512(b3, wb), 0xB1), jsign);
+
+            _mm512_storeu_ps(p0 + k, _mm512_add_ps(b0, u));
+            _mm512_storeu_ps(p2 + k, _mm512_sub_ps(b0, u));
+            _mm512_storeu_ps(p1 + k, _mm512_add_ps(b1, v));
+            _mm512_storeu_ps(p3 + k, _mm512_sub_ps(b1, v));
+        }
+#elif defined(__ARM_NEON)
+        // vld2q splits re and im, no shuffles needed
+        for (; c + 4 <= L; c += 4) {
+            const int32_t k = 2 * c;
+            const float32x4x2_t wa = vld2q_f32(w2 + k), wb = vld2q_f32(w4 + k);
+            const float32x4x2_t a0 = vld2q_f32(p0 + k), a1 = vld2q_f32(p1 + k);
+            const float32x4x2_t a2 = vld2q_f32(p2 + k), a3 = vld2q_f32(p3 + k);
+
+            const float32x4_t t1r = vmlsq_f32(vmulq_f32(a1.val[0], wa.val[0]), a1.val[1], wa.val[1]);
+            const float32x4_t t1i = vmlaq_f32(vmulq_f32(a1.val[0], wa.val[1]), a1.val[1], wa.val[0]);
+            const float32x4_t t3r = vmlsq_f32(vmulq_f32(a3.val[0], wa.val[0]), a3.val[1], wa.val[1]);
+            const float32x4_t t3i = vmlaq_f32(vmulq_f32(a3.val[0], wa.val[1]), a3.val[1], wa.val[0]);
+
+            const float32x4_t b0r = vaddq_f32(a0.val[0], t1r), b0i = vaddq_f32(a0.val[1], t1i);
+            const float32x4_t b1r = vsubq_f32(a0.val[0], t1r), b1i = vsubq_f32(a0.val[1], t1i);
+            const float32x4_t b2r = vaddq_f32(a2.val[0], t3r), b2i = vaddq_f32(a2.val[1], t3i);
+            const float32x4_t b3r = vsubq_f32(a2.val[0], t3r), b3i = vsubq_f32(a2.val[1], t3i);
+
+            const float32x4_t ur = vmlsq_f32(vmulq_f32(b2r, wb.val[0]), b2i, wb.val[1]);
+            const float32x4_t ui = vmlaq_f32(vmulq_f32(b2r, wb.val[1]), b2i, wb.val[0]);
+            const float32x4_t vr0 = vmlsq_f32(vmulq_f32(b3r, wb.val[0]), b3i, wb.val[1]);
+            const float32x4_t vi0 = vmlaq_f32(vmulq_f32(b3r, wb.val[1]), b3i, wb.val[0]);
+            const float32x4_t vr = vmulq_n_f32(vi0, -j4), vi = vmulq_n_f32(vr0, j4);
+
+            float32x4x2_t o;
+            o.val[0] = vaddq_f32(b0r, ur); o.val[1] = vaddq_f32(b0i, ui); vst2q_f32(p0 + k, o);
+            o.val[0] = vsubq_f32(b0r, ur); o.val[1] = vsubq_f32(b0i, ui); vst2q_f32(p2 + k, o);
+            o.val[0] = vaddq_f32(b1r, vr); o.val[1] = vaddq_f32(b1i, vi); vst2q_f32(p1 + k, o);
+            o.val[0] = vsubq_f32(b1r, vr); o.val[1] = vsubq_f32(b1i, vi); vst2q_f32(p3 + k, o);
+        }
+#endif
+
+        // the first stages, L shorter than a vector
+        for (; c < L; c++) {
+            const int32_t k = 2 * c;
+            const float t1r = p1[k] * w2[k] - p1[k + 1] * w2[k + 1];
+            const float t1i = p1[k] * w2[k + 1] + p1[k + 1] * w2[k];
+            const float t3r = p3[k] * w2[k] - p3[k + 1] * w2[k + 1];
+            const float t3i = p3[k] * w2[k + 1] + p3[k + 1] * w2[k];
+
+            const float b0r = p0[k] + t1r, b0i = p0[k + 1] + t1i;
+            const float b1r = p0[k] - t1r, b1i = p0[k + 1] - t1i;
+            const float b2r = p2[k] + t3r, b2i = p2[k + 1] + t3i;
+            const float b3r = p2[k] - t3r, b3i = p2[k + 1] - t3i;
+
+            const float ur = b2r * w4[k] - b2i * w4[k + 1];
+            const float ui = b2r * w4[k + 1] + b2i * w4[k];
+            const float vr0 = b3r * w4[k] - b3i * w4[k + 1];
+            const float vi0 = b3r * w4[k + 1] + b3i * w4[k];
+            const float vr = -j4 * vi0, vi = j4 * vr0;
+
+            p0[k] = b0r + ur;
+            p0[k + 1] = b0i + ui;
+            p2[k] = b0r - ur;
+            p2[k + 1] = b0i - ui;
+            p1[k] = b1r + vr;
+            p1[k + 1] = b1i + vi;
+            p3[k] = b1r - vr;
+            p3[k + 1] = b1i - vi;
+        }
+    }
+}
+
+void FftPlan::Radix4(tSComplex *data) const
+{
+    const int32_t n = m_n;
+
+    for (size_t i = 0; i < m_swaps.size(); i += 2) {
+        tSComplex t = data[m_swaps[i]];
+        data[m_swaps[i]] = data[m_swaps[i + 1]];
+        data[m_swaps[i + 1]] = t;
+    }
+
+    int32_t L = 1;
+
+    if (m_radix2First) {
+        for (int32_t i = 0; i < n; i += 2) {
+            tSComplex a = data[i], b = data[i + 1];
+
+            data[i] = tSComplex {a.re + b.re, a.im + b.im};
+            data[i + 1] = tSComplex {a.re - b.re, a.im - b.im};
+        }
+        L = 2;
+    }
+
+    const tSComplex *tw = m_twiddles.data();
+
+    for (; 4 * L <= n; L *= 4) {
+        radix4_stage(&data[0].re, n, L, &tw[0].re, &tw[L].re, m_inverse? 1 : -1);
+        tw += 2 * L;
+    }
+}
+
+void FftPlan::Bluestein(tSComplex *data) const
+{
+    const int32_t n = m_n, m = m_fwd->Size();
+    // per thread, the plan is shared
+    thread_local std::vector<tSComplex> work;
+
+    work.assign(m, tSComplex {0, 0});
+
+    for (int32_t k = 0; k < n; k++) {
+        work[k].re = data[k].re * m_chirp[k].re - data[k].im * m_chirp[k].im;
+        work[k].im = data[k].re * m_chirp[k].im + data[k].im * m_chirp[k].re;
+    }
+
+    m_fwd->Execute(work.data());
+
+    for (int32_t k = 0; k < m; k++) {
+        float re = work[k].re * m_kernel[k].re - work[k].im * m_kernel[k].im;
+        work[k].im = work[k].re * m_kernel[k].im + work[k].im * m_kernel[k].re;
+        work[k].re = re;
+    }
+
+    m_inv->Execute(work.data());
+
+    for (int32_t k = 0; k < n; k++) {
+        data[k].re = work[k].re * m_chirp[k].re - work[k].im * m_chirp[k].im;
+        data[k].im = work[k].re * m_chirp[k].im + work[k].im * m_chirp[k].re;
+    }
+}
+
+const FftPlan *fft_plan(int32_t n, bool inverse)
+{
+    static std::mutex lock;
+    static std::map<std::pair<int32_t, bool>, std::unique_ptr<FftPlan>> plans;
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto &plan = plans[{n, inverse}];
+
+    if (!plan) {
+#ifdef HAVE_FFTW
+        if (plans.size() == 1) {
+            // what the administrator measured for this machine, if anything
+            std::lock_guard<std::mutex> planner(fftw_planner);
+            MFFTW_IMPORT_SYSTEM_WISDOM();
+        }
+#endif
+        plan = std::make_unique<FftPlan>(n, inverse);
+    }
+
+    return plan.get();
+}
+
+const char *fft_backend()
+{
+#ifdef HAVE_FFTW
+    return "fftw";
+#else
+    return "built-in";
+#endif
+}
+
+void fft_radix2(tSComplex *data, int32_t n, bool inverse)
+{
+    fft_plan(n, inverse)->Execute(data);
+}
+
+int32_t fft_size_pow2(int32_t n)
+{
+    int32_t size = 1;
+
+    while (size < n) {
+        size <<= 1;
+    }
+
+    return size;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "datatypes.h"
+
+// Complex FFT of one size and direction. Forward uses exp(-j*2*pi*k*n/N),
+// inverse is not scaled.
+//
+// Powers of 2 are done by the built-in radix-4 (one radix-2 stage for odd
+// powers) with the twiddles of every stage in a table, other sizes by
+// Bluestein's algorithm on a power of 2. With FFTW found at build time
+// (HAVE_FFTW) it does them all.
+//
+// A plan does not change after it is made, any number of threads may run it
+// at once.
+class FftPlan
+{
+public:
+    FftPlan(int32_t n, bool inverse);
+    ~FftPlan();
+
+    int32_t Size() const { return m_n; }
+    bool Inverse() const { return m_inverse; }
+
+    // In place, data holds Size() points
+    void Execute(tSComplex *data) const;
+
+private:
+    void Radix4(tSComplex *data) const;
+    void Bluestein(tSComplex *data) const;
+
+    int32_t m_n;
+    bool m_inverse;
+
+    // power of 2
+    std::vector<int32_t> m_swaps;           // pairs of the bit reversal permutation
+    std::vector<tSComplex> m_twiddles;      // W(2L)^k and W(4L)^k of every radix-4 stage, k < L
+    bool m_radix2First;                     // odd power of 2
+
+    // any other size
+    std::unique_ptr<FftPlan> m_fwd, m_inv;  // of the power of 2 size
+    std::vector<tSComplex> m_chirp;         // exp(-+j*pi*k^2/n), k < n
+    std::vector<tSComplex> m_kernel;        // transform of the conjugate chirp, scaled
+
+    void *m_fftw;
+};
+
+// Plan of n points from a process wide cache, made on first use and kept until
+// the exit. Safe to call from any thread.
+const FftPlan *fft_plan(int32_t n, bool inverse);
+
+// "fftw" or "built-in"
+const char *fft_backend();
+
+// In-place transform of a power of 2 size, through the plan cache
+void fft_radix2(tSComplex *data, int32_t n, bool inverse);
+
+// Smallest power of 2 not less than n
+int32_t fft_size_pow2(int32_t n);
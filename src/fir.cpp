@@ -0,0 +1,136 @@
+#include "fir.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void fir_block_any(const float *coeff, int32_t taps, fir_state_t *state, const float *in, float *out, int32_t count)
+{
+    float *history = state->history;
+    int32_t pos = state->pos;
+
+    for (int32_t i = 0; i < count; i++) {
+        history[pos] = history[pos + taps] = in[i];
+        pos = (pos + 1 == taps)? 0 : pos + 1;
+
+        const float *w = history + pos;
+        float sum = 0;
+
+        for (int32_t j = 0; j < taps; j++) {
+            sum += w[j] * coeff[j];
+        }
+
+        out[i] = sum;
+    }
+
+    state->pos = pos;
+}
+
+struct fir_entry_t {
+    int32_t sample_rate;
+    const float *coeff;
+    fir_kernel_t kernel;
+};
+
+template<int32_t RATE, int32_t BANDWIDTH>
+static constexpr fir_entry_t fir_entry()
+{
+    using table = fir_table_t<RATE, BANDWIDTH>;
+    return {RATE, table::coeff.data(), {table::taps, &fir_block<table::taps>}};
+}
+
+template<int32_t RATE>
+static constexpr std::array<fir_entry_t, 3> fir_rate()
+{
+    return {fir_entry<RATE, 0>(), fir_entry<RATE, 1>(), fir_entry<RATE, 2>()};
+}
+
+static constexpr std::array<fir_entry_t, 3> fir_tables[] = {
+    fir_rate<8000>(), fir_rate<11025>(), fir_rate<12000>(),
+    fir_rate<22050>(), fir_rate<44100>(), fir_rate<48000>(),
+};
+
+fir_kernel_t fir_kernel(double sample_rate, int32_t bandwidth, float *coeff)
+{
+    for (const auto &rate : fir_tables) {
+        const fir_entry_t &e = rate[bandwidth];
+
+        if (e.sample_rate == sample_rate) {
+            memcpy(coeff, e.coeff, e.kernel.taps * sizeof(float));
+            return e.kernel;
+        }
+    }
+
+    const fir_spec_t &spec = fir_specs[bandwidth];
+    int32_t taps = fir_taps(sample_rate, spec.transition);
+
+    fir_design(coeff, taps, sample_rate, spec.cutoff);
+    return {taps, &fir_block_any};
+}
+
+void fir_coeff_q15(const float *coeff, int32_t taps, int16_t *coeff_q15)
+{
+    int32_t n;
+
+    for (n = 0; n < taps; n++) {
+        int32_t c = lrintf(coeff[n] * 32768.0f);
+        coeff_q15[n] = (c > 32767)? 32767 : (c < -32768)? -32768 : c;
+    }
+    for (; n < FIR_MAX_TAPS + FIR_Q15_PAD; n++) {
+        coeff_q15[n] = 0;
+    }
+}
+
+void fir_block_q15(const int16_t *coeff, int32_t taps, fir_state_q15_t *state, const int16_t *in, int16_t *out, int32_t count)
+{
+    int16_t *history = state->history;
+    int32_t pos = state->pos;
+    const int32_t padded = (taps + FIR_Q15_PAD - 1) / FIR_Q15_PAD * FIR_Q15_PAD;
+
+    for (int32_t i = 0; i < count; i++) {
+        history[pos] = history[pos + taps] = in[i];
+        pos = (pos + 1 == taps)? 0 : pos + 1;
+
+        const int16_t *w = history + pos;
+
+#if defined(__ARM_NEON)
+        // Q15 * Q15 doubled to Q31, saturating
+        int32x4_t acc_lo = vdupq_n_s32(0), acc_hi = vdupq_n_s32(0);
+
+        for (int32_t j = 0; j < padded; j += 8) {
+            int16x8_t x = vld1q_s16(w + j);
+            int16x8_t c = vld1q_s16(coeff + j);
+
+            acc_lo = vqdmlal_s16(acc_lo, vget_low_s16(x), vget_low_s16(c));
+            acc_hi = vqdmlal_s16(acc_hi, vget_high_s16(x), vget_high_s16(c));
+        }
+
+#if defined(__aarch64__)
+        int64_t sum = vaddlvq_s32(acc_lo) + vaddlvq_s32(acc_hi);
+#else
+        // ARMv7 has no across vector add, pairwise to two lanes instead
+        int64x2_t sum2 = vaddq_s64(vpaddlq_s32(acc_lo), vpaddlq_s32(acc_hi));
+        int64_t sum = vgetq_lane_s64(sum2, 0) + vgetq_lane_s64(sum2, 1);
+#endif
+        sum = (sum + (1 << 15)) >> 16;
+#else
+        // Q30, the coefficients of a low pass sum to less than 2 in magnitude
+        int32_t sum = 0;
+
+        // whole vectors of FIR_Q15_PAD, for the auto vectorizer
+        for (int32_t j = 0; j < padded; j += FIR_Q15_PAD) {
+            for (int32_t k = 0; k < FIR_Q15_PAD; k++) {
+                sum += w[j + k] * coeff[j + k];
+            }
+        }
+
+        sum = (sum + (1 << 14)) >> 15;
+#endif
+        out[i] = (sum > 32767)? 32767 : (sum < -32768)? -32768 : sum;
+    }
+
+    state->pos = pos;
+}
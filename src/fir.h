@@ -0,0 +1,195 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/*
+    Low pass of the demodulator's I and Q, designed for the sample rate.
+
+    Cutoff and transition are in Hz, so the filter rejects the same band
+    (the mixing image at twice the carrier, neighbours) at any rate: a Kaiser
+    windowed sinc with as many taps as the transition needs at that rate.
+    The common rates have their coefficients computed by the compiler and a
+    kernel unrolled for their tap count, other rates are designed when the
+    decoder is configured and run by the generic kernel.
+*/
+
+#define FIR_MAX_TAPS        255
+#define FIR_ATTENUATION     50.0    // dB in the stop band, at least 50
+
+struct fir_spec_t {
+    double cutoff;          // Hz, -6 dB
+    double transition;      // Hz, to the stop band
+};
+
+// Narrow, middle and wide (FaxDecoder::firfilter::Bandwidth)
+static constexpr fir_spec_t fir_specs[3] = {
+    {1200, 1500},
+    {1500, 1500},
+    {1900, 1500},
+};
+
+// Compile time math, the <cmath> functions are not constexpr
+static constexpr double fir_cx_cos(double x)
+{
+    constexpr double pi = 3.14159265358979323846;
+
+    // to [-pi, pi]
+    x -= 2 * pi * (int64_t)(x / (2 * pi));
+    if (x > pi) x -= 2 * pi;
+    if (x < -pi) x += 2 * pi;
+
+    double term = 1, sum = 1;
+
+    for (int32_t n = 1; n < 24; n++) {
+        term *= -x * x / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+
+    return sum;
+}
+
+static constexpr double fir_cx_sin(double x)
+{
+    return fir_cx_cos(x - 3.14159265358979323846 / 2);
+}
+
+static constexpr double fir_cx_sqrt(double x)
+{
+    double r = (x > 1)? x : 1;
+
+    for (int32_t i = 0; i < 64; i++) {
+        r = (r + x / r) / 2;
+    }
+
+    return r;
+}
+
+// Modified Bessel function of the first kind, order 0
+static constexpr double fir_cx_bessel_i0(double x)
+{
+    double term = 1, sum = 1;
+
+    for (int32_t k = 1; k < 40; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+// Odd, from FIR_ATTENUATION and the transition relative to the rate
+static constexpr int32_t fir_taps(double sample_rate, double transition)
+{
+    constexpr double pi = 3.14159265358979323846;
+    int32_t taps = (int32_t)((FIR_ATTENUATION - 8) / (2.285 * 2 * pi * transition / sample_rate)) + 2;
+
+    taps |= 1;
+    return (taps < 5)? 5 : (taps > FIR_MAX_TAPS)? FIR_MAX_TAPS : taps;
+}
+
+// Unity DC gain
+static constexpr void fir_design(float *coeff, int32_t taps, double sample_rate, double cutoff)
+{
+    constexpr double pi = 3.14159265358979323846;
+    // Kaiser's beta for 50 dB and more
+    constexpr double beta = 0.1102 * (FIR_ATTENUATION - 8.7);
+    const double fc = cutoff / sample_rate;
+    const double i0_beta = fir_cx_bessel_i0(beta);
+    double h[FIR_MAX_TAPS] = {};
+    double sum = 0;
+
+    for (int32_t n = 0; n < taps; n++) {
+        double t = n - (taps - 1) / 2.0;
+        double r = 2.0 * n / (taps - 1) - 1;
+        double sinc = (t == 0)? 2 * fc : fir_cx_sin(2 * pi * fc * t) / (pi * t);
+
+        h[n] = sinc * fir_cx_bessel_i0(beta * fir_cx_sqrt(1 - r * r)) / i0_beta;
+        sum += h[n];
+    }
+
+    for (int32_t n = 0; n < taps; n++) {
+        coeff[n] = h[n] / sum;
+    }
+}
+
+template<int32_t RATE, int32_t BANDWIDTH>
+struct fir_table_t {
+    static constexpr int32_t taps = fir_taps(RATE, fir_specs[BANDWIDTH].transition);
+
+    static constexpr std::array<float, taps> make()
+    {
+        std::array<float, taps> c {};
+        fir_design(c.data(), taps, RATE, fir_specs[BANDWIDTH].cutoff);
+        return c;
+    }
+
+    static constexpr std::array<float, taps> coeff = make();
+};
+
+/*
+    Filter state: every sample is stored twice, TAPS apart, so the last TAPS
+    of them are always contiguous from pos on. count samples of in are
+    filtered to out, they may be the same.
+*/
+struct fir_state_t {
+    float history[2 * FIR_MAX_TAPS];
+    int32_t pos;
+};
+
+typedef void (*fir_block_fn)(const float *coeff, int32_t taps, fir_state_t *state,
+                             const float *in, float *out, int32_t count);
+
+template<int32_t TAPS>
+void fir_block(const float *coeff, int32_t, fir_state_t *state, const float *in, float *out, int32_t count)
+{
+    float *history = state->history;
+    int32_t pos = state->pos;
+
+    for (int32_t i = 0; i < count; i++) {
+        history[pos] = history[pos + TAPS] = in[i];
+        pos = (pos + 1 == TAPS)? 0 : pos + 1;
+
+        const float *w = history + pos;
+        float sum = 0;
+
+        // a constant trip count, unrolled
+        for (int32_t j = 0; j < TAPS; j++) {
+            sum += w[j] * coeff[j];
+        }
+
+        out[i] = sum;
+    }
+
+    state->pos = pos;
+}
+
+// Any tap count, for the rates without a table
+void fir_block_any(const float *coeff, int32_t taps, fir_state_t *state, const float *in, float *out, int32_t count);
+
+struct fir_kernel_t {
+    int32_t taps;
+    fir_block_fn block;
+};
+
+// Coefficients into coeff (FIR_MAX_TAPS long): the table of a common rate and
+// the kernel unrolled for it, otherwise designed now and the generic kernel
+fir_kernel_t fir_kernel(double sample_rate, int32_t bandwidth, float *coeff);
+
+/*
+    Q15 variant for the fixed point demodulator. Samples and coefficients are
+    int16, products are summed in 32 bits (saturating on NEON) and rounded
+    back to Q15. The coefficients are zero padded to a multiple of
+    FIR_Q15_PAD, so the kernel reads whole vectors past the last tap.
+*/
+#define FIR_Q15_PAD         8
+
+struct fir_state_q15_t {
+    int16_t history[2 * FIR_MAX_TAPS + FIR_Q15_PAD];
+    int32_t pos;
+};
+
+// taps float coefficients to Q15, coeff_q15 is FIR_MAX_TAPS + FIR_Q15_PAD long
+void fir_coeff_q15(const float *coeff, int32_t taps, int16_t *coeff_q15);
+
+void fir_block_q15(const int16_t *coeff, int32_t taps, fir_state_q15_t *state, const int16_t *in, int16_t *out, int32_t count);
@@ -0,0 +1,104 @@
+#include "image.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+
+// Binary 8 bit PGM (P5), comments in the header are skipped
+bool image_load_pgm(const char *file_name, std::vector<uint8_t> &image, int32_t *width, int32_t *height)
+{
+    FILE *fd = fopen(file_name, "rb");
+
+    if (fd == NULL) {
+        return false;
+    }
+
+    int32_t values[3];
+    char magic[3] = {0};
+    bool ok = fread(magic, 1, 2, fd) == 2 && strcmp(magic, "P5") == 0;
+
+    for (int32_t n = 0; ok && n < 3; n++) {
+        int c = fgetc(fd);
+
+        while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            if (c == '#') {
+                while (c != '\n' && c != EOF) {
+                    c = fgetc(fd);
+                }
+            }
+            c = fgetc(fd);
+        }
+
+        ungetc(c, fd);
+        ok = fscanf(fd, "%d", &values[n]) == 1;
+    }
+
+    // single whitespace before the raster
+    ok = ok && fgetc(fd) != EOF && values[2] > 0 && values[2] <= 255;
+
+    if (ok) {
+        *width = values[0];
+        *height = values[1];
+        image.resize((size_t)*width * *height);
+        ok = fread(image.data(), 1, image.size(), fd) == image.size();
+
+        if (ok && values[2] != 255) {
+            for (auto &p : image) {
+                p = p * 255 / values[2];
+            }
+        }
+    }
+
+    fclose(fd);
+    return ok;
+}
+
+#ifdef HAVE_PNG
+bool image_load_png(const char *file_name, std::vector<uint8_t> &image, int32_t *width, int32_t *height)
+{
+    png_image png;
+
+    memset(&png, 0, sizeof png);
+    png.version = PNG_IMAGE_VERSION;
+
+    if (!png_image_begin_read_from_file(&png, file_name)) {
+        return false;
+    }
+
+    png.format = PNG_FORMAT_GRAY;
+    image.resize(PNG_IMAGE_SIZE(png));
+    *width = png.width;
+    *height = png.height;
+
+    return png_image_finish_read(&png, NULL, image.data(), 0, NULL);
+}
+#endif
+
+bool image_load(const char *file_name, std::vector<uint8_t> &image, int32_t *width, int32_t *height)
+{
+    if (image_load_pgm(file_name, image, width, height)) {
+        return true;
+    }
+#ifdef HAVE_PNG
+    return image_load_png(file_name, image, width, height);
+#else
+    return false;
+#endif
+}
+
+bool image_save_pgm(const char *file_name, const uint8_t *image, int32_t width, int32_t height)
+{
+    FILE *fd = fopen(file_name, "wb");
+
+    if (fd == NULL) {
+        return false;
+    }
+
+    fprintf(fd, "P5 %d %d %d\n", width, height, 255);
+    bool ok = fwrite(image, 1, (size_t)width * height, fd) == (size_t)width * height;
+
+    return fclose(fd) == 0 && ok;
+}
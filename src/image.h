@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// 8 bit gray images as used by the encoder and the regression tools.
+// Rows are stored top down without padding.
+
+// Binary PGM (P5), or PNG when built with HAVE_PNG; color PNGs are converted to gray
+bool image_load(const char *file_name, std::vector<uint8_t> &image, int32_t *width, int32_t *height);
+
+bool image_load_pgm(const char *file_name, std::vector<uint8_t> &image, int32_t *width, int32_t *height);
+
+#ifdef HAVE_PNG
+bool image_load_png(const char *file_name, std::vector<uint8_t> &image, int32_t *width, int32_t *height);
+#endif
+
+bool image_save_pgm(const char *file_name, const uint8_t *image, int32_t width, int32_t height);
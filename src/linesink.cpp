@@ -0,0 +1,121 @@
+#include "linesink.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <time.h>
+
+#define PGM_MAX_HEIGHT  999999  // fixed width height field
+
+bool PgmFileSink::Open(const char *file_name, int32_t width)
+{
+    Close();
+
+    m_file = fopen(file_name, "w");
+
+    if (m_file == NULL) {
+        return false;
+    }
+
+    m_width = width;
+    m_lines = 0;
+    m_offset = fprintf(m_file, "P5 %d ", m_width);
+    // reserve space for height (updated with every line) using a fixed-length field
+    fprintf(m_file, "%6d %d\n", 0, 255);
+
+    return true;
+}
+
+void PgmFileSink::Line(std::span<const uint8_t> line, int64_t, double)
+{
+    if (m_file == NULL) return;
+
+    fwrite(line.data(), line.size(), 1, m_file);
+    m_lines++;
+
+    // With each data write to the file update image header too,
+    // so it would be readable if utility is killed midst processing.
+    // Usefull for partial decode, when image tilt is evaluated by eye.
+    long pos = ftell(m_file);
+
+    fseek(m_file, m_offset, SEEK_SET);
+    fprintf(m_file, "%6d", (int32_t) std::min(m_lines, (int64_t) PGM_MAX_HEIGHT));
+    fseek(m_file, pos, SEEK_SET);
+}
+
+void PgmFileSink::Close()
+{
+    if (m_file == NULL) return;
+
+    fflush(m_file);
+
+    fseek(m_file, m_offset, SEEK_SET);
+    if (m_lines > PGM_MAX_HEIGHT) {
+        FAX_WARN("height limited to %d!\n", PGM_MAX_HEIGHT);
+    }
+    fprintf(m_file, "%6d", (int32_t) std::min(m_lines, (int64_t) PGM_MAX_HEIGHT));
+
+    fclose(m_file);
+    FAX_INFO("FAX wrote %" PRId64 " lines\n", m_lines);
+
+    m_file = NULL;
+}
+
+RotatingPgmSink::RotatingPgmSink(const std::string &prefix, int32_t width, int64_t max_lines):
+    m_prefix {prefix},
+    m_width {width},
+    m_maxLines {(max_lines > 0)? std::min(max_lines, (int64_t) PGM_MAX_HEIGHT) : PGM_MAX_HEIGHT},
+    m_files {0},
+    m_lines {0}
+{
+}
+
+void RotatingPgmSink::Line(std::span<const uint8_t> line, int64_t index, double timestamp)
+{
+    if (!m_file.IsOpen()) {
+        char stamp[32], name[64];
+        time_t now = time(NULL);
+        struct tm tm;
+
+        strftime(stamp, sizeof stamp, "%Y%m%d-%H%M%S", gmtime_r(&now, &tm));
+        snprintf(name, sizeof name, "-%s-%04" PRId64 ".pgm", stamp, m_files + 1);
+        std::string file_name = m_prefix + name;
+
+        if (!m_file.Open(file_name.c_str(), m_width)) {
+            FAX_ERROR("FAX open FAILED %s\n", file_name.c_str());
+            return;
+        }
+
+        m_files++;
+        FAX_INFO("FAX open %s at %.1f sec\n", file_name.c_str(), timestamp);
+    }
+
+    m_file.Line(line, index, timestamp);
+    m_lines++;
+
+    if (m_file.Lines() >= m_maxLines) {
+        m_file.Close();
+    }
+}
+
+void RotatingPgmSink::Event(FaxEvent, double)
+{
+    // the next line starts a new file
+    m_file.Close();
+}
+
+void RotatingPgmSink::Close()
+{
+    m_file.Close();
+}
+
+void MemoryLineSink::Line(std::span<const uint8_t> line, int64_t, double)
+{
+    if (Full()) return;
+
+    // lines of another width are cut or padded with white
+    size_t n = std::min(line.size(), (size_t) m_width);
+    m_data.insert(m_data.end(), line.begin(), line.begin() + n);
+    m_data.resize(m_data.size() + (m_width - n), 255);
+    m_lines++;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+
+enum FaxEvent {
+    FAX_EVENT_START,        // START tone recognized, a new fax begins
+    FAX_EVENT_STOP          // STOP tone recognized
+};
+
+// Destination of the finished image lines of a FaxDecoder.
+//
+// The line is the decoder's own buffer, valid only during the call: a sink
+// that keeps it copies it, one that streams it (file, socket, encoder) does not
+// need to. index counts the lines passed to the sink since it was set, the
+// timestamp is the input position in seconds where the line ended.
+class FaxLineSink
+{
+public:
+    virtual ~FaxLineSink() {}
+
+    virtual void Line(std::span<const uint8_t> line, int64_t index, double timestamp) = 0;
+    // Transmission boundaries, before the lines that follow them
+    virtual void Event(FaxEvent, double) {}
+    // End of the image, held back lines have been delivered
+    virtual void Close() {}
+};
+
+// Binary PGM file. The height in the header is updated with every line, so a
+// partially decoded file is readable at any time.
+class PgmFileSink : public FaxLineSink
+{
+public:
+    PgmFileSink():
+        m_file {NULL},
+        m_offset {0},
+        m_width {0},
+        m_lines {0}
+    {
+    }
+
+    ~PgmFileSink() { Close(); }
+
+    bool Open(const char *file_name, int32_t width);
+    bool IsOpen() const { return m_file != NULL; }
+    int64_t Lines() const { return m_lines; }
+
+    void Line(std::span<const uint8_t> line, int64_t index, double timestamp) override;
+    void Close() override;
+
+private:
+    FILE *m_file;
+    long m_offset;          // of the height field
+    int32_t m_width;
+    int64_t m_lines;
+};
+
+// Continuous decoding: a new PGM file at every START and STOP tone and after
+// max_lines lines (at most 999999, the limit of the header). A file is opened
+// with its first line, named <prefix>-YYYYmmdd-HHMMSS-<n>.pgm in UTC.
+class RotatingPgmSink : public FaxLineSink
+{
+public:
+    RotatingPgmSink(const std::string &prefix, int32_t width, int64_t max_lines = 0);
+
+    void Line(std::span<const uint8_t> line, int64_t index, double timestamp) override;
+    void Event(FaxEvent event, double timestamp) override;
+    void Close() override;
+
+    int64_t Files() const { return m_files; }
+    int64_t Lines() const { return m_lines; }
+
+private:
+    PgmFileSink m_file;
+    std::string m_prefix;
+    int32_t m_width;
+    int64_t m_maxLines, m_files, m_lines;
+};
+
+// Lines collected in memory, up to max_lines (0 for no limit)
+class MemoryLineSink : public FaxLineSink
+{
+public:
+    MemoryLineSink(int32_t width, int64_t max_lines = 0):
+        m_width {width},
+        m_maxLines {max_lines},
+        m_lines {0}
+    {
+    }
+
+    void Line(std::span<const uint8_t> line, int64_t index, double timestamp) override;
+
+    const uint8_t *Data() const { return m_data.data(); }
+    int32_t Width() const { return m_width; }
+    int64_t Lines() const { return m_lines; }
+    bool Full() const { return m_maxLines > 0 && m_lines >= m_maxLines; }
+    void Clear() { m_data.clear(); m_lines = 0; }
+
+private:
+    std::vector<uint8_t> m_data;
+    int32_t m_width;
+    int64_t m_maxLines, m_lines;
+};
+
+// Lines handed to a function, e.g. to feed a network stream or an encoder
+class CallbackLineSink : public FaxLineSink
+{
+public:
+    typedef std::function<void(std::span<const uint8_t> line, int64_t index, double timestamp)> LineCallback;
+    typedef std::function<void()> CloseCallback;
+
+    CallbackLineSink(LineCallback line, CloseCallback close = nullptr):
+        m_line {line},
+        m_close {close}
+    {
+    }
+
+    void Line(std::span<const uint8_t> line, int64_t index, double timestamp) override
+        { m_line(line, index, timestamp); }
+    void Close() override
+        { if (m_close) m_close(); }
+
+private:
+    LineCallback m_line;
+    CloseCallback m_close;
+};
@@ -0,0 +1,45 @@
+#include "log.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+std::atomic<int> fax_log_level {FAX_LOG_INFO};
+
+static thread_local char thread_tag[32];
+
+void fax_log_set_level(int level)
+{
+    fax_log_level.store(level, std::memory_order_relaxed);
+}
+
+void fax_log_set_thread_tag(const char *tag)
+{
+    if (tag == NULL) {
+        thread_tag[0] = 0;
+    } else {
+        snprintf(thread_tag, sizeof thread_tag, "[%s] ", tag);
+    }
+}
+
+void fax_log_write(int level, const char *fmt, ...)
+{
+    char buf[1024];
+    size_t len = strlen(thread_tag);
+    va_list ap;
+
+    memcpy(buf, thread_tag, len);
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, sizeof buf - len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0) {
+        return;
+    }
+
+    len = (len + n < sizeof buf)? len + n : sizeof buf - 1;
+
+    // errors and warnings apart from the regular output
+    FILE *f = (level <= FAX_LOG_WARN)? stderr : stdout;
+    fwrite(buf, 1, len, f);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+
+// Leveled logging for the decoder and the utilities.
+//
+// Levels above FAX_LOG_MAX_LEVEL are removed at compile time, the others are
+// checked against the runtime level before any argument is evaluated, so a
+// disabled message costs one relaxed atomic load. Each message is formatted
+// into a local buffer and written with one call, lines of concurrent decoders
+// do not interleave.
+
+#define FAX_LOG_ERROR   0
+#define FAX_LOG_WARN    1
+#define FAX_LOG_INFO    2       // progress and events, the default
+#define FAX_LOG_DEBUG   3       // decisions: phasing, gate, line rate
+#define FAX_LOG_TRACE   4       // per line detector values
+
+#ifndef FAX_LOG_MAX_LEVEL
+#define FAX_LOG_MAX_LEVEL FAX_LOG_DEBUG
+#endif
+
+extern std::atomic<int> fax_log_level;
+
+void fax_log_set_level(int level);
+
+// Prefix for the messages of the calling thread, e.g. a channel name; NULL for none
+void fax_log_set_thread_tag(const char *tag);
+
+void fax_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define FAX_LOG(level, fmt, ...) \
+    do { \
+        if ((level) <= FAX_LOG_MAX_LEVEL && (level) <= fax_log_level.load(std::memory_order_relaxed)) \
+            fax_log_write(level, fmt, ## __VA_ARGS__); \
+    } while (0)
+
+#define FAX_ERROR(fmt, ...) FAX_LOG(FAX_LOG_ERROR, fmt, ## __VA_ARGS__)
+#define FAX_WARN(fmt, ...)  FAX_LOG(FAX_LOG_WARN, fmt, ## __VA_ARGS__)
+#define FAX_INFO(fmt, ...)  FAX_LOG(FAX_LOG_INFO, fmt, ## __VA_ARGS__)
+#define FAX_DEBUG(fmt, ...) FAX_LOG(FAX_LOG_DEBUG, fmt, ## __VA_ARGS__)
+#define FAX_TRACE(fmt, ...) FAX_LOG(FAX_LOG_TRACE, fmt, ## __VA_ARGS__)
@@ -0,0 +1,234 @@
+#include "mem.h"
+#include "log.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include <sys/mman.h>
+
+/*
+    Pool of power of two size classes. Every block starts with a 64 byte
+    header holding its class, which keeps the payload aligned for the SIMD
+    loops. Freed blocks are chained on the free list of their class and
+    handed out again, they go back to the system only with fax_mem_trim().
+    Classes from 2 MB up are mmap()ed so they can use huge pages.
+*/
+
+#define POOL_HDR            64
+#define POOL_MIN_SHIFT      6       // smallest class, 64 bytes with the header
+#define POOL_MMAP_SHIFT     21      // 2 MB
+#define POOL_CLASSES        40
+#define POOL_MAGIC          0xfa8b10c5u
+
+struct pool_hdr {
+    uint32_t magic;
+    uint32_t cls;
+    bool mapped;
+    pool_hdr *next;                 // on the free list
+};
+
+static_assert(sizeof(pool_hdr) <= POOL_HDR, "pool header too large");
+
+static std::mutex pool_lock;
+static pool_hdr *pool_free[POOL_CLASSES];
+static fax_mem_stats_t pool_stats;
+static bool pool_huge;
+
+static size_t class_size(uint32_t cls)
+{
+    return (size_t)1 << (cls + POOL_MIN_SHIFT);
+}
+
+static int32_t size_class(size_t size)
+{
+    if (size > class_size(POOL_CLASSES - 1) - POOL_HDR) {
+        return -1;
+    }
+
+    uint32_t cls = 0;
+
+    while (class_size(cls) < size + POOL_HDR) {
+        cls++;
+    }
+
+    return cls;
+}
+
+static pool_hdr *system_alloc(uint32_t cls)
+{
+    const size_t size = class_size(cls);
+    pool_hdr *h;
+
+    if (cls + POOL_MIN_SHIFT >= POOL_MMAP_SHIFT) {
+        const size_t align = pool_huge? (size_t)1 << POOL_MMAP_SHIFT : 0;
+        const size_t map_size = size + align;
+        uint8_t *p = (uint8_t*) mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+
+        uint8_t *base = p;
+
+        if (align) {
+            // trim to a 2 MB aligned block so every page can be a huge one
+            base = (uint8_t*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+
+            if (base > p) {
+                munmap(p, base - p);
+            }
+            if (p + map_size > base + size) {
+                munmap(base + size, p + map_size - (base + size));
+            }
+#ifdef MADV_HUGEPAGE
+            madvise(base, size, MADV_HUGEPAGE);
+#endif
+        }
+
+        h = (pool_hdr*) base;
+        h->mapped = true;
+    } else {
+        h = (pool_hdr*) aligned_alloc(POOL_HDR, size);
+
+        if (h == NULL) {
+            return NULL;
+        }
+
+        h->mapped = false;
+    }
+
+    h->magic = POOL_MAGIC;
+    h->cls = cls;
+    pool_stats.system_allocs++;
+    return h;
+}
+
+static void system_free(pool_hdr *h)
+{
+    if (h->mapped) {
+        munmap(h, class_size(h->cls));
+    } else {
+        free(h);
+    }
+}
+
+#if defined(MALLOC_INTERCEPT) || defined(FAX_MEM_POOL)
+
+static pool_hdr *header_of(void *ptr)
+{
+    pool_hdr *h = (pool_hdr*)((uint8_t*) ptr - POOL_HDR);
+
+    if (h->magic != POOL_MAGIC) {
+        FAX_ERROR("kiwi_ifree: %p was not allocated by the pool\n", ptr);
+        abort();
+    }
+
+    return h;
+}
+
+void *kiwi_imalloc(const char *, size_t size)
+{
+    int32_t cls = size_class(size);
+
+    if (cls < 0) {
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(pool_lock);
+    pool_hdr *h = pool_free[cls];
+
+    if (h != NULL) {
+        pool_free[cls] = h->next;
+        pool_stats.pool_hits++;
+        pool_stats.bytes_cached -= class_size(cls);
+    } else if ((h = system_alloc(cls)) == NULL) {
+        return NULL;
+    }
+
+    pool_stats.bytes_in_use += class_size(cls);
+    return (uint8_t*) h + POOL_HDR;
+}
+
+void *kiwi_icalloc(const char *from, size_t nel, size_t size)
+{
+    if (size && nel > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *ptr = kiwi_imalloc(from, nel * size);
+
+    if (ptr != NULL) {
+        memset(ptr, 0, nel * size);
+    }
+
+    return ptr;
+}
+
+void *kiwi_irealloc(const char *from, void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return kiwi_imalloc(from, size);
+    }
+
+    const size_t have = class_size(header_of(ptr)->cls) - POOL_HDR;
+
+    // the class has room to spare more often than not
+    if (size <= have) {
+        return ptr;
+    }
+
+    void *nptr = kiwi_imalloc(from, size);
+
+    if (nptr != NULL) {
+        memcpy(nptr, ptr, have);
+        kiwi_ifree(ptr, from);
+    }
+
+    return nptr;
+}
+
+void kiwi_ifree(void *ptr, const char *)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    pool_hdr *h = header_of(ptr);
+
+    std::lock_guard<std::mutex> lock(pool_lock);
+    h->next = pool_free[h->cls];
+    pool_free[h->cls] = h;
+    pool_stats.bytes_in_use -= class_size(h->cls);
+    pool_stats.bytes_cached += class_size(h->cls);
+}
+
+#endif
+
+void fax_mem_huge_pages(bool enable)
+{
+    std::lock_guard<std::mutex> lock(pool_lock);
+    pool_huge = enable;
+}
+
+void fax_mem_get_stats(fax_mem_stats_t *stats)
+{
+    std::lock_guard<std::mutex> lock(pool_lock);
+    *stats = pool_stats;
+}
+
+void fax_mem_trim()
+{
+    std::lock_guard<std::mutex> lock(pool_lock);
+
+    for (int32_t cls = 0; cls < POOL_CLASSES; cls++) {
+        while (pool_free[cls] != NULL) {
+            pool_hdr *h = pool_free[cls];
+            pool_free[cls] = h->next;
+            system_free(h);
+        }
+    }
+
+    pool_stats.bytes_cached = 0;
+}
@@ -23,8 +23,10 @@ Boston, MA  02110-1301, USA.
 
 #include <stddef.h>
 
-//#define MALLOC_INTERCEPT
-#ifdef MALLOC_INTERCEPT
+// With FAX_MEM_POOL (the default build) the decoder buffers come from a pool,
+// see mem.cpp: freed blocks are kept for the next request of their size class,
+// so decoders that are reconfigured or reset for every job stop allocating.
+#if defined(MALLOC_INTERCEPT) || defined(FAX_MEM_POOL)
     void *kiwi_imalloc(const char *from, size_t size);
     void *kiwi_icalloc(const char *from, size_t nel, size_t size);
     void *kiwi_irealloc(const char *from, void *ptr, size_t size);
@@ -36,6 +38,19 @@ Boston, MA  02110-1301, USA.
     #define kiwi_ifree(ptr, ...) free(ptr)
 #endif
 
+struct fax_mem_stats_t {
+    size_t system_allocs;       // blocks taken from malloc/mmap
+    size_t pool_hits;           // requests served from the free lists
+    size_t bytes_in_use, bytes_cached;
+};
+
+// Blocks from 2 MB up are mmap()ed, with this enabled they are also 2 MB aligned
+// and marked for transparent huge pages. Process wide, affects later allocations.
+void fax_mem_huge_pages(bool enable);
+void fax_mem_get_stats(fax_mem_stats_t *stats);
+// Give the cached free blocks back to the system
+void fax_mem_trim();
+
 #define MALLOC_DEBUG
 #ifdef MALLOC_DEBUG
 	void *kiwi_malloc(const char *from, size_t size);
@@ -0,0 +1,276 @@
+#include "multichannel.h"
+#include "avg.h"
+#include "log.h"
+
+#include <cstdlib>
+#include <cstring>
+
+bool channel_config_parse(const char *spec, channel_config_t *config)
+{
+    std::string list = spec;
+    size_t pos = 0;
+
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+
+        std::string item = list.substr(pos, end - pos);
+        std::string key = item, value;
+        size_t eq = item.find('=');
+
+        if (eq != std::string::npos) {
+            key = item.substr(0, eq);
+            value = item.substr(eq + 1);
+        }
+
+        const char *v = value.c_str();
+
+        if (key.empty()) {
+            // ",," or a trailing comma
+        } else if (key == "lpm") {
+            config->lpm = atoi(v);
+        } else if (key == "freq") {
+            config->center_freq = atof(v);
+        } else if (key == "dev") {
+            config->deviation = atof(v);
+        } else if (key == "ppm") {
+            config->srcorr = atof(v) / 1000000 + 1;
+        } else if (key == "pixels") {
+            config->pixels = atoi(v);
+        } else if (key == "align") {
+            config->align_lines = atoi(v);
+        } else if (key == "limit") {
+            config->line_limit = atoi(v);
+        } else if (key == "out") {
+            config->output = value;
+        } else if (key == "off") {
+            config->enabled = false;
+        } else if (key == "no_header") {
+            config->header = false;
+        } else if (key == "no_phasing") {
+            config->phasing = false;
+        } else if (key == "auto_stop") {
+            config->auto_stop = true;
+        } else if (key == "remove_dc") {
+            config->remove_dc = true;
+        } else if (key == "gate") {
+            config->gate = true;
+        } else if (key == "afc") {
+            config->afc = true;
+        } else if (key == "fixed_point") {
+            config->fixed_point = true;
+        } else if (key == "auto_lpm") {
+            config->auto_lpm = true;
+        } else {
+            FAX_ERROR("Unknown channel setting \"%s\"\n", item.c_str());
+            return false;
+        }
+
+        pos = end + 1;
+    }
+
+    return true;
+}
+
+MultiChannelDecoder::MultiChannelDecoder():
+    m_counts {0, 0},
+    m_end {false, false},
+    m_strides {0, 0},
+    m_running {0},
+    m_sampleRate {0},
+    m_block {0},
+    m_done {true}
+{
+}
+
+bool MultiChannelDecoder::Start(const std::vector<channel_config_t> &channels, double sample_rate,
+                                bool continuous, int64_t rotate_lines)
+{
+    m_sampleRate = sample_rate;
+    m_block = 0;
+
+    for (size_t i = 0; i < channels.size(); i++) {
+        auto ch = std::make_unique<channel_t>();
+        const channel_config_t &cfg = channels[i];
+
+        ch->index = i;
+        ch->config = cfg;
+        ch->running = cfg.enabled;
+
+        if (cfg.enabled) {
+            ch->decoder.Configure(cfg.lpm, cfg.pixels, 8, cfg.center_freq, cfg.deviation,
+                FaxDecoder::firfilter::MIDDLE, 15.0, cfg.header, cfg.phasing, cfg.auto_stop,
+                false, false, sample_rate, cfg.srcorr, cfg.line_limit);
+
+            if (continuous) {
+                ch->sink = std::make_unique<RotatingPgmSink>(cfg.output, cfg.pixels, rotate_lines);
+                ch->decoder.SetLineSink(ch->sink.get());
+            } else {
+                ch->decoder.FileOpen(cfg.output.c_str());
+            }
+
+            ch->decoder.SetAutoAlign(cfg.align_lines);
+            ch->decoder.SetCarrierGate(cfg.gate);
+            ch->decoder.SetAfc(cfg.afc);
+            ch->decoder.SetFixedPoint(cfg.fixed_point);
+            ch->decoder.SetAutoLpm(cfg.auto_lpm);
+
+            FAX_INFO("Channel %zu: %d LPM, %d pixels, %.1f +- %.1f Hz, %s\n", i, cfg.lpm, cfg.pixels,
+                cfg.center_freq, cfg.deviation, cfg.output.c_str());
+        }
+
+        m_channels.push_back(std::move(ch));
+    }
+
+    int32_t active = 0;
+
+    for (auto &ch : m_channels) {
+        active += ch->running;
+    }
+
+    if (active == 0) {
+        FAX_ERROR("All channels are off\n");
+        return false;
+    }
+
+    m_running = active;
+    m_done = false;
+    m_barrier = std::make_unique<std::barrier<>>(active + 1);
+
+    for (auto &ch : m_channels) {
+        if (ch->running) {
+            ch->thread = std::thread(&MultiChannelDecoder::Worker, this, ch.get());
+        }
+    }
+
+    return true;
+}
+
+void MultiChannelDecoder::Worker(channel_t *ch)
+{
+    char tag[16];
+    snprintf(tag, sizeof tag, "ch%d", ch->index);
+    fax_log_set_thread_tag(tag);
+
+    for (uint64_t block = 0; ; block++) {
+        // a filled set, or the end
+        m_barrier->arrive_and_wait();
+
+        // the next set may be filled already, so the end is marked per set too
+        const int32_t set = block & 1;
+
+        if (m_end[set]) {
+            break;
+        }
+
+        if (!ch->running) {
+            continue;
+        }
+
+        const size_t count = m_counts[set];
+        int16_t *samples = &m_planes[set][ch->index * m_strides[set]];
+
+        if (ch->config.remove_dc && m_strides[set] != 0) {
+            float avg = FLOAT_AVERAGE(samples, count);
+            SAMPLES_SUBTRACT(samples, count, avg);
+        }
+
+        const size_t step = m_sampleRate;
+
+        for (size_t i = 0; i < count && ch->running; i += step) {
+            if (!ch->decoder.ProcessSamples(&samples[i], MIN(step, count - i), 0)) {
+                ch->running = false;
+                m_running--;
+            }
+        }
+    }
+
+    ch->decoder.FileClose();
+}
+
+int16_t *const *MultiChannelDecoder::Buffers(size_t count)
+{
+    const int32_t set = m_block & 1;
+    const size_t channels = m_channels.size();
+
+    // the decoders work on the other set, this one is free
+    if (count > m_strides[set]) {
+        m_strides[set] = count;
+        m_planes[set].resize(channels * count);
+    }
+
+    m_out.resize(channels);
+
+    for (size_t c = 0; c < channels; c++) {
+        m_out[c] = &m_planes[set][c * m_strides[set]];
+    }
+
+    return m_out.data();
+}
+
+bool MultiChannelDecoder::Commit(size_t count)
+{
+    if (m_done) {
+        return false;
+    }
+
+    const int32_t set = m_block & 1;
+
+    m_counts[set] = count;
+    m_end[set] = false;
+
+    // the decoders are done with the previous block and take this one
+    m_barrier->arrive_and_wait();
+    m_block++;
+
+    return m_running > 0;
+}
+
+bool MultiChannelDecoder::Process(const int16_t *frames, size_t count)
+{
+    if (m_done) {
+        return false;
+    }
+
+    DEINTERLEAVE(frames, count, m_channels.size(), Buffers(count));
+    return Commit(count);
+}
+
+bool MultiChannelDecoder::Broadcast(const int16_t *samples, size_t count)
+{
+    if (m_done) {
+        return false;
+    }
+
+    const int32_t set = m_block & 1;
+
+    if (m_planes[set].size() < count) {
+        m_planes[set].resize(count);
+    }
+
+    memcpy(m_planes[set].data(), samples, count * sizeof(int16_t));
+    m_strides[set] = 0;
+    return Commit(count);
+}
+
+void MultiChannelDecoder::Finish()
+{
+    if (m_done) {
+        return;
+    }
+
+    m_done = true;
+    m_end[m_block & 1] = true;
+    m_barrier->arrive_and_wait();
+
+    for (auto &ch : m_channels) {
+        if (ch->thread.joinable()) {
+            ch->thread.join();
+        }
+    }
+
+    m_channels.clear();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <barrier>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FaxDecoder.h"
+#include "linesink.h"
+
+// Decoder settings of one channel of a multi-channel recording
+struct channel_config_t {
+    bool enabled {true};
+    int32_t lpm {120};
+    int32_t pixels {1809};
+    double center_freq {1900};
+    double deviation {400};
+    double srcorr {1.0};
+    int32_t align_lines {0};
+    int32_t line_limit {0};
+    bool header {true};
+    bool phasing {true};
+    bool auto_stop {false};
+    bool remove_dc {false};
+    bool gate {false};
+    bool afc {false};
+    bool fixed_point {false};
+    bool auto_lpm {false};
+    std::string output;         // image, or the prefix of the rotated ones
+};
+
+// Changes the settings named in a "key=value,flag,..." list: lpm, freq, dev,
+// ppm, pixels, align, limit, out, and the flags off, no_header, no_phasing,
+// auto_stop, remove_dc, gate, afc, auto_lpm, fixed_point. false on an unknown key.
+bool channel_config_parse(const char *spec, channel_config_t *config);
+
+// One decoder per channel, each on its own thread, fed from one pass over
+// the interleaved frames. Blocks are deinterleaved into one of two sets of
+// channel buffers while the decoders work on the other set, a barrier hands
+// the filled set over.
+class MultiChannelDecoder
+{
+public:
+    MultiChannelDecoder();
+    ~MultiChannelDecoder() { Finish(); }
+
+    // rotate_lines and the START/STOP rotation apply to continuous decoding
+    bool Start(const std::vector<channel_config_t> &channels, double sample_rate,
+               bool continuous, int64_t rotate_lines);
+
+    // One block of interleaved frames, returns while it is being decoded.
+    // false once every channel has finished (auto_stop, line_limit).
+    bool Process(const int16_t *frames, size_t count);
+
+    // The same for samples made per channel, e.g. by a channelizer: the
+    // buffers of count samples of every channel are filled and handed over
+    // with Commit()
+    int16_t *const *Buffers(size_t count);
+    bool Commit(size_t count);
+
+    // One block of mono samples for every decoder, e.g. several configurations
+    // tried on one recording. The block is shared and read only, remove_dc of
+    // the channels is not applied: correct it before.
+    bool Broadcast(const int16_t *samples, size_t count);
+
+    // Waits for the last block and closes the images
+    void Finish();
+
+private:
+    struct channel_t {
+        int32_t index;
+        channel_config_t config;
+        FaxDecoder decoder;
+        std::unique_ptr<RotatingPgmSink> sink;
+        std::thread thread;
+        bool running;
+    };
+
+    void Worker(channel_t *ch);
+
+    std::vector<std::unique_ptr<channel_t>> m_channels;
+    std::vector<int16_t> m_planes[2];           // all channels of a block, one after another
+    size_t m_counts[2];
+    bool m_end[2];                              // no more blocks after this set
+    size_t m_strides[2];                        // frames of one channel, 0: one plane for all
+    std::vector<int16_t*> m_out;
+    std::unique_ptr<std::barrier<>> m_barrier;
+    std::atomic<int32_t> m_running;
+    double m_sampleRate;
+    uint64_t m_block;
+    bool m_done;                                // main thread only
+};
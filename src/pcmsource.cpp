@@ -0,0 +1,502 @@
+#include "pcmsource.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PCM_IDLE_MS         200     // a live source returns empty handed after this
+#define PCM_POLL_US         2000    // ring poll interval when it is empty
+#define UDP_MAX_PACKET      65536
+#define UDP_RCVBUF          (1 << 20)
+#define RTP_HEADER          12
+#define RTP_MAX_GAP_SEC     2       // longer gaps are a restart of the sender, not filled
+
+FilePcmSource::FilePcmSource(FILE *file, uint32_t sample_rate, size_t buf_samples):
+    m_file {file},
+    m_bufSamples {buf_samples},
+    m_sampleRate {sample_rate},
+    m_eof {false}
+{
+    m_buf = (int16_t*) operator new (sizeof(int16_t) * buf_samples, std::align_val_t(64));
+}
+
+FilePcmSource::~FilePcmSource()
+{
+    operator delete (m_buf, std::align_val_t(64));
+}
+
+size_t FilePcmSource::Next(int16_t **samples, size_t max)
+{
+    size_t n = fread(m_buf, sizeof(int16_t), std::min(max, m_bufSamples), m_file);
+
+    if (n == 0) {
+        m_eof = true;
+    }
+
+    *samples = m_buf;
+    return n;
+}
+
+UdpPcmSource::UdpPcmSource():
+    m_socket {-1},
+    m_format {RAW},
+    m_sampleRate {0},
+    m_pos {0},
+    m_count {0},
+    m_gap {0},
+    m_synced {false},
+    m_nextTs {0},
+    m_lost {0},
+    m_late {0}
+{
+}
+
+UdpPcmSource::~UdpPcmSource()
+{
+    if (m_socket >= 0) {
+        close(m_socket);
+    }
+}
+
+bool UdpPcmSource::Open(const char *spec, Format format, uint32_t sample_rate)
+{
+    std::string host = "0.0.0.0";
+    const char *port = spec;
+    const char *colon = strrchr(spec, ':');
+
+    if (colon != NULL) {
+        host.assign(spec, colon - spec);
+        port = colon + 1;
+    }
+
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    int err = getaddrinfo(host.c_str(), port, &hints, &ai);
+
+    if (err != 0) {
+        FAX_ERROR("UDP address %s: %s\n", spec, gai_strerror(err));
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    memcpy(&addr, ai->ai_addr, sizeof(addr));
+    freeaddrinfo(ai);
+
+    m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (m_socket < 0) {
+        FAX_ERROR("socket() failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // a burst after a scheduling hiccup must not overflow the socket
+    int rcvbuf = UDP_RCVBUF;
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct timeval tv = {0, PCM_IDLE_MS * 1000};
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if (bind(m_socket, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        FAX_ERROR("bind(%s) failed: %s\n", spec, strerror(errno));
+        close(m_socket);
+        m_socket = -1;
+        return false;
+    }
+
+    if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr))) {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = addr.sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+        if (setsockopt(m_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            FAX_ERROR("joining %s failed: %s\n", host.c_str(), strerror(errno));
+            close(m_socket);
+            m_socket = -1;
+            return false;
+        }
+    }
+
+    m_format = format;
+    m_sampleRate = sample_rate;
+    m_packet.resize(UDP_MAX_PACKET);
+    m_samples.resize(UDP_MAX_PACKET / sizeof(int16_t));
+
+    FAX_INFO("Listening for %s PCM on %s, %u samples/sec\n", (format == RTP)? "RTP" : "raw", spec, sample_rate);
+    return true;
+}
+
+// One datagram into m_samples, false on timeout
+bool UdpPcmSource::Receive()
+{
+    ssize_t len = recv(m_socket, m_packet.data(), m_packet.size(), 0);
+
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            FAX_ERROR("recv() failed: %s\n", strerror(errno));
+            close(m_socket);
+            m_socket = -1;
+        }
+        return false;
+    }
+
+    const uint8_t *payload = m_packet.data();
+
+    if (m_format == RAW) {
+        m_count = len / sizeof(int16_t);
+        memcpy(m_samples.data(), payload, m_count * sizeof(int16_t));
+        m_pos = 0;
+        return true;
+    }
+
+    // RTP: version 2, CSRC list and extension header are skipped
+    if (len < RTP_HEADER || (payload[0] >> 6) != 2) {
+        return true;
+    }
+
+    // a malformed datagram is dropped, lengths are checked before they are used
+    ssize_t header = RTP_HEADER + (payload[0] & 0x0f) * 4;
+
+    if (payload[0] & 0x10) {
+        if (len < header + 4) {
+            return true;
+        }
+        header += 4 + ((payload[header + 2] << 8) | payload[header + 3]) * 4;
+    }
+
+    if (len <= header) {
+        return true;
+    }
+
+    if (payload[0] & 0x20) {
+        ssize_t padding = payload[len - 1];
+
+        if (padding == 0 || padding > len - header) {
+            return true;
+        }
+        len -= padding;
+    }
+
+    if (len <= header) {
+        return true;
+    }
+
+    uint32_t ts;
+    memcpy(&ts, payload + 4, sizeof(ts));
+    ts = ntohl(ts);
+    size_t count = (len - header) / sizeof(int16_t);
+
+    if (m_synced) {
+        int32_t diff = (int32_t)(ts - m_nextTs);
+
+        if (diff < 0) {
+            m_late++;
+            return true;
+        }
+
+        if (diff > 0) {
+            if ((uint32_t) diff <= RTP_MAX_GAP_SEC * m_sampleRate) {
+                m_gap = diff;
+                m_lost += diff;
+                FAX_DEBUG("RTP: %d samples missing, filled with silence\n", diff);
+            } else {
+                FAX_WARN("RTP: stream jumped %.1f sec, sender restarted?\n", (double) diff / m_sampleRate);
+            }
+        }
+    }
+
+    m_synced = true;
+    m_nextTs = ts + count;
+
+    // L16 is network byte order
+    const uint8_t *p = payload + header;
+
+    for (size_t i = 0; i < count; i++) {
+        m_samples[i] = (int16_t)((p[2 * i] << 8) | p[2 * i + 1]);
+    }
+
+    m_count = count;
+    m_pos = 0;
+    return true;
+}
+
+size_t UdpPcmSource::Next(int16_t **samples, size_t max)
+{
+    if (m_socket < 0) {
+        return 0;
+    }
+
+    // datagrams without samples (or late ones) are skipped
+    while (m_gap == 0 && m_pos == m_count) {
+        if (!Receive()) {
+            return 0;
+        }
+    }
+
+    if (m_gap > 0) {
+        size_t n = std::min(m_gap, max);
+
+        // a gap may be longer than a packet
+        if (m_samples.size() < m_count + n) {
+            m_samples.resize(m_count + n);
+        }
+
+        int16_t *zero = &m_samples[m_count];
+        memset(zero, 0, n * sizeof(int16_t));
+        m_gap -= n;
+        *samples = zero;
+        return n;
+    }
+
+    size_t n = std::min(m_count - m_pos, max);
+    *samples = &m_samples[m_pos];
+    m_pos += n;
+    return n;
+}
+
+static uint32_t ring_capacity(uint32_t capacity)
+{
+    uint32_t c = 1024;
+
+    while (c < capacity && c < (1u << 30)) {
+        c <<= 1;
+    }
+
+    return c;
+}
+
+static void sleep_us(long us)
+{
+    struct timespec ts = {0, us * 1000};
+    nanosleep(&ts, NULL);
+}
+
+ShmPcmWriter::ShmPcmWriter():
+    m_ring {NULL},
+    m_size {0}
+{
+}
+
+bool ShmPcmWriter::Create(const char *name, uint32_t sample_rate, uint32_t capacity)
+{
+    Close();
+
+    capacity = ring_capacity(capacity);
+    size_t size = PCM_RING_DATA + (size_t) capacity * sizeof(int16_t);
+
+    // a stale ring of a crashed producer is replaced
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0660);
+
+    if (fd < 0) {
+        FAX_ERROR("shm_open(%s) failed: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    if (ftruncate(fd, size) < 0) {
+        FAX_ERROR("ftruncate(%s) failed: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        FAX_ERROR("mmap(%s) failed: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return false;
+    }
+
+    // the new object is zero filled, positions and flags start at 0
+    m_ring = (pcm_ring_t*) p;
+    m_size = size;
+    m_name = name;
+
+    m_ring->version = PCM_RING_VERSION;
+    m_ring->sample_rate = sample_rate;
+    m_ring->capacity = capacity;
+    std::atomic_thread_fence(std::memory_order_release);
+    m_ring->magic = PCM_RING_MAGIC;
+
+    return true;
+}
+
+size_t ShmPcmWriter::Write(const int16_t *samples, size_t count, bool wait)
+{
+    if (m_ring == NULL) {
+        return 0;
+    }
+
+    int16_t *data = (int16_t*)((uint8_t*) m_ring + PCM_RING_DATA);
+    const uint32_t capacity = m_ring->capacity;
+    uint64_t w = m_ring->write_pos.load(std::memory_order_relaxed);
+    size_t written = 0;
+
+    while (written < count) {
+        uint64_t r = m_ring->read_pos.load(std::memory_order_acquire);
+        size_t room = capacity - (size_t)(w - r);
+
+        if (room == 0) {
+            if (!wait) {
+                m_ring->overruns.fetch_add(count - written, std::memory_order_relaxed);
+                break;
+            }
+            sleep_us(PCM_POLL_US);
+            continue;
+        }
+
+        size_t n = std::min(room, count - written);
+        size_t at = w & (capacity - 1);
+        size_t first = std::min(n, (size_t) capacity - at);
+
+        memcpy(&data[at], &samples[written], first * sizeof(int16_t));
+        memcpy(&data[0], &samples[written + first], (n - first) * sizeof(int16_t));
+
+        w += n;
+        written += n;
+        m_ring->write_pos.store(w, std::memory_order_release);
+    }
+
+    return written;
+}
+
+uint64_t ShmPcmWriter::Overruns() const
+{
+    return m_ring? m_ring->overruns.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t ShmPcmWriter::Pending() const
+{
+    if (m_ring == NULL) return 0;
+
+    return m_ring->write_pos.load(std::memory_order_relaxed) - m_ring->read_pos.load(std::memory_order_acquire);
+}
+
+void ShmPcmWriter::Close()
+{
+    if (m_ring == NULL) return;
+
+    m_ring->closed.store(1, std::memory_order_release);
+    munmap(m_ring, m_size);
+    shm_unlink(m_name.c_str());
+    m_ring = NULL;
+}
+
+ShmPcmSource::ShmPcmSource():
+    m_ring {NULL},
+    m_data {NULL},
+    m_size {0},
+    m_held {0},
+    m_eof {false}
+{
+}
+
+ShmPcmSource::~ShmPcmSource()
+{
+    if (m_ring != NULL) {
+        munmap(m_ring, m_size);
+    }
+}
+
+bool ShmPcmSource::Open(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (fd < 0) {
+        FAX_ERROR("shm_open(%s) failed: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < PCM_RING_DATA) {
+        FAX_ERROR("%s is not a PCM ring\n", name);
+        close(fd);
+        return false;
+    }
+
+    m_size = st.st_size;
+    void *p = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        FAX_ERROR("mmap(%s) failed: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    m_ring = (pcm_ring_t*) p;
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (m_ring->magic != PCM_RING_MAGIC || m_ring->version != PCM_RING_VERSION ||
+        (m_ring->capacity & (m_ring->capacity - 1)) != 0 ||
+        PCM_RING_DATA + (size_t) m_ring->capacity * sizeof(int16_t) > m_size) {
+        FAX_ERROR("%s is not a PCM ring of version %d\n", name, PCM_RING_VERSION);
+        munmap(m_ring, m_size);
+        m_ring = NULL;
+        return false;
+    }
+
+    m_data = (int16_t*)((uint8_t*) m_ring + PCM_RING_DATA);
+
+    FAX_INFO("Reading PCM ring %s, %u samples, %u samples/sec\n", name, m_ring->capacity, m_ring->sample_rate);
+    return true;
+}
+
+size_t ShmPcmSource::Next(int16_t **samples, size_t max)
+{
+    if (m_ring == NULL) {
+        return 0;
+    }
+
+    // the previous block goes back to the producer
+    uint64_t r = m_ring->read_pos.load(std::memory_order_relaxed) + m_held;
+    m_ring->read_pos.store(r, std::memory_order_release);
+    m_held = 0;
+
+    const uint32_t capacity = m_ring->capacity;
+    uint64_t w;
+
+    for (int32_t waited = 0; (w = m_ring->write_pos.load(std::memory_order_acquire)) == r; waited += PCM_POLL_US) {
+        if (m_ring->closed.load(std::memory_order_acquire)) {
+            // nothing was written after the last look at write_pos
+            if (m_ring->write_pos.load(std::memory_order_acquire) == r) {
+                m_eof = true;
+                return 0;
+            }
+            continue;
+        }
+
+        if (waited >= PCM_IDLE_MS * 1000) {
+            return 0;
+        }
+
+        sleep_us(PCM_POLL_US);
+    }
+
+    size_t at = r & (capacity - 1);
+    size_t n = std::min({(size_t)(w - r), max, (size_t) capacity - at});
+
+    *samples = &m_data[at];
+    m_held = n;
+    return n;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Input of the decoder: 16 bit mono PCM from a file, a socket or a shared
+// memory ring written by a co-located SDR process.
+class PcmSource
+{
+public:
+    virtual ~PcmSource() {}
+
+    // Up to max samples. The block stays valid, and may be modified in place,
+    // until the next call. 0 when nothing arrived for a while (live inputs)
+    // or at the end of the input, see Eof().
+    virtual size_t Next(int16_t **samples, size_t max) = 0;
+    virtual bool Eof() const = 0;
+    virtual uint32_t SampleRate() const = 0;
+    // Samples lost in transport: filled with silence (RTP) or dropped by the producer (ring)
+    virtual uint64_t Lost() const { return 0; }
+};
+
+// WAV data or raw PCM from a file, pipe or FIFO, after the header was read
+class FilePcmSource : public PcmSource
+{
+public:
+    FilePcmSource(FILE *file, uint32_t sample_rate, size_t buf_samples);
+    ~FilePcmSource();
+
+    size_t Next(int16_t **samples, size_t max) override;
+    bool Eof() const override { return m_eof; }
+    uint32_t SampleRate() const override { return m_sampleRate; }
+
+private:
+    FILE *m_file;
+    int16_t *m_buf;
+    size_t m_bufSamples;
+    uint32_t m_sampleRate;
+    bool m_eof;
+};
+
+// UDP datagrams of PCM.
+//
+// RAW: native 16 bit samples and nothing else, what gqrx and SDR++ send.
+// Losses can't be seen.
+// RTP: L16 payload (big endian) in RTP packets, as sent by ka9q-radio or
+// ffmpeg. The RTP timestamp counts samples: a gap is filled with silence so
+// the lines after it stay in place, late and duplicated packets are dropped.
+class UdpPcmSource : public PcmSource
+{
+public:
+    enum Format {RAW, RTP};
+
+    UdpPcmSource();
+    ~UdpPcmSource();
+
+    // "[address:]port", a multicast address is joined
+    bool Open(const char *spec, Format format, uint32_t sample_rate);
+
+    size_t Next(int16_t **samples, size_t max) override;
+    bool Eof() const override { return m_socket < 0; }
+    uint32_t SampleRate() const override { return m_sampleRate; }
+    uint64_t Lost() const override { return m_lost; }
+    uint64_t Late() const { return m_late; }
+
+private:
+    bool Receive();
+
+    int m_socket;
+    Format m_format;
+    uint32_t m_sampleRate;
+    std::vector<uint8_t> m_packet;
+    std::vector<int16_t> m_samples;     // of the last packet
+    size_t m_pos, m_count;
+    size_t m_gap;                       // silence to deliver before m_samples
+    bool m_synced;
+    uint32_t m_nextTs;
+    uint64_t m_lost, m_late;
+};
+
+// Single producer, single consumer ring in POSIX shared memory.
+//
+// The producer creates /name, the decoder maps it and reads the samples where
+// the producer wrote them. Positions count samples since the creation and
+// only grow, the producer owns write_pos, the consumer read_pos. A full ring
+// is not waited for by a live producer: what does not fit is counted in
+// overruns and dropped.
+#define PCM_RING_MAGIC      0x5043524du     // "MRCP"
+#define PCM_RING_VERSION    1
+#define PCM_RING_DATA       256             // offset of the samples
+
+struct pcm_ring_t {
+    uint32_t magic;             // set last by the producer
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t capacity;          // samples, a power of two
+    std::atomic<uint32_t> closed;               // no more samples will come
+    alignas(64) std::atomic<uint64_t> write_pos;
+    alignas(64) std::atomic<uint64_t> read_pos;
+    alignas(64) std::atomic<uint64_t> overruns; // samples
+};
+
+static_assert(sizeof(pcm_ring_t) <= PCM_RING_DATA, "ring header too large");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions must be lock free");
+
+class ShmPcmWriter
+{
+public:
+    ShmPcmWriter();
+    ~ShmPcmWriter() { Close(); }
+
+    // capacity is rounded up to a power of two
+    bool Create(const char *name, uint32_t sample_rate, uint32_t capacity);
+    // Without wait what does not fit is dropped and counted. Returns the samples written.
+    size_t Write(const int16_t *samples, size_t count, bool wait);
+    uint64_t Overruns() const;
+    // Written and not yet consumed
+    uint64_t Pending() const;
+    // Marks the end of the stream and removes the name, a consumer drains what is left
+    void Close();
+
+private:
+    pcm_ring_t *m_ring;
+    size_t m_size;
+    std::string m_name;
+};
+
+class ShmPcmSource : public PcmSource
+{
+public:
+    ShmPcmSource();
+    ~ShmPcmSource();
+
+    bool Open(const char *name);
+
+    size_t Next(int16_t **samples, size_t max) override;
+    bool Eof() const override { return m_eof; }
+    uint32_t SampleRate() const override { return m_ring? m_ring->sample_rate : 0; }
+    uint64_t Lost() const override { return m_ring? m_ring->overruns.load(std::memory_order_relaxed) : 0; }
+
+private:
+    pcm_ring_t *m_ring;
+    int16_t *m_data;
+    size_t m_size;
+    size_t m_held;          // samples handed out by the last call
+    bool m_eof;
+};
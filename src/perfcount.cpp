@@ -0,0 +1,133 @@
+#include "perfcount.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char *event_names[FAX_PERF_COUNT] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+const char *fax_perf_name(int32_t event)
+{
+    return (event >= 0 && event < FAX_PERF_COUNT)? event_names[event] : "unknown";
+}
+
+void fax_perf_delta(const FaxPerfReading *from, const FaxPerfReading *to, uint64_t delta[FAX_PERF_COUNT])
+{
+    // raw totals only grow, a scaled total could go down between readings
+    uint64_t enabled = to->enabled - from->enabled;
+    uint64_t running = to->running - from->running;
+    double scale = (running > 0 && running < enabled)? (double)enabled / running : 1.0;
+
+    for (int32_t i = 0; i < FAX_PERF_COUNT; i++) {
+        delta[i] = (to->value[i] > from->value[i])? (uint64_t)((to->value[i] - from->value[i]) * scale) : 0;
+    }
+}
+
+#ifdef __linux__
+
+static const uint64_t event_configs[FAX_PERF_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static int open_event(uint64_t config, int group_fd)
+{
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof pe);
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof pe;
+    pe.config = config;
+    pe.disabled = (group_fd == -1);     // the leader starts the whole group
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(__NR_perf_event_open, &pe, 0, -1, group_fd, 0);
+}
+
+bool fax_perf_open(FaxPerfCounters *perf)
+{
+    for (int32_t i = 0; i < FAX_PERF_COUNT; i++) {
+        perf->fd[i] = -1;
+    }
+
+    for (int32_t i = 0; i < FAX_PERF_COUNT; i++) {
+        perf->fd[i] = open_event(event_configs[i], (i == 0)? -1 : perf->fd[0]);
+
+        if (perf->fd[i] < 0) {
+            int err = errno;
+            fax_perf_close(perf);
+            errno = err;
+            return false;
+        }
+    }
+
+    ioctl(perf->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    return true;
+}
+
+bool fax_perf_read(const FaxPerfCounters *perf, FaxPerfReading *reading)
+{
+    // nr, time_enabled, time_running, then one value per event
+    uint64_t buf[3 + FAX_PERF_COUNT];
+
+    if (perf->fd[0] < 0 || read(perf->fd[0], buf, sizeof buf) != sizeof buf || buf[0] != FAX_PERF_COUNT) {
+        return false;
+    }
+
+    reading->enabled = buf[1];
+    reading->running = buf[2];
+
+    for (int32_t i = 0; i < FAX_PERF_COUNT; i++) {
+        reading->value[i] = buf[3 + i];
+    }
+
+    return true;
+}
+
+void fax_perf_close(FaxPerfCounters *perf)
+{
+    // members first, the leader last
+    for (int32_t i = FAX_PERF_COUNT - 1; i >= 0; i--) {
+        if (perf->fd[i] >= 0) {
+            close(perf->fd[i]);
+            perf->fd[i] = -1;
+        }
+    }
+}
+
+#else
+
+bool fax_perf_open(FaxPerfCounters *perf)
+{
+    for (int32_t i = 0; i < FAX_PERF_COUNT; i++) {
+        perf->fd[i] = -1;
+    }
+
+    errno = ENOSYS;
+    return false;
+}
+
+bool fax_perf_read(const FaxPerfCounters *, FaxPerfReading *)
+{
+    return false;
+}
+
+void fax_perf_close(FaxPerfCounters *)
+{
+}
+
+#endif
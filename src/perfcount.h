@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+// Hardware performance counters of the calling thread (Linux perf_event_open),
+// user space only. The counters are one group, so they are always scheduled
+// together and their ratios (IPC) are consistent.
+
+enum FaxPerfEvent {
+    FAX_PERF_CYCLES,
+    FAX_PERF_INSTRUCTIONS,
+    FAX_PERF_CACHE_MISSES,
+    FAX_PERF_BRANCH_MISSES,
+    FAX_PERF_COUNT
+};
+
+struct FaxPerfCounters {
+    int fd[FAX_PERF_COUNT];
+};
+
+const char *fax_perf_name(int32_t event);
+
+// False when the kernel or the machine (VMs often) does not provide the events,
+// errno tells why
+bool fax_perf_open(FaxPerfCounters *perf);
+
+// Raw running totals and the time the group was enabled and running
+struct FaxPerfReading {
+    uint64_t enabled, running;
+    uint64_t value[FAX_PERF_COUNT];
+};
+
+bool fax_perf_read(const FaxPerfCounters *perf, FaxPerfReading *reading);
+
+// Counts between two readings, scaled up by the share of that interval the
+// group was running when it was multiplexed with other users
+void fax_perf_delta(const FaxPerfReading *from, const FaxPerfReading *to, uint64_t delta[FAX_PERF_COUNT]);
+
+void fax_perf_close(FaxPerfCounters *perf);
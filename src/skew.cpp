@@ -0,0 +1,130 @@
+#include "skew.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+// Variance of the column profile of circularly sheared rows.
+// Row k is read starting at column round(drift * k), i.e. a feature moving right
+// by "drift" pixels each line ends up in the same profile column.
+static double projection_score(const uint8_t *img, int32_t width, int32_t count, double drift, int64_t *profile)
+{
+    std::fill(profile, profile + width, 0);
+
+    for (int32_t k = 0; k < count; k++) {
+        const uint8_t *row = img + (size_t)k * width;
+        int32_t shift = (int32_t)lround(drift * k) % width;
+
+        if (shift < 0) {
+            shift += width;
+        }
+
+        // two straight loops instead of a modulo for every pixel
+        int32_t x = 0;
+        for (int32_t s = shift; s < width; x++, s++) {
+            profile[x] += row[s];
+        }
+        for (int32_t s = 0; x < width; x++, s++) {
+            profile[x] += row[s];
+        }
+    }
+
+    double sum = 0, sum2 = 0;
+
+    for (int32_t x = 0; x < width; x++) {
+        sum += profile[x];
+        sum2 += (double)profile[x] * profile[x];
+    }
+
+    return sum2 / width - (sum / width) * (sum / width);
+}
+
+bool skew_estimate(const uint8_t *lines, int32_t width, int32_t count, double srcorr,
+                   double max_ppm, int32_t downsample, int32_t nthreads, skew_estimate_t *res)
+{
+    if (lines == NULL || res == NULL || width <= 0 || count < 2) {
+        return false;
+    }
+
+    if (downsample < 1) {
+        downsample = 1;
+    }
+
+    const int32_t ds_width = width / downsample;
+
+    if (ds_width < 16) {
+        return false;
+    }
+
+    // Downsampled copy, each pixel is an average of "downsample" neighbours
+    std::vector<uint8_t> preview((size_t)ds_width * count);
+
+    for (int32_t k = 0; k < count; k++) {
+        const uint8_t *src = lines + (size_t)k * width;
+        uint8_t *dst = &preview[(size_t)k * ds_width];
+
+        for (int32_t x = 0; x < ds_width; x++) {
+            int32_t acc = 0;
+            for (int32_t j = 0; j < downsample; j++) {
+                acc += src[x * downsample + j];
+            }
+            dst[x] = acc / downsample;
+        }
+    }
+
+    // Half a preview pixel over the whole block is the finest step worth trying
+    const double step = 0.5 / count;
+    const double max_drift = max_ppm / 1000000.0 * ds_width;
+    const int32_t half = std::max(1, (int32_t)ceil(max_drift / step));
+    const int32_t ncand = half * 2 + 1;
+
+    std::vector<double> scores(ncand);
+
+    if (nthreads <= 0) {
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    nthreads = std::min(nthreads, ncand);
+
+    auto worker = [&](int32_t first) {
+        std::vector<int64_t> profile(ds_width);
+
+        for (int32_t i = first; i < ncand; i += nthreads) {
+            scores[i] = projection_score(preview.data(), ds_width, count, (i - half) * step, profile.data());
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (int32_t t = 1; t < nthreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    int32_t best = std::max_element(scores.begin(), scores.end()) - scores.begin();
+    double offset = 0;
+
+    // parabolic interpolation between the neighbouring candidates
+    if (best > 0 && best < ncand - 1) {
+        double l = scores[best - 1], c = scores[best], r = scores[best + 1];
+        double denom = l - 2 * c + r;
+
+        if (denom < 0) {
+            offset = 0.5 * (l - r) / denom;
+        }
+    }
+
+    std::vector<double> sorted = scores;
+    std::nth_element(sorted.begin(), sorted.begin() + ncand / 2, sorted.end());
+    double median = sorted[ncand / 2];
+
+    res->drift = ((best - half) + offset) * step * downsample;
+    res->ppm = (srcorr * (1.0 + res->drift / width) - 1.0) * 1000000.0;
+    res->confidence = (median > 0)? scores[best] / median : 0;
+
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Result of the image-domain slant search.
+struct skew_estimate_t {
+    double drift;       // horizontal drift of image features, full-width pixels per line
+    double ppm;         // sample rate correction in millionth parts, as accepted by "-s"
+    double confidence;  // best projection score over the median score, ~1.0 means no structure
+};
+
+// Estimate slant of already decoded fax lines by a projection-profile search.
+//
+// Lines are taken row by row (width pixels each) and horizontally downsampled by
+// the given factor. For every candidate drift the rows are circularly sheared and
+// summed into a column profile; the straightest image has the most "peaky" profile
+// (vertical margins, grid lines and phasing pulses add up in the same columns).
+// Candidates are split between nthreads worker threads (0 means all cores).
+//
+// srcorr is the correction the lines were decoded with, max_ppm limits the search.
+bool skew_estimate(const uint8_t *lines, int32_t width, int32_t count, double srcorr,
+                   double max_ppm, int32_t downsample, int32_t nthreads, skew_estimate_t *res);
@@ -0,0 +1,161 @@
+#include "spectrum.h"
+#include "fft.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+int32_t welch_psd(const int16_t *samples, size_t count, int32_t fft_size, int32_t nthreads, double *psd)
+{
+    const int32_t n = fft_size_pow2(fft_size);
+    const int32_t hop = n / 2;
+
+    if (count < (size_t)n) {
+        return 0;
+    }
+
+    const int32_t segments = (count - n) / hop + 1;
+
+    std::vector<float> window(n);
+
+    for (int32_t i = 0; i < n; i++) {
+        window[i] = 0.5 - 0.5 * cos(K_2PI * i / (n - 1));
+    }
+
+    // shared by the threads
+    const FftPlan *plan = fft_plan(n, false);
+
+    if (nthreads <= 0) {
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    nthreads = std::min(nthreads, segments);
+
+    std::vector<std::vector<double>> partial(nthreads, std::vector<double>(n / 2, 0.0));
+
+    auto worker = [&](int32_t t) {
+        std::vector<tSComplex> buf(n);
+        double *acc = partial[t].data();
+
+        for (int32_t s = t; s < segments; s += nthreads) {
+            const int16_t *seg = samples + (size_t)s * hop;
+
+            for (int32_t i = 0; i < n; i++) {
+                buf[i].re = seg[i] * window[i];
+                buf[i].im = 0;
+            }
+
+            plan->Execute(buf.data());
+
+            for (int32_t i = 0; i < n / 2; i++) {
+                acc[i] += (double)buf[i].re * buf[i].re + (double)buf[i].im * buf[i].im;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (int32_t t = 1; t < nthreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (int32_t i = 0; i < n / 2; i++) {
+        double sum = 0;
+        for (int32_t t = 0; t < nthreads; t++) {
+            sum += partial[t][i];
+        }
+        psd[i] = sum / segments;
+    }
+
+    return n;
+}
+
+// Highest bin in [from, to), -1 if the range is empty
+static int32_t peak_bin(const double *psd, int32_t from, int32_t to)
+{
+    int32_t best = -1;
+
+    for (int32_t i = MAX(from, 1); i < to; i++) {
+        if (best < 0 || psd[i] > psd[best]) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+// Parabolic interpolation of the peak on log power, in bins
+static double peak_refine(const double *psd, int32_t bin, int32_t bins)
+{
+    if (bin <= 0 || bin >= bins - 1) {
+        return bin;
+    }
+
+    double l = log(psd[bin - 1] + 1e-20), c = log(psd[bin] + 1e-20), r = log(psd[bin + 1] + 1e-20);
+    double denom = l - 2 * c + r;
+
+    return (denom < 0)? bin + 0.5 * (l - r) / denom : bin;
+}
+
+bool carrier_scan(const int16_t *samples, size_t count, uint32_t sample_rate, double default_deviation,
+                  int32_t nthreads, carrier_estimate_t *res)
+{
+    // ~3 Hz resolution is plenty to tune a 800 Hz shift
+    const int32_t n = fft_size_pow2(sample_rate / 3);
+    const int32_t bins = n / 2;
+    std::vector<double> psd(bins);
+
+    if (welch_psd(samples, count, n, nthreads, psd.data()) == 0) {
+        return false;
+    }
+
+    const double hz = (double)sample_rate / n;
+    const int32_t lo = 800 / hz, hi = MIN(bins, (int32_t)(3200 / hz));
+
+    if (hi <= lo) {
+        return false;
+    }
+
+    // noise floor as a median of the searched band
+    std::vector<double> band(psd.begin() + lo, psd.begin() + hi);
+    std::nth_element(band.begin(), band.begin() + band.size() / 2, band.end());
+    double floor = band[band.size() / 2] + 1e-20;
+
+    int32_t strong = peak_bin(psd.data(), lo, hi);
+    const int32_t near = 500 / hz, far = 1100 / hz;
+    int32_t below = peak_bin(psd.data(), MAX(1, strong - far), MAX(1, strong - near));
+    int32_t above = peak_bin(psd.data(), MIN(bins, strong + near), MIN(bins, strong + far));
+    int32_t other = -1;
+
+    if (below >= 0 && (above < 0 || psd[below] >= psd[above])) {
+        other = below;
+    } else {
+        other = above;
+    }
+
+    double f_strong = peak_refine(psd.data(), strong, bins) * hz;
+
+    // the other tone must stand out of the noise at least 6 dB
+    res->paired = other >= 0 && psd[other] > 4 * floor;
+
+    if (res->paired) {
+        double f_other = peak_refine(psd.data(), other, bins) * hz;
+
+        res->black = MIN(f_strong, f_other);
+        res->white = MAX(f_strong, f_other);
+        res->confidence = 10 * log10(psd[other] / floor);
+    } else {
+        res->white = f_strong;
+        res->black = f_strong - 2 * default_deviation;
+        res->confidence = 10 * log10(psd[strong] / floor);
+    }
+
+    res->carrier = (res->black + res->white) / 2;
+    res->deviation = (res->white - res->black) / 2;
+
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Black/white tone pair found in the spectrum of a recording
+struct carrier_estimate_t {
+    double black;       // Hz
+    double white;       // Hz
+    double carrier;     // (black + white) / 2
+    double deviation;   // (white - black) / 2
+    double confidence;  // weaker tone over the noise floor, dB
+    bool paired;        // false when only one tone was found and deviation is assumed
+};
+
+// Welch-averaged power spectrum (Hann window, 50% overlap) of the given samples,
+// segments are spread over nthreads worker threads (0 means all cores).
+// psd receives fft_size/2 bins, fft_size is rounded up to a power of 2.
+int32_t welch_psd(const int16_t *samples, size_t count, int32_t fft_size, int32_t nthreads, double *psd);
+
+// Estimate fax black/white tones from a (decimated) subset of a recording.
+// The strongest peak between 800 and 3200 Hz is taken as one tone, the strongest
+// peak 500..1100 Hz away from it as the other. If there is none, default_deviation
+// is assumed and the strong tone is taken as white (fax charts are mostly white).
+bool carrier_scan(const int16_t *samples, size_t count, uint32_t sample_rate, double default_deviation,
+                  int32_t nthreads, carrier_estimate_t *res);
@@ -0,0 +1,87 @@
+#include "stats.h"
+
+#include <cinttypes>
+#include <cstring>
+#include <sys/resource.h>
+
+static const char *stage_names[FAX_STAGE_COUNT] = {
+    "read", "dc", "resample", "fir", "demod", "header", "phasing", "line", "write"
+};
+
+const char *fax_stage_name(int32_t stage)
+{
+    return (stage >= 0 && stage < FAX_STAGE_COUNT)? stage_names[stage] : "unknown";
+}
+
+void fax_stats_reset(FaxStats *stats)
+{
+    memset(stats, 0, sizeof(FaxStats));
+    stats->created_wall_ns = fax_clock_ns(CLOCK_MONOTONIC);
+    stats->created_cpu_ns = fax_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+int64_t fax_peak_rss_kb()
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return -1;
+    }
+
+    // kilobytes on Linux, bytes on macOS
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
+void fax_stats_json(const FaxStats *stats, FILE *f)
+{
+    const double wall = (fax_clock_ns(CLOCK_MONOTONIC) - stats->created_wall_ns) / 1e9;
+    const double cpu = (fax_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - stats->created_cpu_ns) / 1e9;
+    const double audio = stats->sample_rate > 0? stats->samples / stats->sample_rate : 0;
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"sample_rate\": %.0f,\n", stats->sample_rate);
+    fprintf(f, "  \"lpm\": %d,\n", stats->lpm);
+    fprintf(f, "  \"samples\": %" PRIu64 ",\n", stats->samples);
+    fprintf(f, "  \"audio_sec\": %.3f,\n", audio);
+    fprintf(f, "  \"wall_sec\": %.6f,\n", wall);
+    fprintf(f, "  \"cpu_sec\": %.6f,\n", cpu);
+    fprintf(f, "  \"realtime_factor\": %.2f,\n", wall > 0? audio / wall : 0);
+    fprintf(f, "  \"stages\": {\n");
+
+    for (int32_t i = 0; i < FAX_STAGE_COUNT; i++) {
+        const FaxStageTime &s = stats->stage[i];
+
+        fprintf(f, "    \"%s\": {\"wall_sec\": %.6f, \"cpu_sec\": %.6f, \"calls\": %" PRIu64 ", \"ns_per_sample\": %.2f",
+            fax_stage_name(i), s.wall_ns / 1e9, s.cpu_ns / 1e9, s.calls,
+            stats->samples? (double)s.wall_ns / stats->samples : 0.0);
+
+        if (stats->perf != NULL) {
+            const uint64_t *p = stats->perf_count[i];
+            const double samples = stats->samples? stats->samples : 1;
+
+            fprintf(f, ",\n      \"perf\": {");
+            for (int32_t e = 0; e < FAX_PERF_COUNT; e++) {
+                fprintf(f, "\"%s\": %" PRIu64 ", ", fax_perf_name(e), p[e]);
+            }
+            // per input sample, to compare rates and stations
+            fprintf(f, "\"ipc\": %.3f, \"cycles_per_sample\": %.2f, \"cache_misses_per_sample\": %.4f, "
+                       "\"branch_misses_per_sample\": %.4f}",
+                p[FAX_PERF_CYCLES]? (double)p[FAX_PERF_INSTRUCTIONS] / p[FAX_PERF_CYCLES] : 0.0,
+                p[FAX_PERF_CYCLES] / samples, p[FAX_PERF_CACHE_MISSES] / samples, p[FAX_PERF_BRANCH_MISSES] / samples);
+        }
+
+        fprintf(f, "}%s\n", (i + 1 < FAX_STAGE_COUNT)? "," : "");
+    }
+
+    fprintf(f, "  },\n");
+    fprintf(f, "  \"lines\": {\"decoded\": %" PRIu64 ", \"emitted\": %" PRIu64 "},\n", stats->lines_decoded, stats->lines_emitted);
+    fprintf(f, "  \"events\": {\"start\": %u, \"stop\": %u, \"phasing_accepted\": %u, \"phasing_rejected\": %u},\n",
+        stats->start_events, stats->stop_events, stats->phasing_accepted, stats->phasing_rejected);
+    fprintf(f, "  \"peak_rss_kb\": %" PRId64 "\n", fax_peak_rss_kb());
+    fprintf(f, "}\n");
+    fflush(f);
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <time.h>
+
+#include "perfcount.h"
+
+// Decoder telemetry: wall and CPU time per processing stage plus event
+// counters, optionally hardware counters too. Timers are per line or per
+// buffer, never per sample, so the cost is a few clock reads per line.
+
+enum FaxStage {
+    FAX_STAGE_READ,         // input file reads
+    FAX_STAGE_DC,           // DC removal
+    FAX_STAGE_RESAMPLE,     // sample rate correction into the line buffer
+    FAX_STAGE_FIR,          // mixer and FIR low pass filters
+    FAX_STAGE_DEMOD,        // FM discriminator and AFC
+    FAX_STAGE_HEADER,       // START/STOP detection
+    FAX_STAGE_PHASING,      // phasing line position and decision
+    FAX_STAGE_LINE,         // pixels from the demodulated line, line blending
+    FAX_STAGE_WRITE,        // output file
+    FAX_STAGE_COUNT
+};
+
+struct FaxStageTime {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    uint64_t calls;
+};
+
+class FaxStageTimer;
+
+struct FaxStats {
+    FaxStageTime stage[FAX_STAGE_COUNT];
+
+    double sample_rate;
+    int32_t lpm;
+    uint64_t samples;               // handed to the decoder
+    uint64_t lines_decoded;         // demodulated lines, headers included
+    uint64_t lines_emitted;         // image lines passed to the output
+    uint32_t start_events, stop_events;
+    uint32_t phasing_accepted, phasing_rejected;
+
+    uint64_t created_wall_ns, created_cpu_ns;
+    FaxStageTimer *current;         // innermost running timer
+
+    // hardware counters, NULL when not used
+    const FaxPerfCounters *perf;
+    uint64_t perf_count[FAX_STAGE_COUNT][FAX_PERF_COUNT];
+};
+
+const char *fax_stage_name(int32_t stage);
+
+void fax_stats_reset(FaxStats *stats);
+
+// Peak resident set size of the process in kB
+int64_t fax_peak_rss_kb();
+
+void fax_stats_json(const FaxStats *stats, FILE *f);
+
+static inline uint64_t fax_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Scoped stage timer, does nothing without stats. Time is exclusive: a nested
+// timer (line decode -> file write) pauses the enclosing one.
+class FaxStageTimer
+{
+public:
+    FaxStageTimer(FaxStats *stats, FaxStage stage):
+        m_stats {stats},
+        m_stage {stage}
+    {
+        if (m_stats == NULL) {
+            return;
+        }
+
+        m_wall = fax_clock_ns(CLOCK_MONOTONIC);
+        m_cpu = fax_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        m_parent = m_stats->current;
+        m_perfValid = m_stats->perf != NULL && fax_perf_read(m_stats->perf, &m_perf);
+
+        if (m_parent != NULL) {
+            m_parent->Accumulate(m_wall, m_cpu, m_perf, m_perfValid);
+        }
+
+        m_stats->current = this;
+        m_stats->stage[m_stage].calls++;
+    }
+
+    ~FaxStageTimer()
+    {
+        if (m_stats == NULL) {
+            return;
+        }
+
+        uint64_t wall = fax_clock_ns(CLOCK_MONOTONIC);
+        uint64_t cpu = fax_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        FaxPerfReading perf;
+        bool perf_valid = m_stats->perf != NULL && fax_perf_read(m_stats->perf, &perf);
+
+        Accumulate(wall, cpu, perf, perf_valid);
+        m_stats->current = m_parent;
+
+        // the enclosing stage goes on from here, not from where this one started
+        if (m_parent != NULL) {
+            m_parent->m_wall = wall;
+            m_parent->m_cpu = cpu;
+            m_parent->m_perf = perf;
+            m_parent->m_perfValid = perf_valid;
+        }
+    }
+
+private:
+    // Counters only when both readings succeeded, the interval is lost otherwise
+    void Accumulate(uint64_t wall, uint64_t cpu, const FaxPerfReading &perf, bool perf_valid)
+    {
+        m_stats->stage[m_stage].wall_ns += wall - m_wall;
+        m_stats->stage[m_stage].cpu_ns += cpu - m_cpu;
+        m_wall = wall;
+        m_cpu = cpu;
+
+        if (m_perfValid && perf_valid) {
+            uint64_t delta[FAX_PERF_COUNT];
+
+            fax_perf_delta(&m_perf, &perf, delta);
+            for (int32_t i = 0; i < FAX_PERF_COUNT; i++) {
+                m_stats->perf_count[m_stage][i] += delta[i];
+            }
+        }
+        m_perf = perf;
+        m_perfValid = perf_valid;
+    }
+
+    FaxStats *m_stats;
+    FaxStage m_stage;
+    FaxStageTimer *m_parent;
+    uint64_t m_wall, m_cpu;
+    FaxPerfReading m_perf;
+    bool m_perfValid;
+};
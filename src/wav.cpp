@@ -0,0 +1,40 @@
+#include "wav.h"
+
+#include <cstring>
+
+void wav_header_fill(wav_header_t *hdr, uint32_t sample_rate, uint16_t channels, uint64_t data_bytes)
+{
+    const uint64_t max_bytes = UINT32_MAX - sizeof(wav_header_t);
+
+    if (data_bytes > max_bytes) {
+        data_bytes = max_bytes;
+    }
+
+    memcpy(hdr->signature, "RIFF", 4);
+    memcpy(hdr->file_type, "WAVE", 4);
+    memcpy(hdr->format_marker, "fmt ", 4);
+    memcpy(hdr->data_marker, "data", 4);
+
+    hdr->format_header_length = 16;
+    hdr->sample_type = 1;
+    hdr->channels = channels;
+    hdr->sample_rate = sample_rate;
+    hdr->bytes_per_sample = channels * sizeof(int16_t);
+    hdr->bytes_per_second = sample_rate * hdr->bytes_per_sample;
+    hdr->bit_depth = 16;
+    hdr->data_size = data_bytes;
+    hdr->fileSize = data_bytes + sizeof(wav_header_t) - 8;
+}
+
+bool wav_write_header(FILE *fd, uint32_t sample_rate, uint16_t channels, uint64_t data_bytes)
+{
+    wav_header_t hdr;
+
+    wav_header_fill(&hdr, sample_rate, channels, data_bytes);
+
+    if (fseek(fd, 0, SEEK_SET) != 0) {
+        return false;
+    }
+
+    return fwrite(&hdr, sizeof(wav_header_t), 1, fd) == 1;
+}
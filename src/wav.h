@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+struct wav_header_t {
+    char signature[4];            // "RIFF"
+    uint32_t fileSize;            // data bytes + sizeof(WavHeader_t) - 8
+    char file_type[4];            // "WAVE"
+    char format_marker[4];        // "fmt "
+    uint32_t format_header_length;// Always 16
+    uint16_t sample_type;         // PCM (1)
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t bytes_per_second;
+    uint16_t bytes_per_sample;
+    uint16_t bit_depth;
+    char data_marker[4];          // "data"
+    uint32_t data_size;
+};
+
+// Fill in a 16 bit PCM header, data_bytes is limited to what the 32 bit size fields can hold
+void wav_header_fill(wav_header_t *hdr, uint32_t sample_rate, uint16_t channels, uint64_t data_bytes);
+
+// Write (or rewrite at the start of the file) a 16 bit PCM header
+bool wav_write_header(FILE *fd, uint32_t sample_rate, uint16_t channels, uint64_t data_bytes);